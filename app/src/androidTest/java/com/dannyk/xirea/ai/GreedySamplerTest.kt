@@ -0,0 +1,24 @@
+package com.dannyk.xirea.ai
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+
+/**
+ * Checks the native argmax fast path against llama.cpp's greedy sampler.
+ * Runs on a device because it needs the native library; no model is loaded.
+ */
+@RunWith(AndroidJUnit4::class)
+class GreedySamplerTest {
+    @Test
+    fun argmaxMatchesReferenceGreedy() {
+        val llamaCpp = LlamaCpp()
+        // Vocab sizes of common small models plus odd sizes that exercise the scalar tail
+        for (nVocab in intArrayOf(1, 17, 32000, 151936, 262144, 262147)) {
+            assertTrue("n_vocab=$nVocab", llamaCpp.checkGreedySampler(nVocab, 50))
+        }
+    }
+}
@@ -0,0 +1,56 @@
+package com.dannyk.xirea.ai
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+
+/**
+ * Checks that token pieces splitting multi-byte characters are only delivered as whole
+ * characters. Runs on a device because it needs the native library; no model is loaded.
+ */
+@RunWith(AndroidJUnit4::class)
+class Utf8AssemblerTest {
+    private val llamaCpp = LlamaCpp()
+
+    // Every way of cutting the text into two pieces must reassemble to the same string
+    private fun assertAllSplits(text: String) {
+        val bytes = text.toByteArray(Charsets.UTF_8)
+        for (cut in 0..bytes.size) {
+            val out = llamaCpp.assembleUtf8(
+                arrayOf(bytes.copyOfRange(0, cut), bytes.copyOfRange(cut, bytes.size))
+            )
+            assertEquals("cut=$cut", text, out.joinToString(""))
+            for (chunk in out) {
+                assertFalse("cut=$cut", chunk.contains('�'))
+            }
+        }
+    }
+
+    @Test
+    fun splitCodepointsReassemble() {
+        assertAllSplits("héllo")
+        assertAllSplits("中文分词")
+        assertAllSplits("اردو زبان")
+        assertAllSplits("ok 😀👍🏽 done")
+    }
+
+    @Test
+    fun byteAtATimeReleasesWholeCharacters() {
+        val bytes = "a😀b".toByteArray(Charsets.UTF_8)
+        val out = llamaCpp.assembleUtf8(Array(bytes.size) { byteArrayOf(bytes[it]) })
+        assertArrayEquals(arrayOf("a", "", "", "", "😀", "b", ""), out)
+    }
+
+    @Test
+    fun malformedBytesBecomeReplacementCharacters() {
+        val stray = byteArrayOf(0x80.toByte(), 'x'.code.toByte())
+        assertEquals("�x", llamaCpp.assembleUtf8(arrayOf(stray)).joinToString(""))
+
+        // A character cut off at the end of the stream is flushed as one replacement
+        val truncated = byteArrayOf(0xF0.toByte(), 0x9F.toByte())
+        assertArrayEquals(arrayOf("", "�"), llamaCpp.assembleUtf8(arrayOf(truncated)))
+    }
+}
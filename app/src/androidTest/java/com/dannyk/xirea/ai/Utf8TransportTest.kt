@@ -0,0 +1,42 @@
+package com.dannyk.xirea.ai
+
+import androidx.test.ext.junit.runners.AndroidJUnit4
+
+import org.junit.Test
+import org.junit.runner.RunWith
+
+import org.junit.Assert.*
+
+/**
+ * Checks that strings reach native code as standard UTF-8, not JNI's modified UTF-8.
+ * Runs on a device because it needs the native library; no model is loaded.
+ */
+@RunWith(AndroidJUnit4::class)
+class Utf8TransportTest {
+    private val llamaCpp = LlamaCpp()
+
+    @Test
+    fun supplementaryCharactersAreFourBytes() {
+        for (text in listOf("", "plain ascii", "héllo", "中文", "اردو", "ok 😀👍🏽 done", "a\u0000b")) {
+            assertArrayEquals(text, text.toByteArray(Charsets.UTF_8), llamaCpp.encodeUtf8(text))
+        }
+        assertEquals(4, llamaCpp.encodeUtf8("😀").size)
+    }
+
+    @Test
+    fun emojiRoundTripThroughNative() {
+        // Java -> native (encodeUtf8) -> Java (the conversion formatChat and the token
+        // callbacks use)
+        for (text in listOf("ok 😀👍🏽 done", "👨‍👩‍👧", "中文 🀄", "😀")) {
+            val bytes = llamaCpp.encodeUtf8(text)
+            assertEquals(text, llamaCpp.assembleUtf8(arrayOf(bytes)).joinToString(""))
+        }
+    }
+
+    @Test
+    fun unpairedSurrogatesBecomeReplacementCharacters() {
+        val replacement = "�".toByteArray(Charsets.UTF_8)
+        assertArrayEquals(replacement, llamaCpp.encodeUtf8("\uD83D"))
+        assertArrayEquals(replacement + "x".toByteArray(), llamaCpp.encodeUtf8("\uDE00x"))
+    }
+}
@@ -0,0 +1,133 @@
+#include "autotune.h"
+
+#include <cstdio>
+#include <memory>
+
+// Profile layout: "XTUN", u32 version, u64 model fingerprint, u64 CPU signature,
+// i32 n_threads_prefill, i32 n_threads_decode, i32 n_batch, i32 kv_quantized,
+// i32 flash_attn, f64 prefill_tps, f64 decode_tps.
+namespace {
+
+const char kMagic[4] = {'X', 'T', 'U', 'N'};
+const uint32_t kVersion = 1;
+
+using File = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+template <typename T>
+bool write_pod(FILE* f, const T& v) {
+    return fwrite(&v, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+bool read_pod(FILE* f, T& v) {
+    return fread(&v, sizeof(T), 1, f) == 1;
+}
+
+}  // namespace
+
+double Autotuner::score_ms(double prefill_tps, double decode_tps) {
+    if (prefill_tps <= 0.0 || decode_tps <= 0.0) return 1e300;
+    return 1000.0 * (kReferencePromptTokens / prefill_tps + kReferenceGeneratedTokens / decode_tps);
+}
+
+TuneResult Autotuner::run(const TuneConfig& base, const TuneSpace& space, const Measure& measure,
+                          int64_t budget_us, const std::atomic<bool>& cancel, const Clock& clock,
+                          TuneTrial& best, std::vector<TuneTrial>* trials) {
+    const int64_t start = clock();
+    std::vector<TuneTrial> done;
+
+    // Measures `config` unless it was already measured; updates `best`. False = stop.
+    auto trial = [&](const TuneConfig& config) {
+        for (const TuneTrial& t : done) {
+            if (t.config == config) return true;
+        }
+        if (cancel.load() || (!done.empty() && clock() - start >= budget_us)) return false;
+        TuneTrial t;
+        t.config = config;
+        if (!measure(config, t.prefill_tps, t.decode_tps)) return !cancel.load();
+        t.score_ms = score_ms(t.prefill_tps, t.decode_tps);
+        if (done.empty() || t.score_ms < best.score_ms) best = t;
+        done.push_back(t);
+        if (trials != nullptr) trials->push_back(t);
+        return true;
+    };
+
+    // A trial refused by the budget still counts as finished; only a cancel does not
+    auto stopped = [&] { return cancel.load() ? kTuneCancelled : kTuneFinished; };
+
+    if (!trial(base) || done.empty()) return done.empty() ? kTuneFailed : stopped();
+
+    for (int32_t n : space.prefill_threads) {
+        TuneConfig c = best.config;
+        c.n_threads_prefill = n;
+        if (!trial(c)) return stopped();
+    }
+    for (int32_t n : space.decode_threads) {
+        TuneConfig c = best.config;
+        c.n_threads_decode = n;
+        if (!trial(c)) return stopped();
+    }
+    for (int32_t n : space.batch_sizes) {
+        TuneConfig c = best.config;
+        c.n_batch = n;
+        if (!trial(c)) return stopped();
+    }
+    for (const auto& kv_flash : space.kv_flash) {
+        TuneConfig c = best.config;
+        c.kv_quantized = kv_flash.first;
+        c.flash_attn = kv_flash.second;
+        if (!trial(c)) return stopped();
+    }
+    return kTuneFinished;
+}
+
+bool TuneProfile::save(const std::string& path) const {
+    File f(fopen(path.c_str(), "wb"), fclose);
+    if (!f) return false;
+    const TuneConfig& c = best.config;
+    return fwrite(kMagic, 1, 4, f.get()) == 4 && write_pod(f.get(), kVersion) &&
+           write_pod(f.get(), model_fingerprint) && write_pod(f.get(), cpu_signature) &&
+           write_pod(f.get(), c.n_threads_prefill) && write_pod(f.get(), c.n_threads_decode) &&
+           write_pod(f.get(), c.n_batch) && write_pod(f.get(), c.kv_quantized) &&
+           write_pod(f.get(), c.flash_attn) && write_pod(f.get(), best.prefill_tps) &&
+           write_pod(f.get(), best.decode_tps);
+}
+
+bool TuneProfile::load(const std::string& path, uint64_t fingerprint, uint64_t signature) {
+    File f(fopen(path.c_str(), "rb"), fclose);
+    if (!f) return false;
+
+    TuneProfile p;
+    TuneConfig& c = p.best.config;
+    char magic[4];
+    uint32_t version = 0;
+    if (fread(magic, 1, 4, f.get()) != 4 || std::string(magic, 4) != std::string(kMagic, 4) ||
+        !read_pod(f.get(), version) || version != kVersion ||
+        !read_pod(f.get(), p.model_fingerprint) || p.model_fingerprint != fingerprint ||
+        !read_pod(f.get(), p.cpu_signature) || p.cpu_signature != signature ||
+        !read_pod(f.get(), c.n_threads_prefill) || !read_pod(f.get(), c.n_threads_decode) ||
+        !read_pod(f.get(), c.n_batch) || !read_pod(f.get(), c.kv_quantized) ||
+        !read_pod(f.get(), c.flash_attn) || !read_pod(f.get(), p.best.prefill_tps) ||
+        !read_pod(f.get(), p.best.decode_tps)) {
+        return false;
+    }
+    if (c.n_threads_prefill < 1 || c.n_threads_decode < 1 || c.n_batch < 1 ||
+        c.kv_quantized < 0 || c.kv_quantized > 1 || c.flash_attn < -1 || c.flash_attn > 1) {
+        return false;
+    }
+    p.best.score_ms = Autotuner::score_ms(p.best.prefill_tps, p.best.decode_tps);
+    *this = p;
+    return true;
+}
+
+std::string TuneProfile::path_for(const std::string& dir, uint64_t fingerprint, uint64_t signature) {
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%016llx.xtun", (unsigned long long) fingerprint,
+             (unsigned long long) signature);
+    return dir + name;
+}
+
+bool TuneProfile::save_result(TuneResult result, const std::string& dir) const {
+    if (result != kTuneFinished || dir.empty()) return false;
+    return save(path_for(dir, model_fingerprint, cpu_signature));
+}
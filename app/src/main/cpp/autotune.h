@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// On-device autotuning with persisted per-model, per-device profiles
+// ============================================================================
+// The RAM table in applyDeviceConfig knows nothing about the model or the SoC. The tuner
+// measures prefill and decode throughput on the device itself and keeps the runtime
+// settings that minimize the latency of a reference request. The winner is stored in a
+// small profile file keyed by model fingerprint and CPU signature and reused on later loads.
+struct TuneConfig {
+    int32_t n_threads_prefill = 4;
+    int32_t n_threads_decode = 4;
+    int32_t n_batch = 128;              // n_ubatch is kept equal
+    int32_t kv_quantized = 0;           // 0 = f16 K/V cache, 1 = q8_0
+    int32_t flash_attn = -1;            // -1 = llama.cpp default, 0 = off, 1 = on
+
+    bool operator==(const TuneConfig& o) const {
+        return n_threads_prefill == o.n_threads_prefill && n_threads_decode == o.n_threads_decode &&
+               n_batch == o.n_batch && kv_quantized == o.kv_quantized && flash_attn == o.flash_attn;
+    }
+};
+
+struct TuneTrial {
+    TuneConfig config;
+    double prefill_tps = 0.0;
+    double decode_tps = 0.0;
+    double score_ms = 0.0;              // estimated latency of the reference request
+};
+
+// Values tried per dimension. Dimensions are swept one at a time (coordinate descent), in
+// the order prefill threads, decode threads, batch size, KV cache / flash attention, each
+// starting from the best configuration found so far.
+struct TuneSpace {
+    std::vector<int32_t> prefill_threads;
+    std::vector<int32_t> decode_threads;
+    std::vector<int32_t> batch_sizes;
+    std::vector<std::pair<int32_t, int32_t>> kv_flash;     // (kv_quantized, flash_attn)
+};
+
+enum TuneResult {
+    kTuneFailed = 0,        // not even the base configuration was measured
+    kTuneCancelled,         // stopped early; the best of the partial sweep is for this session
+    kTuneFinished,          // swept every dimension, or ran out of budget
+};
+
+class Autotuner {
+public:
+    // Measures `config`; false if it failed or was cancelled.
+    using Measure = std::function<bool(const TuneConfig& config, double& prefill_tps,
+                                       double& decode_tps)>;
+    using Clock = std::function<int64_t()>;     // microseconds
+
+    // Reference request the score estimates: prompt tokens / prefill + generated / decode.
+    static const int kReferencePromptTokens = 256;
+    static const int kReferenceGeneratedTokens = 128;
+
+    static double score_ms(double prefill_tps, double decode_tps);
+
+    // Starts from `base` (which is measured first) and fills `best` with the best trial. No
+    // new trial starts once `budget_us` has elapsed or `cancel` is raised. `trials` receives
+    // every measured configuration.
+    static TuneResult run(const TuneConfig& base, const TuneSpace& space, const Measure& measure,
+                    int64_t budget_us, const std::atomic<bool>& cancel, const Clock& clock,
+                    TuneTrial& best, std::vector<TuneTrial>* trials);
+};
+
+// The tuned configuration for one model on one device.
+struct TuneProfile {
+    uint64_t model_fingerprint = 0;
+    uint64_t cpu_signature = 0;
+    TuneTrial best;
+
+    // Binary file in host byte order, see autotune.cpp for the layout. Profiles are keyed by
+    // CPU signature and never leave the device that wrote them.
+    bool save(const std::string& path) const;
+
+    // Fails if the file is missing, damaged or belongs to another model or device.
+    bool load(const std::string& path, uint64_t model_fingerprint, uint64_t cpu_signature);
+
+    // "<dir>/<model>-<cpu>.xtun"
+    static std::string path_for(const std::string& dir, uint64_t model_fingerprint,
+                                uint64_t cpu_signature);
+
+    // Saves to path_for(dir, ...) only after a finished sweep, so a cancelled one is tried
+    // again on the next load. False if nothing was written.
+    bool save_result(TuneResult result, const std::string& dir) const;
+};
@@ -0,0 +1,139 @@
+#include "cpu_features.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
+// Variant tables mirror ggml's GGML_CPU_ALL_VARIANTS list (ggml/src/CMakeLists.txt); a tag
+// listed here but missing from the build just fails to load and the next one is tried.
+
+namespace {
+
+const std::vector<CpuVariant> kArm64Variants = {
+    {"android_armv8.0_1", kCpuNeon},
+    {"android_armv8.2_1", kCpuNeon | kCpuDotprod},
+    {"android_armv8.2_2", kCpuNeon | kCpuDotprod | kCpuFp16},
+    {"android_armv8.6_1", kCpuNeon | kCpuDotprod | kCpuFp16 | kCpuI8mm},
+    {"android_armv9.0_1", kCpuNeon | kCpuDotprod | kCpuFp16 | kCpuI8mm | kCpuSve2},
+};
+
+const std::vector<CpuVariant> kX86Variants = {
+    {"x64", 0},
+    {"sse42", kCpuSse42},
+    {"sandybridge", kCpuSse42 | kCpuAvx},
+    {"haswell", kCpuSse42 | kCpuAvx | kCpuF16c | kCpuFma | kCpuAvx2 | kCpuBmi2},
+    {"alderlake", kCpuSse42 | kCpuAvx | kCpuF16c | kCpuFma | kCpuAvx2 | kCpuBmi2 | kCpuAvxVnni},
+    {"skylakex", kCpuSse42 | kCpuAvx | kCpuF16c | kCpuFma | kCpuAvx2 | kCpuBmi2 | kCpuAvx512},
+    {"icelake", kCpuSse42 | kCpuAvx | kCpuF16c | kCpuFma | kCpuAvx2 | kCpuBmi2 | kCpuAvx512 |
+                kCpuAvx512Vbmi | kCpuAvx512Vnni},
+};
+
+const std::vector<CpuVariant> kNoVariants;
+
+const struct {
+    uint32_t bit;
+    const char* name;
+} kFeatureNames[] = {
+    {kCpuNeon, "neon"},         {kCpuDotprod, "dotprod"},       {kCpuFp16, "fp16"},
+    {kCpuI8mm, "i8mm"},         {kCpuSve, "sve"},               {kCpuSve2, "sve2"},
+    {kCpuSse42, "sse4.2"},      {kCpuAvx, "avx"},               {kCpuF16c, "f16c"},
+    {kCpuFma, "fma"},           {kCpuAvx2, "avx2"},             {kCpuBmi2, "bmi2"},
+    {kCpuAvx512, "avx512f"},    {kCpuAvx512Vbmi, "avx512vbmi"}, {kCpuAvx512Vnni, "avx512vnni"},
+    {kCpuAvxVnni, "avxvnni"},
+};
+
+#if defined(__x86_64__)
+uint64_t xgetbv0() {
+    uint32_t lo = 0, hi = 0;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t) hi << 32) | lo;
+}
+#endif
+
+}  // namespace
+
+CpuArch host_cpu_arch() {
+#if defined(__aarch64__)
+    return CpuArch::Arm64;
+#elif defined(__x86_64__)
+    return CpuArch::X86_64;
+#else
+    return CpuArch::Other;
+#endif
+}
+
+uint32_t detect_cpu_features() {
+    uint32_t f = 0;
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+    if (ecx & (1u << 20)) f |= kCpuSse42;
+    // AVX state must also be enabled by the OS (OSXSAVE + XCR0 YMM bits)
+    const bool os_avx = (ecx & (1u << 27)) && (xgetbv0() & 0x6) == 0x6;
+    const bool os_avx512 = os_avx && (xgetbv0() & 0xe6) == 0xe6;
+    if (os_avx) {
+        if (ecx & (1u << 28)) f |= kCpuAvx;
+        if (ecx & (1u << 29)) f |= kCpuF16c;
+        if (ecx & (1u << 12)) f |= kCpuFma;
+    }
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        if (ebx & (1u << 8)) f |= kCpuBmi2;
+        if (os_avx && (ebx & (1u << 5))) f |= kCpuAvx2;
+        if (os_avx512 && (ebx & (1u << 16))) {
+            f |= kCpuAvx512;
+            if (ecx & (1u << 1)) f |= kCpuAvx512Vbmi;
+            if (ecx & (1u << 11)) f |= kCpuAvx512Vnni;
+        }
+    }
+    if (os_avx && __get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1u << 4))) {
+        f |= kCpuAvxVnni;
+    }
+#elif defined(__aarch64__)
+    // Bit values from the kernel's uapi asm/hwcap.h
+    const unsigned long hwcap = getauxval(AT_HWCAP);
+    const unsigned long hwcap2 = getauxval(AT_HWCAP2);
+    if (hwcap & (1ul << 1)) f |= kCpuNeon;          // HWCAP_ASIMD
+    if (hwcap & (1ul << 10)) f |= kCpuFp16;         // HWCAP_ASIMDHP
+    if (hwcap & (1ul << 20)) f |= kCpuDotprod;      // HWCAP_ASIMDDP
+    if (hwcap & (1ul << 22)) f |= kCpuSve;          // HWCAP_SVE
+    if (hwcap2 & (1ul << 1)) f |= kCpuSve2;         // HWCAP2_SVE2
+    if (hwcap2 & (1ul << 13)) f |= kCpuI8mm;        // HWCAP2_I8MM
+#endif
+    return f;
+}
+
+const std::vector<CpuVariant>& cpu_variants(CpuArch arch) {
+    switch (arch) {
+        case CpuArch::Arm64: return kArm64Variants;
+        case CpuArch::X86_64: return kX86Variants;
+        default: return kNoVariants;
+    }
+}
+
+std::vector<CpuVariant> runnable_cpu_variants(CpuArch arch, uint32_t features,
+                                              const std::string& forced) {
+    const std::vector<CpuVariant>& all = cpu_variants(arch);
+    std::vector<CpuVariant> out;
+    for (auto it = all.rbegin(); it != all.rend(); ++it) {
+        if ((it->required & features) != it->required) continue;
+        if (!forced.empty() && forced != it->name) continue;
+        out.push_back(*it);
+    }
+    return out;
+}
+
+std::string cpu_variant_library(const CpuVariant& variant) {
+    return std::string("libggml-cpu-") + variant.name + ".so";
+}
+
+std::string cpu_feature_names(uint32_t features) {
+    std::string out;
+    for (const auto& f : kFeatureNames) {
+        if (!(features & f.bit)) continue;
+        if (!out.empty()) out += " ";
+        out += f.name;
+    }
+    return out;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// CPU features and ggml CPU backend variants
+// ============================================================================
+// A single baseline CPU backend leaves the int8 dot-product and matmul instructions of
+// newer cores (dotprod, i8mm, SVE; AVX2/AVX512 on x86) unused. The build produces one
+// ggml CPU backend library per instruction-set level (GGML_CPU_ALL_VARIANTS, loaded with
+// GGML_BACKEND_DL); at startup the features of the running CPU are probed and the most
+// capable variant they support is loaded. A variant can be forced by name, e.g. to compare
+// variants on one machine; forcing one the CPU cannot run is refused.
+enum CpuFeature : uint32_t {
+    kCpuNeon = 1u << 0,
+    kCpuDotprod = 1u << 1,          // SDOT/UDOT
+    kCpuFp16 = 1u << 2,             // FP16 vector arithmetic
+    kCpuI8mm = 1u << 3,             // SMMLA/UMMLA
+    kCpuSve = 1u << 4,
+    kCpuSve2 = 1u << 5,
+    kCpuSse42 = 1u << 8,
+    kCpuAvx = 1u << 9,
+    kCpuF16c = 1u << 10,
+    kCpuFma = 1u << 11,
+    kCpuAvx2 = 1u << 12,
+    kCpuBmi2 = 1u << 13,
+    kCpuAvx512 = 1u << 14,          // AVX512F
+    kCpuAvx512Vbmi = 1u << 15,
+    kCpuAvx512Vnni = 1u << 16,
+    kCpuAvxVnni = 1u << 17,
+};
+
+enum class CpuArch { Arm64, X86_64, Other };
+
+struct CpuVariant {
+    const char* name;               // ggml's variant tag: libggml-cpu-<name>.so
+    uint32_t required;              // CpuFeature bits
+};
+
+// Architecture this code was compiled for.
+CpuArch host_cpu_arch();
+
+// Features of the running CPU (cpuid + xgetbv on x86, auxv hwcaps on arm64).
+uint32_t detect_cpu_features();
+
+// Variants built for `arch`, least capable first; empty for other architectures.
+const std::vector<CpuVariant>& cpu_variants(CpuArch arch);
+
+// Variants of `arch` that `features` can run, most capable first. With `forced` set, only
+// that variant (if it is runnable). Loading falls back along the list.
+std::vector<CpuVariant> runnable_cpu_variants(CpuArch arch, uint32_t features,
+                                              const std::string& forced);
+
+// "libggml-cpu-<name>.so"
+std::string cpu_variant_library(const CpuVariant& variant);
+
+// Space-separated feature names, e.g. "neon dotprod fp16".
+std::string cpu_feature_names(uint32_t features);
@@ -0,0 +1,198 @@
+#include "cpu_topology.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// First integer in a small sysfs file, or -1.
+long read_long(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return -1;
+    long value = -1;
+    if (fscanf(f, "%ld", &value) != 1) value = -1;
+    fclose(f);
+    return value;
+}
+
+// Parses a cpulist such as "0-3,6,8-9".
+std::vector<int> read_cpu_list(const std::string& path) {
+    std::vector<int> cpus;
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return cpus;
+    char buf[256];
+    if (fgets(buf, sizeof(buf), f) != nullptr) {
+        char* p = buf;
+        while (*p != '\0' && *p != '\n') {
+            char* end = nullptr;
+            const long first = strtol(p, &end, 10);
+            if (end == p) break;
+            long last = first;
+            p = end;
+            if (*p == '-') {
+                last = strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (long c = first; c <= last && c < CPU_SETSIZE; c++) cpus.push_back((int) c);
+            if (*p == ',') p++;
+        }
+    }
+    fclose(f);
+    return cpus;
+}
+
+// cpuN directories below root.
+std::vector<int> scan_cpu_dirs(const std::string& root) {
+    std::vector<int> cpus;
+    DIR* dir = opendir(root.c_str());
+    if (dir == nullptr) return cpus;
+    while (dirent* e = readdir(dir)) {
+        const char* name = e->d_name;
+        if (strncmp(name, "cpu", 3) != 0 || name[3] < '0' || name[3] > '9') continue;
+        char* end = nullptr;
+        const long id = strtol(name + 3, &end, 10);
+        if (*end == '\0' && id < CPU_SETSIZE) cpus.push_back((int) id);
+    }
+    closedir(dir);
+    std::sort(cpus.begin(), cpus.end());
+    return cpus;
+}
+
+}  // namespace
+
+int CpuTopology::n_performance() const {
+    return (int) std::count_if(cores.begin(), cores.end(),
+                               [](const CpuCore& c) { return c.performance; });
+}
+
+std::vector<int> CpuTopology::performance_cpus() const {
+    std::vector<int> cpus;
+    for (const CpuCore& c : cores) {
+        if (c.performance) cpus.push_back(c.id);
+    }
+    return cpus;
+}
+
+bool CpuTopology::heterogeneous() const {
+    return n_performance() < n_cores();
+}
+
+uint64_t CpuTopology::signature() const {
+    uint64_t h = 1469598103934665603ULL;
+    auto mix = [&h](uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            h ^= (v >> (8 * i)) & 0xFF;
+            h *= 1099511628211ULL;
+        }
+    };
+    for (const CpuCore& c : cores) {
+        mix((uint32_t) c.id);
+        mix(c.max_freq_khz);
+        mix(c.capacity);
+        mix((uint32_t) c.cluster);
+    }
+    return h;
+}
+
+CpuTopology detect_cpu_topology(const std::string& root, int fallback_cores) {
+    CpuTopology topo;
+    std::vector<int> ids = read_cpu_list(root + "/online");
+    if (ids.empty()) ids = scan_cpu_dirs(root);
+
+    bool all_capacity = !ids.empty();
+    for (int id : ids) {
+        const std::string dir = root + "/cpu" + std::to_string(id);
+        CpuCore core;
+        core.id = id;
+        const long freq = read_long(dir + "/cpufreq/cpuinfo_max_freq");
+        const long capacity = read_long(dir + "/cpu_capacity");
+        long cluster = read_long(dir + "/topology/cluster_id");
+        if (cluster < 0) cluster = read_long(dir + "/topology/physical_package_id");
+        core.max_freq_khz = freq > 0 ? (uint32_t) freq : 0;
+        core.capacity = capacity > 0 ? (uint32_t) capacity : 0;
+        core.cluster = (int) cluster;
+        all_capacity = all_capacity && core.capacity > 0;
+        topo.cores.push_back(core);
+    }
+
+    if (topo.cores.empty()) {
+        for (int id = 0; id < std::max(1, fallback_cores); id++) {
+            CpuCore core;
+            core.id = id;
+            topo.cores.push_back(core);
+        }
+        return topo;
+    }
+
+    // Cores whose speed is unknown cannot be ranked and are kept
+    auto rank = [all_capacity](const CpuCore& c) {
+        return all_capacity ? c.capacity : c.max_freq_khz;
+    };
+    uint32_t lowest = UINT32_MAX, highest = 0;
+    for (const CpuCore& c : topo.cores) {
+        if (rank(c) == 0) continue;
+        lowest = std::min(lowest, rank(c));
+        highest = std::max(highest, rank(c));
+    }
+    if (highest > lowest) {
+        for (CpuCore& c : topo.cores) c.performance = rank(c) == 0 || rank(c) > lowest;
+    }
+    return topo;
+}
+
+bool set_thread_affinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+    }
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int>& cpus) {
+    if (cpus.empty()) return;
+    cpu_set_t current;
+    CPU_ZERO(&current);
+    if (sched_getaffinity(0, sizeof(current), &current) != 0) return;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &current)) previous_.push_back(cpu);
+    }
+    active_ = set_thread_affinity(cpus);
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity() {
+    if (active_) set_thread_affinity(previous_);
+}
+
+ScopedThreadPriority::ScopedThreadPriority() {
+    sched_param param{};
+    if (pthread_getschedparam(pthread_self(), &policy_, &param) != 0) return;
+    sched_priority_ = param.sched_priority;
+    errno = 0;
+    nice_ = getpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid));
+    saved_ = errno == 0;
+}
+
+ScopedThreadPriority::~ScopedThreadPriority() {
+    if (!saved_) return;
+    int policy = 0;
+    sched_param param{};
+    if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 &&
+        (policy != policy_ || param.sched_priority != sched_priority_)) {
+        param.sched_priority = sched_priority_;
+        pthread_setschedparam(pthread_self(), policy_, &param);
+    }
+    const id_t tid = (id_t) syscall(SYS_gettid);
+    errno = 0;
+    const int nice = getpriority(PRIO_PROCESS, tid);
+    if (errno == 0 && nice != nice_) setpriority(PRIO_PROCESS, tid, nice_);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// CPU topology - big.LITTLE aware core detection
+// ============================================================================
+// Phone SoCs mix performance and efficiency cores. ggml splits every matmul evenly across
+// its threads, so a single thread on an efficiency core gates each op. The topology is read
+// from sysfs (cpuinfo_max_freq, cpu_capacity, cluster ids); the root is a parameter so tests
+// can point it at a fake tree.
+struct CpuCore {
+    int id = 0;
+    uint32_t max_freq_khz = 0;      // 0 if unknown
+    uint32_t capacity = 0;          // arm64 cpu_capacity (1024 = biggest core), 0 if unknown
+    int cluster = -1;
+    bool performance = true;
+};
+
+struct CpuTopology {
+    std::vector<CpuCore> cores;     // sorted by id
+
+    int n_cores() const { return (int) cores.size(); }
+    int n_performance() const;
+    std::vector<int> performance_cpus() const;
+
+    // More than one class of core (and therefore something to avoid).
+    bool heterogeneous() const;
+
+    // Identifies the SoC for per-device caches (FNV-1a over every core's id, max frequency,
+    // capacity and cluster).
+    uint64_t signature() const;
+};
+
+static const char* const kSysfsCpuRoot = "/sys/devices/system/cpu";
+
+// Reads the topology below `root`. Cores are ranked by capacity when every core reports it,
+// by max frequency otherwise; the slowest tier is marked as efficiency cores unless all
+// cores are alike. Falls back to `fallback_cores` identical cores if nothing is readable.
+CpuTopology detect_cpu_topology(const std::string& root, int fallback_cores);
+
+// Restricts the calling thread to `cpus`. Threads it creates afterwards (ggml's workers)
+// inherit the mask. Returns false if the kernel refused.
+bool set_thread_affinity(const std::vector<int>& cpus);
+
+// Pins the calling thread for the lifetime of the object and restores the previous mask,
+// so borrowed (Java) threads are left as they were. Does nothing for an empty set.
+class ScopedThreadAffinity {
+public:
+    explicit ScopedThreadAffinity(const std::vector<int>& cpus);
+    ~ScopedThreadAffinity();
+
+    bool active() const { return active_; }
+
+private:
+    bool active_ = false;
+    std::vector<int> previous_;
+};
+
+// Restores the calling thread's scheduling policy and nice value on destruction. ggml applies
+// its threadpool priority to whichever thread submits a graph, which may be a borrowed one.
+class ScopedThreadPriority {
+public:
+    ScopedThreadPriority();
+    ~ScopedThreadPriority();
+
+private:
+    bool saved_ = false;
+    int policy_ = 0;
+    int sched_priority_ = 0;
+    int nice_ = 0;
+};
@@ -0,0 +1,153 @@
+#include "generation_trace.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+// Layout: "XTRC", u32 version, i32 n_vocab, i32 top_k, f32 top_p, f32 temp,
+// f32 min_p (version 2+), u32 seed, i32 max_tokens, u32 n_stop + strings,
+// version 3+: grammar string, i32 repetition_policy, u8 allow_eog, u32 n_allowed + strings,
+// u32 n_subset + i32 ids, then u32 n_prompt + i32 tokens, u32 n_tokens + i32 tokens.
+// Strings are u32 length + bytes. Every value is little-endian; floats are their IEEE bits.
+namespace {
+
+const char kMagic[4] = {'X', 'T', 'R', 'C'};
+const uint32_t kVersion = 3;
+const uint32_t kMaxCount = 1u << 24;    // sanity bound when reading
+
+using File = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+bool write_u32(FILE* f, uint32_t v) {
+    const unsigned char b[4] = {(unsigned char) v, (unsigned char) (v >> 8),
+                                (unsigned char) (v >> 16), (unsigned char) (v >> 24)};
+    return fwrite(b, 1, 4, f) == 4;
+}
+
+bool read_u32(FILE* f, uint32_t& v) {
+    unsigned char b[4];
+    if (fread(b, 1, 4, f) != 4) return false;
+    v = (uint32_t) b[0] | ((uint32_t) b[1] << 8) | ((uint32_t) b[2] << 16) |
+        ((uint32_t) b[3] << 24);
+    return true;
+}
+
+bool write_i32(FILE* f, int32_t v) {
+    return write_u32(f, (uint32_t) v);
+}
+
+bool read_i32(FILE* f, int32_t& v) {
+    uint32_t u = 0;
+    if (!read_u32(f, u)) return false;
+    v = (int32_t) u;
+    return true;
+}
+
+bool write_f32(FILE* f, float v) {
+    uint32_t u;
+    memcpy(&u, &v, sizeof(u));
+    return write_u32(f, u);
+}
+
+bool read_f32(FILE* f, float& v) {
+    uint32_t u = 0;
+    if (!read_u32(f, u)) return false;
+    memcpy(&v, &u, sizeof(v));
+    return true;
+}
+
+bool write_string(FILE* f, const std::string& s) {
+    return write_u32(f, (uint32_t) s.size()) && fwrite(s.data(), 1, s.size(), f) == s.size();
+}
+
+bool read_string(FILE* f, std::string& s) {
+    uint32_t len = 0;
+    if (!read_u32(f, len) || len > kMaxCount) return false;
+    s.resize(len);
+    return fread(&s[0], 1, len, f) == len;
+}
+
+bool write_strings(FILE* f, const std::vector<std::string>& strings) {
+    if (!write_u32(f, (uint32_t) strings.size())) return false;
+    for (const std::string& s : strings) {
+        if (!write_string(f, s)) return false;
+    }
+    return true;
+}
+
+bool read_strings(FILE* f, std::vector<std::string>& strings) {
+    uint32_t n = 0;
+    if (!read_u32(f, n) || n > kMaxCount) return false;
+    strings.resize(n);
+    for (std::string& s : strings) {
+        if (!read_string(f, s)) return false;
+    }
+    return true;
+}
+
+bool write_tokens(FILE* f, const std::vector<int32_t>& tokens) {
+    if (!write_u32(f, (uint32_t) tokens.size())) return false;
+    for (int32_t t : tokens) {
+        if (!write_i32(f, t)) return false;
+    }
+    return true;
+}
+
+bool read_tokens(FILE* f, std::vector<int32_t>& tokens) {
+    uint32_t n = 0;
+    if (!read_u32(f, n) || n > kMaxCount) return false;
+    tokens.resize(n);
+    for (int32_t& t : tokens) {
+        if (!read_i32(f, t)) return false;
+    }
+    return true;
+}
+
+}  // namespace
+
+bool GenerationTrace::save(const std::string& path) const {
+    File f(fopen(path.c_str(), "wb"), fclose);
+    if (!f) return false;
+
+    FILE* fp = f.get();
+    const unsigned char eog = allow_eog ? 1 : 0;
+    return fwrite(kMagic, 1, 4, fp) == 4 && write_u32(fp, kVersion) &&
+           write_i32(fp, n_vocab) && write_i32(fp, top_k) && write_f32(fp, top_p) &&
+           write_f32(fp, temp) && write_f32(fp, min_p) && write_u32(fp, seed) &&
+           write_i32(fp, max_tokens) && write_strings(fp, stop_sequences) &&
+           write_string(fp, grammar) && write_i32(fp, repetition_policy) &&
+           fwrite(&eog, 1, 1, fp) == 1 && write_strings(fp, allowed_special) &&
+           write_tokens(fp, vocab_subset) && write_tokens(fp, prompt) && write_tokens(fp, tokens);
+}
+
+bool GenerationTrace::load(const std::string& path) {
+    File f(fopen(path.c_str(), "rb"), fclose);
+    if (!f) return false;
+
+    FILE* fp = f.get();
+    GenerationTrace t;
+    char magic[4];
+    uint32_t version = 0;
+    if (fread(magic, 1, 4, fp) != 4 || memcmp(magic, kMagic, 4) != 0 ||
+        !read_u32(fp, version) || version < 1 || version > kVersion ||
+        !read_i32(fp, t.n_vocab) || !read_i32(fp, t.top_k) || !read_f32(fp, t.top_p) ||
+        !read_f32(fp, t.temp) || (version >= 2 && !read_f32(fp, t.min_p)) ||
+        !read_u32(fp, t.seed) || !read_i32(fp, t.max_tokens) ||
+        !read_strings(fp, t.stop_sequences)) {
+        return false;
+    }
+    if (version >= 3) {
+        unsigned char eog = 0;
+        if (!read_string(fp, t.grammar) || !read_i32(fp, t.repetition_policy) ||
+            fread(&eog, 1, 1, fp) != 1 || !read_strings(fp, t.allowed_special) ||
+            !read_tokens(fp, t.vocab_subset)) {
+            return false;
+        }
+        t.allow_eog = eog != 0;
+    } else {
+        t.has_constraints = false;
+    }
+    if (!read_tokens(fp, t.prompt) || !read_tokens(fp, t.tokens)) return false;
+
+    *this = std::move(t);
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Generation traces for deterministic replay
+// ============================================================================
+// Everything needed to repeat a generation exactly: the prompt tokens that were evaluated,
+// the tokens that were sampled, the sampler settings with the seed actually used, and the
+// constraints that shaped the logits (grammar, repetition policy, special tokens, the
+// vocabulary subset). A
+// trace is replayed either by force-decoding its tokens (identical decode work, no
+// sampling) or by regenerating with the recorded seed, so tok/s can be compared across
+// builds and devices on the same work.
+struct GenerationTrace {
+    int32_t n_vocab = 0;                    // guards against replaying on another model
+    int32_t top_k = 0;
+    float top_p = 0.0f;
+    float temp = 0.0f;
+    float min_p = 0.0f;
+    uint32_t seed = 0;
+    int32_t max_tokens = 0;
+    std::vector<std::string> stop_sequences;
+    // Version 3+; older files replay with the current settings instead
+    bool has_constraints = true;
+    std::string grammar;                    // GBNF, empty = unconstrained
+    int32_t repetition_policy = 0;
+    bool allow_eog = true;                  // special-token exceptions
+    std::vector<std::string> allowed_special;
+    std::vector<int32_t> vocab_subset;      // ids sampled from, empty = full vocabulary
+    std::vector<int32_t> prompt;
+    std::vector<int32_t> tokens;
+
+    bool empty() const { return prompt.empty(); }
+
+    // Binary file written little-endian byte by byte, so traces move between devices;
+    // see generation_trace.cpp for the layout.
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+};
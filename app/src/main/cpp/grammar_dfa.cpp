@@ -0,0 +1,584 @@
+#include "grammar_dfa.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// ============================================================================
+// Grammar AST
+// ============================================================================
+struct GrammarDfa::Node {
+    enum Kind { kSeq, kAlt, kLiteral, kClass, kAny, kRef, kRepeat };
+
+    Kind kind = kSeq;
+    std::vector<std::shared_ptr<Node>> children;
+    std::string text;                                       // literal bytes or rule name
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;      // class ranges (code points)
+    bool negated = false;
+    int min = 0;
+    int max = -1;                                           // -1 = unbounded
+};
+
+static const size_t kMaxNfaStates = 200000;
+static const int kMaxBoundedRepeat = 256;
+
+static void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back((char) cp);
+    } else if (cp < 0x800) {
+        out.push_back((char) (0xC0 | (cp >> 6)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back((char) (0xE0 | (cp >> 12)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back((char) (0xF0 | (cp >> 18)));
+        out.push_back((char) (0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back((char) (0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back((char) (0x80 | (cp & 0x3F)));
+    }
+}
+
+// ============================================================================
+// GBNF parser - same surface syntax as llama.cpp grammars
+// ============================================================================
+class GbnfParser {
+public:
+    using Node = GrammarDfa::Node;
+
+    GbnfParser(const std::string& src, std::string& error) : src_(src), error_(error) {}
+
+    bool parse(std::map<std::string, std::shared_ptr<Node>>& rules) {
+        for (;;) {
+            skip_space(true);
+            if (pos_ >= src_.size()) return true;
+
+            std::string name;
+            if (!parse_name(name)) return fail("expected rule name");
+            skip_space(false);
+            if (src_.compare(pos_, 3, "::=") != 0) return fail("expected ::=");
+            pos_ += 3;
+            skip_space(true);
+
+            std::shared_ptr<Node> body;
+            if (!parse_alternates(false, body)) return false;
+            rules[name] = body;
+        }
+    }
+
+private:
+    bool fail(const char* what) {
+        error_ = std::string(what) + " at offset " + std::to_string(pos_);
+        return false;
+    }
+
+    char cur() const { return pos_ < src_.size() ? src_[pos_] : '\0'; }
+
+    static bool is_name_char(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               c == '-' || c == '_';
+    }
+
+    void skip_space(bool newline_ok) {
+        while (pos_ < src_.size()) {
+            const char c = src_[pos_];
+            if (c == ' ' || c == '\t') {
+                pos_++;
+            } else if (c == '#') {
+                while (pos_ < src_.size() && src_[pos_] != '\n') pos_++;
+            } else if (newline_ok && (c == '\n' || c == '\r')) {
+                pos_++;
+            } else {
+                break;
+            }
+        }
+    }
+
+    bool parse_name(std::string& name) {
+        const size_t begin = pos_;
+        while (pos_ < src_.size() && is_name_char(src_[pos_])) pos_++;
+        name = src_.substr(begin, pos_ - begin);
+        return !name.empty();
+    }
+
+    bool parse_hex(int digits, uint32_t& cp) {
+        cp = 0;
+        for (int i = 0; i < digits; i++) {
+            const char c = cur();
+            uint32_t v;
+            if (c >= '0' && c <= '9') v = c - '0';
+            else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+            else return fail("bad hex escape");
+            cp = cp * 16 + v;
+            pos_++;
+        }
+        return true;
+    }
+
+    // One (possibly escaped) character of a literal or class, as a code point.
+    bool parse_char(uint32_t& cp) {
+        if (pos_ >= src_.size()) return fail("unexpected end of grammar");
+        const unsigned char c = (unsigned char) src_[pos_];
+        if (c == '\\') {
+            pos_++;
+            const char e = cur();
+            pos_++;
+            switch (e) {
+                case 'n': cp = '\n'; return true;
+                case 'r': cp = '\r'; return true;
+                case 't': cp = '\t'; return true;
+                case 'x': return parse_hex(2, cp);
+                case 'u': return parse_hex(4, cp);
+                case 'U': return parse_hex(8, cp);
+                case '\\': case '"': case '[': case ']': case '-': case '^':
+                    cp = (uint32_t) e;
+                    return true;
+                default: return fail("unknown escape");
+            }
+        }
+        // Decode one UTF-8 sequence from the grammar source
+        int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (len == 0 || pos_ + len > src_.size()) return fail("invalid UTF-8 in grammar");
+        cp = len == 1 ? c : len == 2 ? (c & 0x1F) : len == 3 ? (c & 0x0F) : (c & 0x07);
+        for (int i = 1; i < len; i++) cp = (cp << 6) | ((unsigned char) src_[pos_ + i] & 0x3F);
+        pos_ += len;
+        return true;
+    }
+
+    bool parse_alternates(bool nested, std::shared_ptr<Node>& out) {
+        auto alt = std::make_shared<Node>();
+        alt->kind = Node::kAlt;
+        for (;;) {
+            std::shared_ptr<Node> seq;
+            if (!parse_sequence(nested, seq)) return false;
+            alt->children.push_back(seq);
+            if (cur() != '|') break;
+            pos_++;
+            skip_space(true);
+        }
+        out = alt->children.size() == 1 ? alt->children[0] : alt;
+        return true;
+    }
+
+    bool parse_sequence(bool nested, std::shared_ptr<Node>& out) {
+        auto seq = std::make_shared<Node>();
+        seq->kind = Node::kSeq;
+        for (;;) {
+            const char c = cur();
+            if (c == '\0' || c == '|' || c == ')' || c == '\n' || c == '\r') break;
+
+            auto item = std::make_shared<Node>();
+            if (c == '"') {
+                pos_++;
+                item->kind = Node::kLiteral;
+                while (cur() != '"') {
+                    if (pos_ >= src_.size()) return fail("unterminated literal");
+                    uint32_t cp;
+                    if (!parse_char(cp)) return false;
+                    append_utf8(item->text, cp);
+                }
+                pos_++;
+            } else if (c == '[') {
+                pos_++;
+                item->kind = Node::kClass;
+                if (cur() == '^') {
+                    item->negated = true;
+                    pos_++;
+                }
+                while (cur() != ']') {
+                    if (pos_ >= src_.size()) return fail("unterminated character class");
+                    uint32_t lo;
+                    if (!parse_char(lo)) return false;
+                    uint32_t hi = lo;
+                    if (cur() == '-' && pos_ + 1 < src_.size() && src_[pos_ + 1] != ']') {
+                        pos_++;
+                        if (!parse_char(hi)) return false;
+                    }
+                    item->ranges.emplace_back(lo, hi);
+                }
+                pos_++;
+            } else if (c == '.') {
+                pos_++;
+                item->kind = Node::kAny;
+            } else if (c == '(') {
+                pos_++;
+                skip_space(true);
+                if (!parse_alternates(true, item)) return false;
+                if (cur() != ')') return fail("expected )");
+                pos_++;
+            } else if (is_name_char(c)) {
+                item->kind = Node::kRef;
+                parse_name(item->text);
+            } else {
+                return fail("unexpected character");
+            }
+            skip_space(nested);
+
+            // Postfix repetition
+            const char op = cur();
+            if (op == '*' || op == '+' || op == '?' || op == '{') {
+                auto rep = std::make_shared<Node>();
+                rep->kind = Node::kRepeat;
+                rep->children.push_back(item);
+                pos_++;
+                if (op == '*') {
+                    rep->min = 0; rep->max = -1;
+                } else if (op == '+') {
+                    rep->min = 1; rep->max = -1;
+                } else if (op == '?') {
+                    rep->min = 0; rep->max = 1;
+                } else {
+                    skip_space(true);
+                    if (!parse_int(rep->min)) return fail("expected repetition count");
+                    skip_space(true);
+                    rep->max = rep->min;
+                    if (cur() == ',') {
+                        pos_++;
+                        skip_space(true);
+                        rep->max = -1;
+                        if (cur() != '}' && !parse_int(rep->max)) return fail("expected repetition bound");
+                        skip_space(true);
+                    }
+                    if (cur() != '}') return fail("expected }");
+                    pos_++;
+                    if (rep->max != -1 && rep->max < rep->min) return fail("bad repetition bounds");
+                }
+                item = rep;
+                skip_space(nested);
+            }
+            seq->children.push_back(item);
+        }
+        out = seq->children.size() == 1 ? seq->children[0] : seq;
+        return true;
+    }
+
+    bool parse_int(int& value) {
+        const size_t begin = pos_;
+        value = 0;
+        while (cur() >= '0' && cur() <= '9') {
+            value = value * 10 + (cur() - '0');
+            if (value > 100000) return false;
+            pos_++;
+        }
+        return pos_ > begin;
+    }
+
+    const std::string& src_;
+    std::string& error_;
+    size_t pos_ = 0;
+};
+
+// ============================================================================
+// NFA construction (Thompson), rule references are inlined
+// ============================================================================
+int GrammarDfa::new_nfa_state() {
+    nfa_.emplace_back();
+    return (int) nfa_.size() - 1;
+}
+
+bool GrammarDfa::build_ref(const std::string& name, Frag& out, std::string& error) {
+    auto it = rules_.find(name);
+    if (it == rules_.end()) {
+        error = "undefined rule: " + name;
+        return false;
+    }
+    if (std::find(expanding_.begin(), expanding_.end(), name) != expanding_.end()) {
+        error = "recursive rule: " + name;
+        return false;
+    }
+    expanding_.push_back(name);
+    const bool ok = build(*it->second, out, error);
+    expanding_.pop_back();
+    return ok;
+}
+
+bool GrammarDfa::build(const Node& node, Frag& out, std::string& error) {
+    if (nfa_.size() > kMaxNfaStates) {
+        error = "grammar too large";
+        return false;
+    }
+
+    switch (node.kind) {
+        case Node::kLiteral: {
+            out.start = new_nfa_state();
+            int s = out.start;
+            for (unsigned char c : node.text) {
+                const int t = new_nfa_state();
+                nfa_[s].edges.push_back({c, c, t});
+                s = t;
+            }
+            out.end = s;
+            return true;
+        }
+        case Node::kClass:
+        case Node::kAny: {
+            out.start = new_nfa_state();
+            out.end = new_nfa_state();
+            bool any_multibyte = node.kind == Node::kAny || node.negated;
+            if (node.kind == Node::kAny) {
+                nfa_[out.start].edges.push_back({0x00, 0x7F, out.end});
+            } else {
+                bool ascii[128] = {};
+                for (const auto& r : node.ranges) {
+                    if (r.second < 0x80) {
+                        for (uint32_t c = r.first; c <= r.second; c++) ascii[c] = true;
+                    } else if (node.negated) {
+                        error = "negated classes may only list ASCII characters";
+                        return false;
+                    } else if (r.first != r.second) {
+                        error = "non-ASCII ranges in character classes are not supported";
+                        return false;
+                    } else {
+                        // A single non-ASCII character: its UTF-8 bytes as a literal path
+                        std::string bytes;
+                        append_utf8(bytes, r.first);
+                        int s = out.start;
+                        for (size_t i = 0; i < bytes.size(); i++) {
+                            const int t = i + 1 == bytes.size() ? out.end : new_nfa_state();
+                            const unsigned char b = (unsigned char) bytes[i];
+                            nfa_[s].edges.push_back({b, b, t});
+                            s = t;
+                        }
+                    }
+                }
+                for (int c = 0; c < 128; c++) {
+                    if (ascii[c] == node.negated) continue;
+                    int hi = c;
+                    while (hi + 1 < 128 && ascii[hi + 1] == ascii[c]) hi++;
+                    nfa_[out.start].edges.push_back({(unsigned char) c, (unsigned char) hi, out.end});
+                    c = hi;
+                }
+            }
+            if (any_multibyte) {
+                // Any multi-byte UTF-8 code point
+                static const unsigned char kLead[3][2] = {{0xC2, 0xDF}, {0xE0, 0xEF}, {0xF0, 0xF4}};
+                for (int k = 0; k < 3; k++) {
+                    int s = new_nfa_state();
+                    nfa_[out.start].edges.push_back({kLead[k][0], kLead[k][1], s});
+                    for (int i = 0; i <= k; i++) {
+                        const int t = i == k ? out.end : new_nfa_state();
+                        nfa_[s].edges.push_back({0x80, 0xBF, t});
+                        s = t;
+                    }
+                }
+            }
+            return true;
+        }
+        case Node::kRef:
+            return build_ref(node.text, out, error);
+        case Node::kSeq: {
+            out.start = new_nfa_state();
+            int s = out.start;
+            for (const auto& child : node.children) {
+                Frag f;
+                if (!build(*child, f, error)) return false;
+                nfa_[s].eps.push_back(f.start);
+                s = f.end;
+            }
+            out.end = s;
+            return true;
+        }
+        case Node::kAlt: {
+            out.start = new_nfa_state();
+            out.end = new_nfa_state();
+            for (const auto& child : node.children) {
+                Frag f;
+                if (!build(*child, f, error)) return false;
+                nfa_[out.start].eps.push_back(f.start);
+                nfa_[f.end].eps.push_back(out.end);
+            }
+            return true;
+        }
+        case Node::kRepeat: {
+            const Node& child = *node.children[0];
+            if (node.min > kMaxBoundedRepeat || node.max > kMaxBoundedRepeat) {
+                error = "repetition bound too large";
+                return false;
+            }
+            out.start = new_nfa_state();
+            int s = out.start;
+            for (int i = 0; i < node.min; i++) {
+                Frag f;
+                if (!build(child, f, error)) return false;
+                nfa_[s].eps.push_back(f.start);
+                s = f.end;
+            }
+            out.end = new_nfa_state();
+            if (node.max == -1) {
+                Frag f;
+                if (!build(child, f, error)) return false;
+                nfa_[s].eps.push_back(f.start);
+                nfa_[f.end].eps.push_back(f.start);
+                nfa_[f.end].eps.push_back(out.end);
+                nfa_[s].eps.push_back(out.end);
+            } else {
+                for (int i = node.min; i < node.max; i++) {
+                    Frag f;
+                    if (!build(child, f, error)) return false;
+                    nfa_[s].eps.push_back(f.start);
+                    nfa_[s].eps.push_back(out.end);
+                    s = f.end;
+                }
+                nfa_[s].eps.push_back(out.end);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// ============================================================================
+// Subset construction
+// ============================================================================
+void GrammarDfa::closure(std::vector<int>& set) const {
+    std::vector<int> stack(set);
+    std::vector<uint8_t> seen(nfa_.size(), 0);
+    for (int s : set) seen[s] = 1;
+    while (!stack.empty()) {
+        const int s = stack.back();
+        stack.pop_back();
+        for (int t : nfa_[s].eps) {
+            if (!seen[t]) {
+                seen[t] = 1;
+                set.push_back(t);
+                stack.push_back(t);
+            }
+        }
+    }
+    std::sort(set.begin(), set.end());
+}
+
+int GrammarDfa::intern(std::vector<int>&& set) {
+    auto it = dfa_ids_.find(set);
+    if (it != dfa_ids_.end()) return it->second;
+
+    const int id = (int) dfa_sets_.size();
+    accepting_.push_back(std::binary_search(set.begin(), set.end(), nfa_final_) ? 1 : 0);
+    trans_.insert(trans_.end(), 256, -2);
+    dfa_ids_.emplace(set, id);
+    dfa_sets_.push_back(std::move(set));
+    return id;
+}
+
+bool GrammarDfa::compile(const std::string& gbnf, const std::string& root, std::string& error) {
+    error.clear();
+    rules_.clear();
+    nfa_.clear();
+    dfa_ids_.clear();
+    dfa_sets_.clear();
+    trans_.clear();
+    accepting_.clear();
+
+    GbnfParser parser(gbnf, error);
+    if (!parser.parse(rules_)) return false;
+
+    Frag frag;
+    if (!build_ref(root, frag, error)) return false;
+    nfa_final_ = frag.end;
+
+    std::vector<int> start_set{frag.start};
+    closure(start_set);
+    intern(std::move(start_set));
+
+    // Determinize everything now so a blow-up is caught here, not in the middle of decoding
+    for (int state = 0; state < n_states(); state++) {
+        for (int c = 0; c < 256; c++) {
+            step(state, (unsigned char) c);
+            if (n_states() > kMaxDfaStates) {
+                error = "grammar needs more than " + std::to_string(kMaxDfaStates) + " DFA states";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int GrammarDfa::step(int state, unsigned char byte) {
+    const int32_t cached = trans_[(size_t) state * 256 + byte];
+    if (cached != -2) return cached;
+
+    std::vector<int> next;
+    for (int s : dfa_sets_[state]) {
+        for (const Edge& e : nfa_[s].edges) {
+            if (byte >= e.lo && byte <= e.hi) next.push_back(e.to);
+        }
+    }
+    int target = kDead;
+    if (!next.empty()) {
+        closure(next);
+        next.erase(std::unique(next.begin(), next.end()), next.end());
+        target = intern(std::move(next));
+    }
+    trans_[(size_t) state * 256 + byte] = target;
+    return target;
+}
+
+int GrammarDfa::step(int state, const char* bytes, size_t n) {
+    for (size_t i = 0; i < n && state != kDead; i++) {
+        state = step(state, (unsigned char) bytes[i]);
+    }
+    return state;
+}
+
+bool GrammarDfa::exhausted(int state) {
+    for (int c = 0; c < 256; c++) {
+        if (step(state, (unsigned char) c) != kDead) return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// Token masks
+// ============================================================================
+GrammarTokenMasks::GrammarTokenMasks(GrammarDfa* dfa, const std::vector<std::string>* pieces,
+                                     std::vector<int32_t> eog)
+    : dfa_(dfa), pieces_(pieces), eog_(std::move(eog)), n_words_((pieces->size() + 63) / 64) {}
+
+const uint64_t* GrammarTokenMasks::mask(int state) {
+    auto it = masks_.find(state);
+    if (it != masks_.end()) return it->second.data();
+
+    if (masks_.size() >= kMaxCachedMasks) masks_.clear();
+
+    std::vector<uint64_t> bits(n_words_, 0);
+    const std::vector<std::string>& pieces = *pieces_;
+    for (size_t i = 0; i < pieces.size(); i++) {
+        const std::string& piece = pieces[i];
+        if (piece.empty()) continue;
+        if (dfa_->step(state, piece.data(), piece.size()) != GrammarDfa::kDead) {
+            bits[i >> 6] |= 1ULL << (i & 63);
+        }
+    }
+    if (dfa_->accepting(state)) {
+        for (int32_t id : eog_) {
+            if (id >= 0 && (size_t) id < pieces.size()) bits[id >> 6] |= 1ULL << (id & 63);
+        }
+    }
+    n_built_++;
+    return masks_.emplace(state, std::move(bits)).first->second.data();
+}
+
+int GrammarTokenMasks::advance(int state, int32_t token) {
+    const std::string& piece = (*pieces_)[token];
+    return dfa_->step(state, piece.data(), piece.size());
+}
+
+void apply_token_mask(const uint64_t* mask, float* logits, int n_vocab) {
+    const int n_words = (n_vocab + 63) / 64;
+    for (int w = 0; w < n_words; w++) {
+        const uint64_t bits = mask[w];
+        if (bits == ~0ULL) continue;
+
+        float* row = logits + (size_t) w * 64;
+        const int n = std::min(64, n_vocab - w * 64);
+        if (bits == 0) {
+            for (int j = 0; j < n; j++) row[j] = -INFINITY;
+        } else {
+            for (int j = 0; j < n; j++) {
+                row[j] = ((bits >> j) & 1) ? row[j] : -INFINITY;
+            }
+        }
+    }
+}
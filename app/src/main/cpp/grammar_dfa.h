@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Grammar-constrained decoding with cached per-state token masks
+// ============================================================================
+// A GBNF grammar whose language is regular (no recursive rules) is compiled into a
+// byte-level NFA and determinized. For every DFA state reached during decoding the set of
+// vocabulary tokens whose piece keeps the automaton alive is computed once and cached as a
+// bitset, so constraining a step is a single masked pass over the logits.
+// Recursive grammars, and grammars whose DFA would exceed kMaxDfaStates (subset construction
+// can blow up exponentially), are rejected by compile(); callers fall back to llama's
+// grammar sampler.
+class GrammarDfa {
+public:
+    static const int kDead = -1;
+    static const int kMaxDfaStates = 4096;      // 1 KiB of transitions each
+
+    // Compiles `gbnf` starting at rule `root`. Returns false and sets `error` if the grammar
+    // is malformed, recursive, too large, or uses features outside the supported subset.
+    bool compile(const std::string& gbnf, const std::string& root, std::string& error);
+
+    int start() const { return 0; }
+
+    // Next state after consuming `byte`, or kDead.
+    int step(int state, unsigned char byte);
+
+    // Runs a whole piece through the automaton.
+    int step(int state, const char* bytes, size_t n);
+
+    bool accepting(int state) const { return accepting_[state] != 0; }
+
+    // True if no byte can be consumed from `state` (the output is complete).
+    bool exhausted(int state);
+
+    int n_states() const { return (int) accepting_.size(); }
+
+private:
+    struct Edge {
+        unsigned char lo;
+        unsigned char hi;
+        int to;
+    };
+    struct NfaState {
+        std::vector<int> eps;
+        std::vector<Edge> edges;
+    };
+    struct Node;
+    struct Frag {
+        int start;
+        int end;
+    };
+
+    friend class GbnfParser;
+
+    int new_nfa_state();
+    bool build(const Node& node, Frag& out, std::string& error);
+    bool build_ref(const std::string& name, Frag& out, std::string& error);
+    void closure(std::vector<int>& set) const;
+    int intern(std::vector<int>&& set);
+
+    std::map<std::string, std::shared_ptr<Node>> rules_;
+    std::vector<std::string> expanding_;
+    std::vector<NfaState> nfa_;
+    int nfa_final_ = 0;
+
+    std::map<std::vector<int>, int> dfa_ids_;
+    std::vector<std::vector<int>> dfa_sets_;
+    std::vector<int32_t> trans_;            // 256 per DFA state, -2 = not computed yet
+    std::vector<uint8_t> accepting_;
+};
+
+// Allowed-token bitsets per DFA state, built on first visit.
+class GrammarTokenMasks {
+public:
+    // `pieces[i]` is the text of token i (empty for tokens that never satisfy a grammar).
+    // `eog` tokens are allowed exactly in accepting states.
+    GrammarTokenMasks(GrammarDfa* dfa, const std::vector<std::string>* pieces,
+                      std::vector<int32_t> eog);
+
+    // Bit i of the returned words is set if token i may be sampled in `state`.
+    const uint64_t* mask(int state);
+
+    int advance(int state, int32_t token);
+
+    size_t n_built() const { return n_built_; }
+
+private:
+    static const size_t kMaxCachedMasks = 256;
+
+    GrammarDfa* dfa_;
+    const std::vector<std::string>* pieces_;
+    std::vector<int32_t> eog_;
+    size_t n_words_;
+    std::unordered_map<int, std::vector<uint64_t>> masks_;
+    size_t n_built_ = 0;
+};
+
+// logits[i] = -inf wherever bit i of `mask` is clear.
+void apply_token_mask(const uint64_t* mask, float* logits, int n_vocab);
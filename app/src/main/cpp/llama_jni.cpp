@@ -3,12 +3,35 @@
 #include <vector>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <cstring>
 #include <algorithm>
+#include <chrono>
 #include <cctype>
+#include <cmath>
 #include <android/log.h>
 #include <sys/sysinfo.h>
+#include <time.h>
 
 #include "llama.h"
+#include "ggml-backend.h"
+#include "ggml-cpu.h"
+#include "autotune.h"
+#include "cpu_features.h"
+#include "cpu_topology.h"
+#include "generation_trace.h"
+#include "grammar_dfa.h"
+#include "parallel_tokenizer.h"
+#include "repetition_detector.h"
+#include "sampler_kernels.h"
+#include "stop_matcher.h"
+#include "thermal_governor.h"
+#include "utf8_assembler.h"
+#include "vocab_pieces.h"
+#include "vocab_subset.h"
 
 #define LOG_TAG "LlamaJNI"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
@@ -20,19 +43,30 @@
 // ============================================================================
 static llama_model* g_model = nullptr;
 static llama_context* g_ctx = nullptr;
-static llama_sampler* g_sampler = nullptr;
 static const llama_vocab* g_vocab = nullptr;
 static std::atomic<bool> g_is_generating{false};
 static std::atomic<uint64_t> g_generation_id{0};
 static std::atomic<uint64_t> g_stop_generation_id{0};
+static std::atomic<int64_t> g_stop_requested_us{0};
+static std::atomic<bool> g_abort_on_stop{true};  // abort in-flight graphs via llama abort callback
 
 // Pre-allocated reusable batch - NEVER allocate inside generation loop
 static llama_batch g_batch;
 static bool g_batch_initialized = false;
 static int g_batch_size = 128;
 static int g_context_size = 1024;
-static int g_n_threads = 4;
+// Thread counts are set from the UI thread and read by generation and tuning threads
+static std::atomic<int> g_n_threads{4};             // topology default, starting point for both below
+static std::atomic<int> g_n_threads_prefill{4};     // n_threads_batch: compute-bound prompt batches
+static std::atomic<int> g_n_threads_decode{4};      // n_threads: bandwidth-bound single-token steps
 static int g_max_gen_tokens = 256;
+static bool g_kv_quantized = false;         // q8_0 K/V cache instead of f16 (needs flash attention)
+static int g_flash_attn = -1;               // -1 = llama.cpp default, 0 = off, 1 = on
+
+// Prefill scheduling - chunk size adapts so one llama_decode step stays under the target
+static const int kMinPrefillChunk = 16;     // keep chunks large enough for efficient GEMMs
+static const int kDefaultPrefillTargetMs = 150;
+static std::atomic<int> g_prefill_target_ms{kDefaultPrefillTargetMs};  // 0 = fixed-size chunks
 
 static const int kLowEndContext = 512;
 static const int kMidContext = 1024;
@@ -50,9 +84,170 @@ static const int kMidMaxGenTokens = 512;
 static const int kHighMaxGenTokens = 768;
 static const uint64_t kMaxParams = 7ULL * 1000ULL * 1000ULL * 1000ULL; // 7B
 
+// Repetition-loop handling - small quantized models often get stuck repeating a phrase
+enum RepetitionPolicy {
+    kRepetitionOff = 0,
+    kRepetitionStop = 1,        // end generation once a loop is detected
+    kRepetitionPenalize = 2,    // ban the token that continues the loop, stop if it persists
+};
+static std::atomic<int> g_repetition_policy{kRepetitionStop};
+static const int kRepetitionMaxPenalties = 4;   // loop continuations the penalize policy bans;
+                                                // the next detection stops generation
+
+// Why the most recent generation ended
+enum StopReason {
+    kStopNone = 0,
+    kStopEos,
+    kStopMaxTokens,
+    kStopContextFull,
+    kStopRequested,
+    kStopRepetition,
+    kStopSequence,
+    kStopError,
+    kStopTruncated,         // the sink could not take the output
+};
+
+static const char* stop_reason_name(int reason) {
+    switch (reason) {
+        case kStopEos: return "eos";
+        case kStopMaxTokens: return "max_tokens";
+        case kStopContextFull: return "context_full";
+        case kStopRequested: return "stopped";
+        case kStopRepetition: return "repetition";
+        case kStopSequence: return "stop_sequence";
+        case kStopError: return "error";
+        case kStopTruncated: return "truncated";
+        default: return "none";
+    }
+}
+
+// Special/control token suppression - built once per model at load
+static bool g_allow_eog_tokens = true;              // EOG tokens must still end the turn
+static std::vector<std::string> g_allowed_special;  // pieces exempt from suppression
+static std::vector<llama_logit_bias> g_special_token_bias;
+
+// Chat formatting - template and end-of-turn tokens come from the GGUF metadata
+static const char* g_chat_template = nullptr;       // owned by g_model
+static std::vector<llama_token> g_turn_end_tokens;  // stop tokens besides llama_vocab_is_eog
+static const char* const kTurnEndMarkers[] = {
+    "<|im_end|>", "<|eot_id|>", "<|end|>", "<end_of_turn>", "<|endoftext|>",
+    "<|END_OF_TURN_TOKEN|>", "<|end_of_turn|>", "</s>",
+};
+
+// Grammar-constrained decoding - the last compiled grammar keeps its cached token masks
+struct CompiledGrammar {
+    std::string source;
+    GrammarDfa dfa;
+    std::unique_ptr<GrammarTokenMasks> masks;
+};
+static std::unique_ptr<CompiledGrammar> g_grammar;
+static std::vector<std::string> g_grammar_pieces;   // plain-text piece per token, built lazily
+
 // JVM reference for callbacks
 static JavaVM* g_jvm = nullptr;
 
+// Stats of the most recent generation, reported via getGenerationStats()
+struct GenerationStats {
+    int64_t tokenize_us = 0;
+    int tokenize_chunks = 0;                // > 1 when the prompt was tokenized in parallel
+    int n_prompt = 0;
+    int n_generated = 0;
+    int n_prefill_chunks = 0;
+    int min_prefill_chunk = 0;
+    int64_t prefill_us = 0;
+    int64_t max_prefill_step_us = 0;
+    int64_t decode_us = 0;
+    int64_t stop_latency_us = -1;           // stopGeneration() -> idle, -1 if not stopped
+    int stop_reason = kStopNone;
+    int repetition_period = 0;              // period of the last detected loop
+    int repetition_hits = 0;
+    int64_t sample_us = 0;                  // time spent in the sampler
+    int64_t constraint_us = 0;              // time spent masking/advancing the grammar
+    const char* sampling_mode = "fused";    // fused, greedy (argmax) or chain (grammar fallback)
+    int vocab_subset = 0;                   // tokens sampled from, 0 = full vocabulary
+    const char* grammar_mode = "none";      // none, dfa (cached masks) or llama (fallback)
+    int grammar_states = 0;
+    int grammar_masks_built = 0;
+    bool output_truncated = false;          // byte output buffer filled up
+    bool pinned = false;                    // decode ran on the performance cores only
+    int n_threads_prefill = 0;
+    int n_threads_decode = 0;
+    const char* threadpool = "off";         // off (llama-managed workers), or the poll level
+    int64_t token_p50_us = 0;               // inter-token latency percentiles
+    int64_t token_p95_us = 0;
+    int64_t decode_cpu_us = 0;              // process CPU time over the decode phase
+    int threads_decode_final = 0;           // after the governor's adjustments
+    std::vector<GovernorDecision> governor_decisions;
+};
+// The generation in progress fills g_stats on its own thread; end_generation publishes
+// the finished stats as g_last_stats, which other threads copy through last_stats().
+static GenerationStats g_stats;
+static GenerationStats g_last_stats;
+static std::mutex g_last_stats_mutex;
+
+static GenerationStats last_stats() {
+    std::lock_guard<std::mutex> lock(g_last_stats_mutex);
+    return g_last_stats;
+}
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// CPU time consumed by every thread of the process.
+static int64_t cpu_time_us() {
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) return 0;
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ============================================================================
+// Cancellation
+// ============================================================================
+// Polled by ggml between graph nodes, so a stop request interrupts an in-flight
+// llama_decode instead of waiting for the whole ubatch to finish.
+static bool generation_abort_callback(void* data) {
+    const uint64_t id = (uint64_t) (uintptr_t) data;
+    return g_stop_generation_id.load(std::memory_order_relaxed) == id;
+}
+
+static void request_stop() {
+    g_stop_requested_us.store(now_us());
+    g_stop_generation_id.store(g_generation_id.load());
+}
+
+static void reset_threadpools();
+static std::atomic<bool> g_threadpool_reset_pending{false};     // see request_threadpool_reset
+
+// Marks the generation idle and records how long it took to honor a stop request.
+static void end_generation(uint64_t local_id) {
+    if (g_ctx != nullptr) {
+        llama_set_abort_callback(g_ctx, nullptr, nullptr);
+    }
+    const int64_t requested = g_stop_requested_us.exchange(0);
+    if (requested > 0 && g_stop_generation_id.load() == local_id) {
+        g_stats.stop_latency_us = now_us() - requested;
+        LOGI("Stop-to-idle latency: %.1f ms (abort callback %s)",
+             g_stats.stop_latency_us / 1000.0, g_abort_on_stop.load() ? "on" : "off");
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_last_stats_mutex);
+        g_last_stats = g_stats;
+    }
+    if (g_threadpool_reset_pending.exchange(false)) reset_threadpools();
+    g_is_generating = false;
+}
+
+// Drops KV cells written by a partially evaluated (aborted or failed) decode so the
+// cache again holds exactly positions [0, n_valid).
+static void rollback_kv(int n_valid) {
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    if (mem) {
+        llama_memory_seq_rm(mem, 0, n_valid, -1);
+    }
+}
+
 // ============================================================================
 // Safe, fixed configuration for broad compatibility
 // ============================================================================
@@ -64,13 +259,34 @@ static long getTotalMemoryMB() {
     return 4096;
 }
 
+// big.LITTLE topology, read once. With pinning on, the thread running llama_decode (and so
+// every ggml worker it spawns) is restricted to the performance cores.
+static std::atomic<bool> g_pin_threads{false};
+
+// The first caller detects it; a function-local static, so concurrent first calls are safe.
+static const CpuTopology& cpu_topology() {
+    static const CpuTopology topology = [] {
+        const int hw = (int) std::thread::hardware_concurrency();
+        CpuTopology detected = detect_cpu_topology(kSysfsCpuRoot, std::max(1, hw));
+        LOGI("CPU topology: %d cores, %d performance", detected.n_cores(), detected.n_performance());
+        return detected;
+    }();
+    return topology;
+}
+
+// One thread per performance core: a ggml thread on an efficiency core gates every matmul.
 static int getThreadCount(bool lowEnd) {
-    int cpuCores = std::thread::hardware_concurrency();
+    int cpuCores = cpu_topology().n_performance();
     if (cpuCores <= 0) cpuCores = 1;
     int cap = lowEnd ? kLowEndMaxThreads : kMaxThreads;
     return std::min(cpuCores, cap);
 }
 
+static std::vector<int> pinned_cpus() {
+    return g_pin_threads && cpu_topology().heterogeneous() ? cpu_topology().performance_cpus()
+                                                            : std::vector<int>();
+}
+
 static void applyDeviceConfig() {
     const long totalMB = getTotalMemoryMB();
     const bool lowEnd = totalMB <= 3072;
@@ -98,34 +314,534 @@ static void applyDeviceConfig() {
     }
 
     g_n_threads = getThreadCount(lowEnd);
+    g_kv_quantized = false;
+    g_flash_attn = -1;
 
     LOGI("Device config: RAM=%ldMB -> ctx=%d, batch=%d, threads=%d, maxTokens=%d",
-         totalMB, g_context_size, g_batch_size, g_n_threads, g_max_gen_tokens);
+         totalMB, g_context_size, g_batch_size, g_n_threads.load(), g_max_gen_tokens);
 }
 
 // ============================================================================
-// Tokenization helpers
+// Chat template
 // ============================================================================
-static std::vector<llama_token> tokenize_prompt(const std::string& text, bool add_special) {
-    if (g_vocab == nullptr) return {};
-    
-    int n_tokens = text.length() + 32;
-    std::vector<llama_token> tokens(n_tokens);
+// Registers the vocabulary's EOT token plus every known turn-end marker that the
+// model's chat template actually uses, so generation ends at the true turn boundary
+// even when the GGUF does not flag those tokens as EOG.
+static void load_chat_template() {
+    g_chat_template = nullptr;
+    g_turn_end_tokens.clear();
+    if (g_model == nullptr || g_vocab == nullptr) return;
+
+    g_chat_template = llama_model_chat_template(g_model, nullptr);
+
+    const llama_token eot = llama_vocab_eot(g_vocab);
+    if (eot != LLAMA_TOKEN_NULL) g_turn_end_tokens.push_back(eot);
+
+    if (g_chat_template != nullptr) {
+        const std::string tmpl(g_chat_template);
+        for (const char* marker : kTurnEndMarkers) {
+            if (tmpl.find(marker) == std::string::npos) continue;
+            llama_token id;
+            const int n = llama_tokenize(g_vocab, marker, (int) strlen(marker), &id, 1, false, true);
+            if (n == 1 && std::find(g_turn_end_tokens.begin(), g_turn_end_tokens.end(), id) ==
+                              g_turn_end_tokens.end()) {
+                g_turn_end_tokens.push_back(id);
+            }
+        }
+    }
+    LOGI("Chat template: %s, %zu end-of-turn tokens",
+         g_chat_template != nullptr ? "embedded" : "none", g_turn_end_tokens.size());
+}
+
+static bool is_end_of_turn(llama_token token) {
+    if (llama_vocab_is_eog(g_vocab, token)) return true;
+    return std::find(g_turn_end_tokens.begin(), g_turn_end_tokens.end(), token) !=
+           g_turn_end_tokens.end();
+}
+
+// Formats a conversation with the model's embedded template. Returns false if the model
+// has no template or llama.cpp does not recognize it.
+static bool apply_chat_template(const std::vector<llama_chat_message>& messages, bool add_assistant,
+                                std::string& out) {
+    if (g_chat_template == nullptr) return false;
+
+    size_t total = 0;
+    for (const auto& msg : messages) total += strlen(msg.content);
+    out.resize(total * 2 + 256);
+
+    int n = llama_chat_apply_template(g_chat_template, messages.data(), messages.size(),
+                                      add_assistant, out.data(), (int32_t) out.size());
+    if (n > (int) out.size()) {
+        out.resize(n);
+        n = llama_chat_apply_template(g_chat_template, messages.data(), messages.size(),
+                                      add_assistant, out.data(), (int32_t) out.size());
+    }
+    if (n < 0) return false;
+    out.resize(n);
+    return true;
+}
+
+// ============================================================================
+// Sampler setup
+// ============================================================================
+// Added (user-defined) tokens that are chat markers such as <|im_start|> or [INST]: a
+// bracketed piece without whitespace. Many GGUF conversions mark these USER_DEFINED
+// rather than CONTROL.
+static bool is_marker_token_text(const char* text) {
+    const size_t n = text != nullptr ? strlen(text) : 0;
+    if (n < 3) return false;
+    const bool angle = text[0] == '<' && text[n - 1] == '>';
+    const bool square = text[0] == '[' && text[n - 1] == ']';
+    if (!angle && !square) return false;
+    for (size_t i = 0; i < n; i++) {
+        if (isspace((unsigned char) text[i])) return false;
+    }
+    return true;
+}
+
+// Collects a -inf logit bias for every control/unknown token, and every user-defined
+// marker token, of the vocabulary so the sampler can never pick one. EOG tokens (if
+// allowed) and configured exceptions pass.
+static void build_special_token_mask() {
+    g_special_token_bias.clear();
+    if (g_vocab == nullptr) return;
+
+    const int n_vocab = llama_vocab_n_tokens(g_vocab);
+    for (llama_token id = 0; id < n_vocab; id++) {
+        const int attr = llama_vocab_get_attr(g_vocab, id);
+        const char* text = llama_vocab_get_text(g_vocab, id);
+        const bool special = (attr & (LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_UNKNOWN)) != 0 ||
+                             ((attr & LLAMA_TOKEN_ATTR_USER_DEFINED) && is_marker_token_text(text));
+        if (!special) continue;
+        if (g_allow_eog_tokens && is_end_of_turn(id)) continue;
+
+        if (text != nullptr &&
+            std::find(g_allowed_special.begin(), g_allowed_special.end(), text) !=
+                g_allowed_special.end()) {
+            continue;
+        }
+        g_special_token_bias.push_back({id, -INFINITY});
+    }
+    LOGI("Suppressing %zu special/control tokens", g_special_token_bias.size());
+}
+
+// Default sampling - near-greedy settings for SPEED (lower values = less randomness)
+static const SamplerParams kDefaultSamplerParams = {20, 0.85f, 0.6f, 0.0f};
+
+// Per-request sampling settings (LlamaCpp.SamplerConfig on the Kotlin side)
+struct SamplerConfig {
+    SamplerParams params;
+    uint32_t seed = LLAMA_DEFAULT_SEED;
+};
+
+// llama_sampler wrapper around FusedSampler. Inside a chain it works on llama's candidate
+// array; on its own, run_generation hands it the logits row directly (see sample_next).
+struct FusedSamplerCtx {
+    FusedSampler sampler;
+    std::vector<float> scratch;
+};
+
+static const char* fused_sampler_name(const llama_sampler* /* smpl */) {
+    return "fused-top-k-p-temp";
+}
+
+static void fused_sampler_apply(llama_sampler* smpl, llama_token_data_array* cur_p) {
+    auto* fs = (FusedSamplerCtx*) smpl->ctx;
+    fs->scratch.resize(cur_p->size);
+    for (size_t i = 0; i < cur_p->size; i++) fs->scratch[i] = cur_p->data[i].logit;
+    const int32_t idx = fs->sampler.sample(fs->scratch.data(), (int) cur_p->size);
+    cur_p->selected = idx < 0 ? 0 : idx;
+}
+
+static void fused_sampler_reset(llama_sampler* smpl) {
+    ((FusedSamplerCtx*) smpl->ctx)->sampler.reset();
+}
+
+static llama_sampler* fused_sampler_clone(const llama_sampler* smpl);
+
+static void fused_sampler_free(llama_sampler* smpl) {
+    delete (FusedSamplerCtx*) smpl->ctx;
+}
+
+static const llama_sampler_i kFusedSamplerIface = {
+    /* .name   = */ fused_sampler_name,
+    /* .accept = */ nullptr,
+    /* .apply  = */ fused_sampler_apply,
+    /* .reset  = */ fused_sampler_reset,
+    /* .clone  = */ fused_sampler_clone,
+    /* .free   = */ fused_sampler_free,
+};
+
+static llama_sampler* create_fused_sampler(const SamplerParams& params, uint32_t seed) {
+    return llama_sampler_init(&kFusedSamplerIface, new FusedSamplerCtx{FusedSampler(params, seed), {}});
+}
+
+static llama_sampler* fused_sampler_clone(const llama_sampler* smpl) {
+    const FusedSampler& fs = ((const FusedSamplerCtx*) smpl->ctx)->sampler;
+    return create_fused_sampler(fs.params(), fs.seed());
+}
+
+// Builds the sampling chain. `constraint` (owned by the chain) runs first, e.g. a grammar.
+// A temperature <= 0 ends the chain with llama's greedy stage instead of the fused one.
+static llama_sampler* create_sampler_chain(llama_sampler* constraint, const SamplerConfig& config) {
+    llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
+    llama_sampler* chain = llama_sampler_chain_init(sparams);
+
+    if (constraint != nullptr) {
+        llama_sampler_chain_add(chain, constraint);
+    }
+
+    // Banned special tokens are masked before anything else looks at the candidates
+    if (!g_special_token_bias.empty()) {
+        llama_sampler_chain_add(chain, llama_sampler_init_logit_bias(
+            llama_vocab_n_tokens(g_vocab), (int32_t) g_special_token_bias.size(),
+            g_special_token_bias.data()));
+    }
+
+    llama_sampler_chain_add(chain, config.params.temp <= 0.0f
+        ? llama_sampler_init_greedy()
+        : create_fused_sampler(config.params, config.seed));
+    return chain;
+}
+
+// Stateless greedy sampler shared by all deterministic requests. sample_next recognizes it
+// and runs the vectorized argmax on the logits row instead.
+static llama_sampler* greedy_sampler() {
+    static llama_sampler* greedy = llama_sampler_init_greedy();
+    return greedy;
+}
+
+// ============================================================================
+// Vocabulary subset - sampling over the tokens a deployment actually uses
+// ============================================================================
+// Experimental, off by default. The win that matters - pruning rows of the lm_head matmul -
+// needs the output tensor and graph, which llama.h does not expose: llama_decode always
+// projects onto the full vocabulary. What the subset shrinks is everything after that
+// (bias, scan, draw), a small share of decode time, at the cost of exactness: tokens outside
+// the subset can never be sampled. evaluateVocabSubset measures both sides.
+static VocabSubset g_vocab_subset;
+static std::atomic<bool> g_vocab_subset_enabled{false};
+static std::vector<float> g_subset_logits;
+
+// Identifies the loaded model for on-disk caches (FNV-1a over its description and sizes).
+static uint64_t model_fingerprint() {
+    char desc[256];
+    llama_model_desc(g_model, desc, sizeof(desc));
+    const std::string key = std::string(desc) + "|" +
+                            std::to_string(llama_model_n_params(g_model)) + "|" +
+                            std::to_string(llama_model_size(g_model)) + "|" +
+                            std::to_string(llama_vocab_n_tokens(g_vocab));
+    uint64_t h = 1469598103934665603ULL;
+    for (unsigned char c : key) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Tokens that must stay available whatever the corpus: special/control/byte tokens, the
+// end-of-turn set, and single-byte pieces (byte-level BPE fallback).
+static void add_required_subset_tokens(std::vector<int32_t>& tokens) {
+    const int n_vocab = llama_vocab_n_tokens(g_vocab);
+    const int required = LLAMA_TOKEN_ATTR_CONTROL | LLAMA_TOKEN_ATTR_USER_DEFINED |
+                         LLAMA_TOKEN_ATTR_BYTE | LLAMA_TOKEN_ATTR_UNKNOWN;
+    char buf[8];
+    for (llama_token id = 0; id < n_vocab; id++) {
+        if ((llama_vocab_get_attr(g_vocab, id) & required) != 0 || is_end_of_turn(id) ||
+            llama_vocab_is_eog(g_vocab, id) ||
+            llama_token_to_piece(g_vocab, id, buf, sizeof(buf), 0, true) == 1) {
+            tokens.push_back(id);
+        }
+    }
+}
+
+static bool vocab_subset_active() {
+    return g_vocab_subset_enabled && !g_vocab_subset.empty();
+}
+
+// Samples from the last logits row. The standalone fused and greedy samplers read the row
+// directly, skipping the n_vocab candidate array llama_sampler_sample would build, and only
+// consider the tokens of `subset` if one is given; chains go the regular way.
+static llama_token sample_next(llama_sampler* smpl, int n_vocab, const VocabSubset* subset) {
+    const bool greedy = smpl == greedy_sampler();
+    if (!greedy && smpl->iface != &kFusedSamplerIface) {
+        return llama_sampler_sample(smpl, g_ctx, -1);
+    }
+    float* logits = llama_get_logits_ith(g_ctx, -1);
+    for (const llama_logit_bias& b : g_special_token_bias) logits[b.token] += b.bias;
     
-    int actual = llama_tokenize(g_vocab, text.c_str(), text.length(), 
-                                tokens.data(), n_tokens, add_special, true);
+    const float* row = logits;
+    int n = n_vocab;
+    if (subset != nullptr) {
+        g_subset_logits.resize(subset->size());
+        subset->gather(logits, g_subset_logits.data());
+        row = g_subset_logits.data();
+        n = (int) g_subset_logits.size();
+    }
     
+    const int32_t idx = greedy ? argmax(row, n)
+                               : ((FusedSamplerCtx*) smpl->ctx)->sampler.sample(row, n);
+    if (idx < 0) return llama_vocab_eos(g_vocab);
+    return subset != nullptr ? subset->ids()[idx] : idx;
+}
+
+// Drops per-model grammar state (compiled masks are only valid for one vocabulary).
+static void reset_grammar_cache() {
+    g_grammar.reset();
+    g_grammar_pieces.clear();
+    g_grammar_pieces.shrink_to_fit();
+}
+
+// ============================================================================
+// Tokenization helpers
+// ============================================================================
+// Long prompts are tokenized in chunks on g_n_threads threads. Whether cutting at the
+// chunk boundaries is exact depends on the model's pre-tokenizer, so the first parallel
+// run per model is checked against llama_tokenize and parallel mode is dropped on mismatch.
+enum ParallelTokenizeMode {
+    kParallelTokenizeOff = 0,
+    kParallelTokenizeOn = 1,        // verified once per model
+    kParallelTokenizeVerify = 2,    // every parallel run is checked (benchmarks, debugging)
+};
+enum TokenizerSplitState { kSplitUnverified, kSplitExact, kSplitInexact };
+static std::atomic<int> g_parallel_tokenize_mode{kParallelTokenizeOn};   // set from the UI thread
+static std::atomic<int> g_tokenizer_split_state{kSplitUnverified};
+static const size_t kParallelTokenizeMinBytes = 8192;
+
+static bool tokenize_text(const char* text, size_t n, bool add_special,
+                          std::vector<llama_token>& tokens) {
+    tokens.resize(n + 32);
+    int actual = llama_tokenize(g_vocab, text, (int) n, tokens.data(), (int) tokens.size(),
+                                add_special, true);
     if (actual < 0) {
         tokens.resize(-actual);
-        actual = llama_tokenize(g_vocab, text.c_str(), text.length(),
-                                tokens.data(), tokens.size(), add_special, true);
+        actual = llama_tokenize(g_vocab, text, (int) n, tokens.data(), (int) tokens.size(),
+                                add_special, true);
     }
-    
-    if (actual < 0) return {};
+    if (actual < 0) return false;
     tokens.resize(actual);
+    return true;
+}
+
+// Returns the number of chunks tokenized in parallel (1 = single-threaded), 0 on failure.
+static int tokenize_parallel(const std::string& text, bool add_special,
+                             std::vector<llama_token>& tokens) {
+    const int n_chunks = ParallelTokenizer::tokenize(text, add_special, g_n_threads,
+                                                     tokenize_text, tokens);
+    if (n_chunks < 2 || (g_tokenizer_split_state == kSplitExact &&
+                         g_parallel_tokenize_mode != kParallelTokenizeVerify)) {
+        return n_chunks;
+    }
+    
+    std::vector<llama_token> serial;
+    if (!tokenize_text(text.data(), text.size(), add_special, serial)) return 0;
+    if (serial == tokens) {
+        g_tokenizer_split_state = kSplitExact;
+        return n_chunks;
+    }
+    LOGI("Parallel tokenization differs from llama_tokenize for this model (%zu vs %zu tokens), "
+         "disabled", tokens.size(), serial.size());
+    g_tokenizer_split_state = kSplitInexact;
+    tokens.swap(serial);
+    return 1;
+}
+
+static std::vector<llama_token> tokenize_prompt(const std::string& text, bool add_special,
+                                                int* n_chunks = nullptr) {
+    if (g_vocab == nullptr) return {};
+    
+    std::vector<llama_token> tokens;
+    int chunks = 1;
+    if (g_parallel_tokenize_mode != kParallelTokenizeOff && g_n_threads > 1 &&
+        text.size() >= kParallelTokenizeMinBytes && g_tokenizer_split_state != kSplitInexact) {
+        chunks = tokenize_parallel(text, add_special, tokens);
+        if (chunks == 0) return {};
+    } else if (!tokenize_text(text.data(), text.size(), add_special, tokens)) {
+        return {};
+    }
+    if (n_chunks != nullptr) *n_chunks = chunks;
+    
+    // Chat templates may already start with the BOS text - don't feed BOS twice
+    const llama_token bos = llama_vocab_bos(g_vocab);
+    if (add_special && tokens.size() >= 2 && bos != LLAMA_TOKEN_NULL &&
+        tokens[0] == bos && tokens[1] == bos) {
+        tokens.erase(tokens.begin());
+    }
     return tokens;
 }
 
+// Receives the generated text, in order, on the generation thread. Bytes held back by
+// the stop-sequence matcher are only delivered once they can no longer start a match,
+// and every chunk is whole UTF-8 code points - never empty, never a split character.
+// Returns false if the text was not delivered; the generation then stops as truncated.
+struct TokenSink {
+    virtual ~TokenSink() = default;
+    virtual bool on_text(const char* text, size_t n) = 0;
+};
+
+// NewStringUTF takes modified UTF-8, which encodes supplementary characters (emoji) as
+// surrogate pairs; standard 4-byte sequences are rejected by CheckJNI.
+static jstring new_string_utf8(JNIEnv* env, const char* data, size_t n, std::string& scratch) {
+    scratch.clear();
+    append_modified_utf8(data, n, scratch);
+    return env->NewStringUTF(scratch.c_str());
+}
+
+// ============================================================================
+// Token delivery - call back into Java off the decode thread
+// ============================================================================
+// The generation loop hands each piece of text to this worker and immediately submits
+// the next llama_decode. NewStringUTF and the Kotlin callback then overlap with graph
+// computation. A stop request issued from the callback still aborts the in-flight decode
+// through the abort callback.
+//
+// In byte mode (start_bytes) the text is appended to a caller-owned direct buffer instead
+// and the callback, if any, only receives the (offset, length) of each new region - no Java
+// strings at all. Everything queued since the last wake-up is delivered as one region.
+class TokenDeliveryWorker : public TokenSink {
+public:
+    bool start(JNIEnv* env, jobject callback, jmethodID on_token, uint64_t generation_id,
+               size_t reserve) {
+        callback_ = env->NewGlobalRef(callback);
+        if (callback_ == nullptr) return false;
+        on_token_ = on_token;
+        generation_id_ = generation_id;
+        response_.reserve(reserve);
+        thread_ = std::thread(&TokenDeliveryWorker::run, this);
+        return true;
+    }
+
+    // `callback` may be null when only the final output is wanted. Output that does not
+    // fit in `capacity` bytes stops the generation; it is cut at a chunk boundary, so
+    // the buffer always holds whole UTF-8 code points.
+    bool start_bytes(JNIEnv* env, jobject callback, jmethodID on_bytes, uint64_t generation_id,
+                     char* output, size_t capacity) {
+        if (callback != nullptr) {
+            callback_ = env->NewGlobalRef(callback);
+            if (callback_ == nullptr) return false;
+        }
+        on_token_ = on_bytes;
+        generation_id_ = generation_id;
+        output_ = output;
+        capacity_ = capacity;
+        thread_ = std::thread(&TokenDeliveryWorker::run, this);
+        return true;
+    }
+
+    bool on_text(const char* text, size_t n) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.emplace_back(text, n);
+        }
+        cv_.notify_one();
+        return true;
+    }
+
+    // Delivers everything still queued (unless stopped), then joins the worker.
+    void finish(JNIEnv* env) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_one();
+        if (thread_.joinable()) thread_.join();
+        if (callback_ != nullptr) {
+            env->DeleteGlobalRef(callback_);
+            callback_ = nullptr;
+        }
+    }
+
+    const std::string& response() const { return response_; }
+
+    size_t written() const { return written_; }
+
+    bool truncated() const { return truncated_; }
+
+private:
+    void run() {
+        JNIEnv* env = nullptr;
+        if (callback_ != nullptr &&
+            (g_jvm == nullptr || g_jvm->AttachCurrentThread(&env, nullptr) != JNI_OK)) {
+            LOGE("Token delivery: failed to attach thread");
+            return;
+        }
+
+        std::deque<std::string> pending;
+        std::string scratch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return done_ || !queue_.empty(); });
+                if (queue_.empty() && done_) break;
+                pending.swap(queue_);
+            }
+            if (output_ != nullptr) {
+                deliver_bytes(env, pending);
+            } else {
+                deliver_strings(env, pending, scratch);
+            }
+            pending.clear();
+        }
+
+        if (env != nullptr) g_jvm->DetachCurrentThread();
+    }
+
+    void deliver_strings(JNIEnv* env, const std::deque<std::string>& pending, std::string& scratch) {
+        for (const std::string& piece : pending) {
+            // Text produced after a stop request is never delivered
+            if (g_stop_generation_id.load() == generation_id_) break;
+            response_.append(piece);
+
+            jstring jtoken = new_string_utf8(env, piece.data(), piece.size(), scratch);
+            env->CallVoidMethod(callback_, on_token_, jtoken);
+            env->DeleteLocalRef(jtoken);
+            if (!check_callback(env)) break;
+        }
+    }
+
+    void deliver_bytes(JNIEnv* env, const std::deque<std::string>& pending) {
+        const size_t start = written_;
+        for (const std::string& piece : pending) {
+            if (g_stop_generation_id.load() == generation_id_ || truncated_) break;
+            if (piece.size() > capacity_ - written_) {
+                LOGI("Output buffer full after %zu bytes, stopping", written_);
+                truncated_ = true;
+                g_stop_generation_id.store(generation_id_);
+                break;
+            }
+            memcpy(output_ + written_, piece.data(), piece.size());
+            written_ += piece.size();
+        }
+        if (callback_ != nullptr && written_ > start) {
+            env->CallVoidMethod(callback_, on_token_, (jint) start, (jint) (written_ - start));
+            check_callback(env);
+        }
+    }
+
+    // A throwing callback stops the generation.
+    bool check_callback(JNIEnv* env) {
+        if (!env->ExceptionCheck()) return true;
+        env->ExceptionDescribe();
+        env->ExceptionClear();
+        g_stop_generation_id.store(generation_id_);
+        return false;
+    }
+
+    jobject callback_ = nullptr;
+    jmethodID on_token_ = nullptr;
+    uint64_t generation_id_ = 0;
+    std::string response_;
+    char* output_ = nullptr;                // byte mode: caller's direct buffer
+    size_t capacity_ = 0;
+    size_t written_ = 0;
+    bool truncated_ = false;
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::string> queue_;
+    bool done_ = false;
+};
+
 // ============================================================================
 // Batch helper - reuses pre-allocated batch
 // ============================================================================
@@ -144,262 +860,862 @@ static void batch_add(llama_token token, int pos, bool logits) {
 }
 
 // ============================================================================
-// JNI Lifecycle
+// Prefill chunk scheduling
 // ============================================================================
-extern "C" {
+// Picks the size of the next prompt chunk so that a single llama_decode step stays
+// close to g_prefill_target_ms. The per-token cost is measured on the previous chunk;
+// the first chunk uses the full batch. Chunks are rounded to multiples of
+// kMinPrefillChunk to keep the matmuls well shaped.
+static int next_prefill_chunk(int remaining, int64_t last_step_us, int last_chunk) {
+    int chunk = g_batch_size;
+    if (g_prefill_target_ms > 0 && last_chunk > 0 && last_step_us > 0) {
+        const double us_per_token = (double) last_step_us / last_chunk;
+        int fit = (int) ((g_prefill_target_ms * 1000.0) / us_per_token);
+        fit = (fit / kMinPrefillChunk) * kMinPrefillChunk;
+        chunk = std::max(kMinPrefillChunk, std::min(fit, g_batch_size));
+    }
+    return std::min(chunk, remaining);
+}
 
-JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
-    g_jvm = vm;
-    llama_backend_init();
-    LOGI("Llama backend initialized");
-    return JNI_VERSION_1_6;
+// ============================================================================
+// CPU backend variants - runtime dispatch on CPU features
+// ============================================================================
+// Builds with XIREA_CPU_VARIANTS do not link ggml's CPU backend. They ship one backend
+// module per instruction-set level (cpu_features.h) and load the most capable one the
+// device runs before the first model, falling back to lesser ones if a load fails. The
+// threadpool entry points then live in that module and come from its registry. Modules
+// export create/free only, so in these builds pause/resume stay null and pools are never
+// parked: idle workers fall asleep on their own once their poll period runs out.
+struct CpuThreadpoolApi {
+    decltype(&ggml_threadpool_new) create = nullptr;
+    decltype(&ggml_threadpool_free) free = nullptr;
+    decltype(&ggml_threadpool_pause) pause = nullptr;
+    decltype(&ggml_threadpool_resume) resume = nullptr;
+};
+static CpuThreadpoolApi g_threadpool_api;
+static std::string g_forced_cpu_variant;            // empty = best runnable
+static std::string g_cpu_variant;                   // loaded module, "builtin" when linked
+static std::mutex g_model_mutex;                    // held while the model or context is rebuilt
+#ifdef XIREA_CPU_VARIANTS
+static ggml_backend_reg_t g_cpu_backend = nullptr;
+#endif
+
+static bool load_cpu_backend() {
+    if (!g_cpu_variant.empty()) return true;
+#ifdef XIREA_CPU_VARIANTS
+    const uint32_t features = detect_cpu_features();
+    for (const CpuVariant& v : runnable_cpu_variants(host_cpu_arch(), features, g_forced_cpu_variant)) {
+        g_cpu_backend = ggml_backend_load(cpu_variant_library(v).c_str());
+        if (g_cpu_backend != nullptr) {
+            g_cpu_variant = v.name;
+            break;
+        }
+        LOGE("CPU backend %s failed to load", v.name);
+    }
+    if (g_cpu_backend == nullptr) {
+        LOGE("No CPU backend for features [%s]%s%s", cpu_feature_names(features).c_str(),
+             g_forced_cpu_variant.empty() ? "" : ", forced ", g_forced_cpu_variant.c_str());
+        return false;
+    }
+    g_threadpool_api.create = (decltype(&ggml_threadpool_new))
+        ggml_backend_reg_get_proc_address(g_cpu_backend, "ggml_threadpool_new");
+    g_threadpool_api.free = (decltype(&ggml_threadpool_free))
+        ggml_backend_reg_get_proc_address(g_cpu_backend, "ggml_threadpool_free");
+    if (g_threadpool_api.free == nullptr) g_threadpool_api.create = nullptr;
+    LOGI("CPU backend: %s (features: %s)", g_cpu_variant.c_str(), cpu_feature_names(features).c_str());
+#else
+    g_threadpool_api.create = ggml_threadpool_new;
+    g_threadpool_api.free = ggml_threadpool_free;
+    g_threadpool_api.pause = ggml_threadpool_pause;
+    g_threadpool_api.resume = ggml_threadpool_resume;
+    g_cpu_variant = "builtin";
+#endif
+    return true;
 }
 
-JNIEXPORT void JNI_OnUnload(JavaVM* vm, void* reserved) {
-    llama_backend_free();
-    LOGI("Llama backend freed");
+static void free_threadpools();
+
+// Only with no model loaded: its tensors and the pools belong to the module.
+static void unload_cpu_backend() {
+    free_threadpools();
+#ifdef XIREA_CPU_VARIANTS
+    if (g_cpu_backend != nullptr) ggml_backend_unload(g_cpu_backend);
+    g_cpu_backend = nullptr;
+#endif
+    g_threadpool_api = CpuThreadpoolApi();
+    g_cpu_variant.clear();
 }
 
 // ============================================================================
-// Model Loading - Optimized for mobile
+// Threadpools - persistent ggml workers with a poll (spin) policy
 // ============================================================================
-JNIEXPORT jboolean JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_loadModel(
-    JNIEnv* env,
-    jobject /* this */,
-    jstring modelPath,
-    jint nCtx,
-    jint nThreads,
-    jint nGpuLayers
-) {
-    // Clean up any existing state
-    if (g_batch_initialized) {
-        llama_batch_free(g_batch);
-        g_batch_initialized = false;
+// Without a threadpool, ggml starts its workers for every graph, so each token of the
+// decode loop pays thread creation and wake-up, and the cores may clock down in between.
+// Attached pools keep the workers alive: after a graph they spin for a while (`poll`,
+// 0..100, higher spins longer) before sleeping, so the next token starts on hot threads.
+// Prefill and decode get separate pools. Where ggml_threadpool_pause is available (not in
+// XIREA_CPU_VARIANTS builds) each is parked when its phase ends, so an idle model costs no
+// CPU. Both are sized for every core; the active count still comes from
+// llama_set_n_threads, and ggml skips polling on unused workers.
+// ggml applies the pool priority (and cpumask) to the thread that submits a graph, so every
+// caller of llama_decode restores its own priority with ScopedThreadPriority.
+struct ThreadPoolPolicy {
+    bool enabled = true;
+    int poll = 50;                              // ggml default
+    int priority = GGML_SCHED_PRIO_NORMAL;
+};
+static ThreadPoolPolicy g_pool_policy;
+static std::mutex g_pool_policy_mutex;          // set from the UI thread, read where pools are built
+
+static ThreadPoolPolicy pool_policy() {
+    std::lock_guard<std::mutex> lock(g_pool_policy_mutex);
+    return g_pool_policy;
+}
+
+static void set_pool_policy(const ThreadPoolPolicy& policy) {
+    std::lock_guard<std::mutex> lock(g_pool_policy_mutex);
+    g_pool_policy = policy;
+}
+static ggml_threadpool* g_pool_decode = nullptr;
+static ggml_threadpool* g_pool_batch = nullptr;
+static int g_pool_decode_poll = 0;              // differs from the policy while governed
+
+static const char* threadpool_name(const ThreadPoolPolicy& policy) {
+    if (!policy.enabled) return "off";
+    if (policy.poll <= 0) return "sleep";
+    return policy.poll >= 100 ? "spin" : "poll";
+}
+
+static ggml_threadpool* create_threadpool(int poll) {
+    const int n_threads = std::max({std::min(cpu_topology().n_cores(), kMaxThreads),
+                                    g_n_threads_prefill.load(), g_n_threads_decode.load()});
+    ggml_threadpool_params params = ggml_threadpool_params_default(n_threads);
+    params.poll = (uint32_t) std::max(0, std::min(poll, 100));
+    params.prio = (ggml_sched_priority) pool_policy().priority;
+    params.paused = true;
+    for (int cpu : pinned_cpus()) {
+        if (cpu >= 0 && cpu < GGML_MAX_N_THREADS) params.cpumask[cpu] = true;
     }
-    if (g_sampler != nullptr) {
-        llama_sampler_free(g_sampler);
-        g_sampler = nullptr;
+    params.strict_cpu = false;          // every worker may run on any cpu of the mask
+    return g_threadpool_api.create != nullptr ? g_threadpool_api.create(&params) : nullptr;
+}
+
+static void free_threadpools() {
+    if (g_ctx != nullptr) llama_detach_threadpool(g_ctx);
+    if (g_pool_decode != nullptr) g_threadpool_api.free(g_pool_decode);
+    if (g_pool_batch != nullptr) g_threadpool_api.free(g_pool_batch);
+    g_pool_decode = g_pool_batch = nullptr;
+}
+
+// Attaches the pools to g_ctx per the policy, creating them if needed. Falls back to
+// llama-managed workers if a pool cannot be created.
+static void attach_threadpools() {
+    if (g_ctx == nullptr) return;
+    const ThreadPoolPolicy policy = pool_policy();
+    if (policy.enabled && g_pool_decode == nullptr && g_threadpool_api.create != nullptr) {
+        g_pool_decode = create_threadpool(policy.poll);
+        g_pool_batch = create_threadpool(policy.poll);
+        g_pool_decode_poll = policy.poll;
+        if (g_pool_decode == nullptr || g_pool_batch == nullptr) {
+            LOGE("Threadpool creation failed, using per-graph workers");
+            free_threadpools();
+            return;
+        }
     }
-    if (g_ctx != nullptr) {
-        llama_free(g_ctx);
-        g_ctx = nullptr;
+    if (g_pool_decode != nullptr) {
+        llama_attach_threadpool(g_ctx, g_pool_decode, g_pool_batch);
+    } else {
+        llama_detach_threadpool(g_ctx);
     }
-    if (g_model != nullptr) {
-        llama_model_free(g_model);
-        g_model = nullptr;
+}
+
+// Recreates the pools after the policy or the cpu mask changed.
+static void reset_threadpools() {
+    free_threadpools();
+    attach_threadpools();
+}
+
+// Recreates the pools now if no generation runs, otherwise when it ends: end_generation
+// applies the pending reset, since a running generation's workers must not be torn down.
+static void request_threadpool_reset() {
+    g_threadpool_reset_pending = true;
+    if (g_is_generating.exchange(true)) return;
+    if (g_threadpool_reset_pending.exchange(false)) reset_threadpools();
+    g_is_generating = false;
+}
+
+// ggml fixes the poll level at creation, so changing it swaps in a new decode pool.
+// Only called between graphs by the thread that runs them.
+static void set_decode_poll(int poll) {
+    if (g_pool_decode == nullptr || poll == g_pool_decode_poll) return;
+    ggml_threadpool* pool = create_threadpool(poll);
+    if (pool == nullptr) return;
+    if (g_threadpool_api.resume != nullptr) g_threadpool_api.resume(pool);
+    llama_attach_threadpool(g_ctx, pool, g_pool_batch);
+    g_threadpool_api.free(g_pool_decode);
+    g_pool_decode = pool;
+    g_pool_decode_poll = poll;
+}
+
+// A graph on a paused pool resumes it; these make the phase boundaries explicit. No-ops in
+// XIREA_CPU_VARIANTS builds.
+static void resume_threadpool(ggml_threadpool* pool) {
+    if (pool != nullptr && g_threadpool_api.resume != nullptr) g_threadpool_api.resume(pool);
+}
+
+static void park_threadpool(ggml_threadpool* pool) {
+    if (pool != nullptr && g_threadpool_api.pause != nullptr) g_threadpool_api.pause(pool);
+}
+
+static void park_threadpools() {
+    park_threadpool(g_pool_batch);
+    park_threadpool(g_pool_decode);
+}
+
+// ============================================================================
+// Thermal governor - sustained rather than peak decode throughput
+// ============================================================================
+// Each generation runs a ThroughputGovernor (thermal_governor.h) from its configured
+// decode thread count and poll level. Every completed window of tokens it may change the
+// active thread count (llama_set_n_threads, no new workers) or the decode pool's poll
+// level, the latter at most once per poll_hold_windows since it rebuilds the pool. The
+// hottest zone is picked when the generation starts and is the only one read while it
+// runs. The generation's settings are restored when it ends.
+static std::atomic<bool> g_governor_enabled{true};
+static GovernorConfig g_governor_config;            // thresholds, set from the UI thread
+static std::mutex g_governor_config_mutex;
+static std::vector<std::string> g_thermal_zones;
+static bool g_thermal_zones_found = false;
+
+static const std::vector<std::string>& thermal_zones() {
+    if (!g_thermal_zones_found) {
+        g_thermal_zones = find_cpu_thermal_zones(kSysfsThermalRoot);
+        g_thermal_zones_found = true;
+        LOGI("Thermal zones: %zu readable for the governor", g_thermal_zones.size());
     }
-    g_vocab = nullptr;
-    
-    const char* path = env->GetStringUTFChars(modelPath, nullptr);
-    LOGI("Loading model: %s", path);
-    
-    // Adaptive configuration for device capabilities
-    applyDeviceConfig();
-    
-    // Model parameters - optimized for mobile
-    llama_model_params model_params = llama_model_default_params();
-    model_params.n_gpu_layers = 0;      // CPU-only for stability
-    model_params.use_mmap = true;       // Memory-mapped loading (fast, low memory)
-    model_params.use_mlock = false;     // Don't lock - prevents OOM
-    
-    // Load model
-    g_model = llama_model_load_from_file(path, model_params);
-    env->ReleaseStringUTFChars(modelPath, path);
-    
-    if (g_model == nullptr) {
-        LOGE("Failed to load model");
-        return JNI_FALSE;
+    return g_thermal_zones;
+}
+
+static GovernorConfig governor_config() {
+    GovernorConfig config;
+    {
+        std::lock_guard<std::mutex> lock(g_governor_config_mutex);
+        config = g_governor_config;
     }
-    
-    // Get vocabulary
-    g_vocab = llama_model_get_vocab(g_model);
-    if (g_vocab == nullptr) {
-        LOGE("Failed to get vocabulary");
-        llama_model_free(g_model);
-        g_model = nullptr;
-        return JNI_FALSE;
+    config.max_threads = llama_n_threads(g_ctx);
+    config.min_threads = std::min(2, config.max_threads);
+    config.poll = g_pool_decode != nullptr ? g_pool_decode_poll : 0;
+    return config;
+}
+
+static void apply_governor_decision(const GovernorDecision& d) {
+    if (d.n_threads != llama_n_threads(g_ctx)) {
+        llama_set_n_threads(g_ctx, d.n_threads, llama_n_threads_batch(g_ctx));
+    }
+    set_decode_poll(d.poll);
+    LOGI("Governor: %s at token %d (%.1f tok/s, %.1f C) -> %d threads, poll %d", d.reason,
+         d.token, d.tps, d.temp_c, d.n_threads, d.poll);
+}
+
+static std::string governor_decisions_json(const std::vector<GovernorDecision>& decisions) {
+    std::string out = "[";
+    for (size_t i = 0; i < decisions.size(); i++) {
+        const GovernorDecision& d = decisions[i];
+        if (i > 0) out += ",";
+        out += "{\"token\":" + std::to_string(d.token) + ",";
+        out += "\"reason\":\"" + std::string(d.reason) + "\",";
+        out += "\"threads\":" + std::to_string(d.n_threads) + ",";
+        out += "\"poll\":" + std::to_string(d.poll) + ",";
+        out += "\"tps\":" + std::to_string(d.tps) + ",";
+        out += "\"temp_c\":" + (std::isnan(d.temp_c) ? std::string("null") : std::to_string(d.temp_c)) + "}";
+    }
+    return out + "]";
+}
+
+// ============================================================================
+// Thread calibration - separate thread counts for prefill and decode
+// ============================================================================
+// llama.cpp uses n_threads_batch for multi-token batches and n_threads for single-token
+// steps, so one llama_set_n_threads call makes every phase run with its own count. Prefill
+// is compute-bound and gains from more threads; decode is memory-bound and often runs
+// faster with fewer (less contention, no straggling efficiency core). A short synthetic
+// prefill/decode sweep picks the pair within a fixed time budget. Loading only marks it
+// pending; AIEngine runs calibrateThreads() in the background afterwards, and a request,
+// load or unload cancels it the way it cancels autotune().
+static std::atomic<bool> g_calibrate_threads{true};
+static std::atomic<bool> g_calibration_pending{false};
+static std::atomic<bool> g_autotune_cancel{false};  // stops a calibration or autotune()
+static const int kCalibrationPromptTokens = 64;
+static const int kCalibrationDecodeTokens = 8;
+static const int64_t kCalibrationBudgetUs = 3000 * 1000;
+
+struct ThreadCalibration {
+    int64_t total_us = 0;
+    std::vector<std::pair<int, double>> prefill_tps;    // (threads, tok/s)
+    std::vector<std::pair<int, double>> decode_tps;
+};
+static std::mutex g_thread_calibration_mutex;     // the sweep may run on the generation thread
+static ThreadCalibration g_thread_calibration;
+
+static void apply_thread_counts() {
+    llama_set_n_threads(g_ctx, g_n_threads_decode, g_n_threads_prefill);
+}
+
+// Candidate counts around the topology default. Prefill also tries every core; decode
+// tries fewer threads.
+static std::vector<int> thread_candidates(bool decode) {
+    const int all = std::min(cpu_topology().n_cores(), kMaxThreads);
+    std::vector<int> out = {g_n_threads, all};
+    if (decode) {
+        out.push_back(g_n_threads - 1);
+        out.push_back(g_n_threads / 2);
+    }
+    std::vector<int> unique;
+    for (int n : out) {
+        if (n >= 1 && std::find(unique.begin(), unique.end(), n) == unique.end()) unique.push_back(n);
+    }
+    return unique;
+}
+
+// Decodes tokens[0, n) from position 0 in g_batch_size chunks. Returns elapsed us or -1.
+static int64_t timed_prefill(const std::vector<llama_token>& tokens, int n) {
+    const int64_t t0 = now_us();
+    for (int done = 0; done < n;) {
+        const int chunk = std::min(g_batch_size, n - done);
+        batch_clear();
+        for (int i = 0; i < chunk; i++) batch_add(tokens[done + i], done + i, done + i == n - 1);
+        if (llama_decode(g_ctx, g_batch) != 0) return -1;
+        done += chunk;
     }
+    return now_us() - t0;
+}
+
+// Runs the sweep on the loaded context and applies the winners. The KV cache is left empty.
+// The caller holds g_is_generating and the model lock. False if cancelled (the best counts
+// so far are applied and the calibration stays pending) or not possible.
+static bool calibrate_threads() {
+    ThreadCalibration calibration;
+    g_n_threads_prefill = g_n_threads_decode = g_n_threads.load();
+    apply_thread_counts();
     
-            // Cap by requested and model limits
-                int modelTrainCtx = llama_model_n_ctx_train(g_model);
-                int deviceCtx = g_context_size;
-                g_context_size = std::min({(int)nCtx, deviceCtx, modelTrainCtx});
+    const int n_prompt = std::min(kCalibrationPromptTokens,
+                                  g_context_size - kCalibrationDecodeTokens - 1);
+    const std::vector<llama_token> text =
+        tokenize_prompt("The quick brown fox jumps over the lazy dog. ", false);
+    if (n_prompt < 8 || text.empty()) return false;
+    std::vector<llama_token> tokens;
+    while ((int) tokens.size() < n_prompt) tokens.insert(tokens.end(), text.begin(), text.end());
     
-                LOGI("Context size: requested=%d, device=%d, model_max=%d -> using=%d",
-                    nCtx, deviceCtx, modelTrainCtx, g_context_size);
+    ScopedThreadAffinity affinity(pinned_cpus());
+    ScopedThreadPriority priority;
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    const int64_t t_start = now_us();
+    auto over_budget = [&] {
+        return g_autotune_cancel.load() || now_us() - t_start > kCalibrationBudgetUs;
+    };
+    
+    // Untimed warm-up: the first pass pays for faulting in the mmapped weights
+    if (mem) llama_memory_clear(mem, true);
+    if (timed_prefill(tokens, 8) < 0) return false;
+    
+    double best = 0.0;
+    for (int n : thread_candidates(false)) {
+        if (over_budget()) break;
+        if (mem) llama_memory_clear(mem, true);
+        llama_set_n_threads(g_ctx, g_n_threads, n);
+        const int64_t us = timed_prefill(tokens, n_prompt);
+        if (us <= 0) break;
+        const double tps = n_prompt * 1e6 / us;
+        calibration.prefill_tps.emplace_back(n, tps);
+        if (tps > best) {
+            best = tps;
+            g_n_threads_prefill = n;
+        }
+    }
+    
+    // The prompt from the last prefill stays in the cache as decode context
+    best = 0.0;
+    for (int n : thread_candidates(true)) {
+        if (over_budget()) break;
+        llama_set_n_threads(g_ctx, n, g_n_threads_prefill);
+        const int64_t t0 = now_us();
+        bool ok = true;
+        for (int i = 0; i < kCalibrationDecodeTokens && ok; i++) {
+            batch_clear();
+            batch_add(tokens[i], n_prompt + i, true);
+            ok = llama_decode(g_ctx, g_batch) == 0;
+        }
+        rollback_kv(n_prompt);
+        if (!ok) break;
+        const double tps = kCalibrationDecodeTokens * 1e6 / (now_us() - t0);
+        calibration.decode_tps.emplace_back(n, tps);
+        if (tps > best) {
+            best = tps;
+            g_n_threads_decode = n;
+        }
+    }
     
-    // Context parameters - performance optimized
+    if (mem) llama_memory_clear(mem, true);
+    apply_thread_counts();
+    park_threadpools();
+    calibration.total_us = now_us() - t_start;
+    const bool cancelled = g_autotune_cancel.load();
+    if (!cancelled) g_calibration_pending = false;
+    LOGI("Thread calibration: prefill=%d, decode=%d (%lld ms%s)", g_n_threads_prefill.load(),
+         g_n_threads_decode.load(), (long long) (calibration.total_us / 1000),
+         cancelled ? ", cancelled" : "");
+    std::lock_guard<std::mutex> lock(g_thread_calibration_mutex);
+    g_thread_calibration = std::move(calibration);
+    return !cancelled;
+}
+
+static std::string thread_calibration_json() {
+    auto list = [](const std::vector<std::pair<int, double>>& runs) {
+        std::string out = "[";
+        for (size_t i = 0; i < runs.size(); i++) {
+            if (i > 0) out += ",";
+            out += "{\"threads\":" + std::to_string(runs[i].first) + ",\"tps\":" +
+                   std::to_string(runs[i].second) + "}";
+        }
+        return out + "]";
+    };
+    std::lock_guard<std::mutex> lock(g_thread_calibration_mutex);
+    std::string info = "{";
+    info += "\"n_threads_prefill\":" + std::to_string(g_n_threads_prefill) + ",";
+    info += "\"n_threads_decode\":" + std::to_string(g_n_threads_decode) + ",";
+    info += "\"pending\":" + std::string(g_calibration_pending ? "true" : "false") + ",";
+    info += "\"calibration_ms\":" + std::to_string(g_thread_calibration.total_us / 1000) + ",";
+    info += "\"prefill\":" + list(g_thread_calibration.prefill_tps) + ",";
+    info += "\"decode\":" + list(g_thread_calibration.decode_tps);
+    info += "}";
+    return info;
+}
+
+// ============================================================================
+// Autotuning - per-model, per-device runtime settings
+// ============================================================================
+// Thread calibration only moves the thread counts. The autotuner (autotune.h) also sweeps
+// the batch size and the KV cache type / flash attention pair, which need a new context,
+// and keeps the result in a profile under g_profile_dir. A matching profile is applied at
+// load instead of the RAM table defaults and skips thread calibration.
+static std::string g_profile_dir;                   // empty = profiles disabled
+static const char* g_tune_source = "defaults";      // defaults, profile, autotune or partial
+static const int kAutotunePromptTokens = 128;
+static const int kAutotuneDecodeTokens = 16;
+
+// The model lock for loadModel and unloadModel. calibrateThreads() and autotune() hold it
+// for their whole sweep, so they are cancelled (again on every retry, in case they had not
+// started) until it is released.
+static std::unique_lock<std::mutex> lock_model_for_reload() {
+    std::unique_lock<std::mutex> lock(g_model_mutex, std::try_to_lock);
+    while (!lock.owns_lock()) {
+        g_autotune_cancel = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        lock.try_lock();
+    }
+    return lock;
+}
+
+static TuneConfig current_tune_config() {
+    TuneConfig config;
+    config.n_threads_prefill = g_n_threads_prefill;
+    config.n_threads_decode = g_n_threads_decode;
+    config.n_batch = g_batch_size;
+    config.kv_quantized = g_kv_quantized ? 1 : 0;
+    config.flash_attn = g_flash_attn;
+    return config;
+}
+
+// Creates g_ctx and a matching g_batch from the current runtime settings.
+static bool create_context() {
     llama_context_params ctx_params = llama_context_default_params();
     ctx_params.n_ctx = g_context_size;
-    ctx_params.n_threads = g_n_threads;
-    ctx_params.n_threads_batch = g_n_threads;
+    ctx_params.n_threads = g_n_threads_decode;
+    ctx_params.n_threads_batch = g_n_threads_prefill;
     ctx_params.n_batch = g_batch_size;
     ctx_params.n_ubatch = g_batch_size;
     ctx_params.embeddings = false;      // Not needed for inference
-    
-    // Create context
-    g_ctx = llama_init_from_model(g_model, ctx_params);
-    if (g_ctx == nullptr) {
-        LOGE("Failed to create context");
-        llama_model_free(g_model);
-        g_model = nullptr;
-        g_vocab = nullptr;
-        return JNI_FALSE;
-    }
-
-    // Enforce model size and quantization constraints
-    uint64_t n_params = llama_model_n_params(g_model);
-    if (n_params > kMaxParams) {
-        LOGE("Model too large: %llu params (max 7B)", (unsigned long long) n_params);
-        llama_free(g_ctx);
-        g_ctx = nullptr;
-        llama_model_free(g_model);
-        g_model = nullptr;
-        g_vocab = nullptr;
-        return JNI_FALSE;
+    if (g_kv_quantized) {
+        ctx_params.type_k = GGML_TYPE_Q8_0;
+        ctx_params.type_v = GGML_TYPE_Q8_0;
     }
-
-    char desc[256];
-    llama_model_desc(g_model, desc, sizeof(desc));
-    std::string desc_str(desc);
-    for (auto & c : desc_str) c = (char) tolower((unsigned char) c);
-    if (desc_str.find("q4") == std::string::npos &&
-        desc_str.find("q5") == std::string::npos &&
-        desc_str.find("quantized") == std::string::npos) {
-        LOGE("Unsupported quantization (require Q4/Q5): %s", desc);
-        llama_free(g_ctx);
-        g_ctx = nullptr;
-        llama_model_free(g_model);
-        g_model = nullptr;
-        g_vocab = nullptr;
-        return JNI_FALSE;
+    if (g_flash_attn >= 0) {
+        ctx_params.flash_attn_type = g_flash_attn ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+                                                  : LLAMA_FLASH_ATTN_TYPE_DISABLED;
     }
     
+    g_ctx = llama_init_from_model(g_model, ctx_params);
+    if (g_ctx == nullptr) return false;
+    
     // Pre-allocate reusable batch - this is the KEY optimization
     // Never allocate inside the generation loop!
     g_batch = llama_batch_init(g_batch_size, 0, 1);
     g_batch_initialized = true;
-    
-    // Initialize sampler with near-greedy settings for SPEED
-    // Lower values = faster sampling, less randomness
-    llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
-    g_sampler = llama_sampler_chain_init(sparams);
-    
-    // Near-greedy sampling chain for maximum speed
-    llama_sampler_chain_add(g_sampler, llama_sampler_init_top_k(20));    // Very focused
-    llama_sampler_chain_add(g_sampler, llama_sampler_init_top_p(0.85f, 1));
-    llama_sampler_chain_add(g_sampler, llama_sampler_init_temp(0.6f));   // Low temp = faster
-    llama_sampler_chain_add(g_sampler, llama_sampler_init_dist(LLAMA_DEFAULT_SEED));
-    
-    LOGI("Model loaded: ctx=%d, batch=%d, threads=%d (near-greedy sampling)",
-         g_context_size, g_batch_size, g_n_threads);
-    
-    return JNI_TRUE;
+    attach_threadpools();
+    return true;
 }
 
-// ============================================================================
-// Model Unloading
-// ============================================================================
-JNIEXPORT void JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_unloadModel(
-    JNIEnv* env,
-    jobject /* this */
-) {
-    g_stop_generation_id.store(g_generation_id.load());
-    
-    // Nullify pointers first to prevent stale access from other threads
-    auto* batch_copy = g_batch_initialized ? &g_batch : nullptr;
-    auto* sampler_copy = g_sampler;
-    auto* ctx_copy = g_ctx;
-    auto* model_copy = g_model;
-    
-    g_vocab = nullptr;
-    g_sampler = nullptr;
-    g_ctx = nullptr;
-    g_model = nullptr;
-    
+static void free_context() {
     if (g_batch_initialized) {
         llama_batch_free(g_batch);
         g_batch_initialized = false;
     }
-    if (sampler_copy != nullptr) {
-        llama_sampler_free(sampler_copy);
-    }
-    if (ctx_copy != nullptr) {
-        llama_free(ctx_copy);
+    if (g_ctx != nullptr) {
+        llama_free(g_ctx);
+        g_ctx = nullptr;
     }
-    if (model_copy != nullptr) {
-        llama_model_free(model_copy);
+}
+
+// Switches to `config`, rebuilding the context only if a context parameter changed.
+// On failure the previous settings are restored.
+static bool apply_tune_config(const TuneConfig& config) {
+    const TuneConfig previous = current_tune_config();
+    g_n_threads_prefill = config.n_threads_prefill;
+    g_n_threads_decode = config.n_threads_decode;
+    if (g_ctx != nullptr && config.n_batch == previous.n_batch &&
+        config.kv_quantized == previous.kv_quantized && config.flash_attn == previous.flash_attn) {
+        apply_thread_counts();
+        return true;
     }
+    g_batch_size = config.n_batch;
+    g_kv_quantized = config.kv_quantized != 0;
+    g_flash_attn = config.flash_attn;
+    free_context();
+    if (create_context()) return true;
     
-    LOGI("Model unloaded");
+    LOGE("Context creation failed for batch=%d kv=%s fa=%d", config.n_batch,
+         config.kv_quantized ? "q8_0" : "f16", config.flash_attn);
+    g_n_threads_prefill = previous.n_threads_prefill;
+    g_n_threads_decode = previous.n_threads_decode;
+    g_batch_size = previous.n_batch;
+    g_kv_quantized = previous.kv_quantized != 0;
+    g_flash_attn = previous.flash_attn;
+    return create_context();
 }
 
-JNIEXPORT jboolean JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_isModelLoaded(
-    JNIEnv* env,
-    jobject /* this */
-) {
-    return (g_model != nullptr && g_ctx != nullptr) ? JNI_TRUE : JNI_FALSE;
+// Applies the stored profile for this model and device, if any. Called before the
+// context exists, so only the globals change.
+static bool load_tune_profile() {
+    if (g_profile_dir.empty()) return false;
+    const uint64_t fingerprint = model_fingerprint();
+    const uint64_t signature = cpu_topology().signature();
+    TuneProfile profile;
+    if (!profile.load(TuneProfile::path_for(g_profile_dir, fingerprint, signature), fingerprint,
+                      signature)) {
+        return false;
+    }
+    const TuneConfig& c = profile.best.config;
+    if (g_calibrate_threads) {
+        g_n_threads_prefill = std::min((int) c.n_threads_prefill, kMaxThreads);
+        g_n_threads_decode = std::min((int) c.n_threads_decode, kMaxThreads);
+    }
+    g_batch_size = c.n_batch;
+    g_kv_quantized = c.kv_quantized != 0;
+    g_flash_attn = c.flash_attn;
+    LOGI("Tune profile: prefill=%d, decode=%d, batch=%d, kv=%s, fa=%d", c.n_threads_prefill,
+         c.n_threads_decode, c.n_batch, c.kv_quantized ? "q8_0" : "f16", c.flash_attn);
+    return true;
 }
 
-JNIEXPORT void JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_stopGeneration(
-    JNIEnv* env,
-    jobject /* this */
-) {
-    g_stop_generation_id.store(g_generation_id.load());
+static bool autotune_abort_callback(void* /* data */) {
+    return g_autotune_cancel.load(std::memory_order_relaxed);
+}
+
+// Prefill of tokens[0, n_prompt) followed by n_decode single-token steps, from an empty
+// cache. The cache is left empty.
+static bool measure_throughput(const std::vector<llama_token>& tokens, int n_prompt, int n_decode,
+                               double& prefill_tps, double& decode_tps) {
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    if (mem) llama_memory_clear(mem, true);
+    llama_set_abort_callback(g_ctx, autotune_abort_callback, nullptr);
+    const int64_t prefill_us = timed_prefill(tokens, n_prompt);
+    bool ok = prefill_us > 0;
+    const int64_t t0 = now_us();
+    for (int i = 0; i < n_decode && ok; i++) {
+        batch_clear();
+        batch_add(tokens[i], n_prompt + i, true);
+        ok = llama_decode(g_ctx, g_batch) == 0;
+    }
+    const int64_t decode_us = now_us() - t0;
+    llama_set_abort_callback(g_ctx, nullptr, nullptr);
+    if (mem) llama_memory_clear(mem, true);
+    if (!ok || decode_us <= 0) return false;
+    prefill_tps = n_prompt * 1e6 / prefill_us;
+    decode_tps = n_decode * 1e6 / decode_us;
+    return true;
+}
+
+static std::string tune_config_json(const TuneConfig& c) {
+    std::string info = "{";
+    info += "\"n_threads_prefill\":" + std::to_string(c.n_threads_prefill) + ",";
+    info += "\"n_threads_decode\":" + std::to_string(c.n_threads_decode) + ",";
+    info += "\"n_batch\":" + std::to_string(c.n_batch) + ",";
+    info += "\"kv_cache\":\"" + std::string(c.kv_quantized ? "q8_0" : "f16") + "\",";
+    info += "\"flash_attn\":" + std::to_string(c.flash_attn);
+    info += "}";
+    return info;
 }
 
 // ============================================================================
-// Token Generation - Maximum Speed Optimization
+// JNI helpers
 // ============================================================================
-JNIEXPORT jstring JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_generate(
-    JNIEnv* env,
-    jobject /* this */,
-    jstring prompt,
-    jint maxTokens,
-    jobject callback
-) {
-    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
-        return env->NewStringUTF("Error: Model not loaded");
+// Standard UTF-8 of a Java string. GetStringUTFChars would return modified UTF-8, which
+// encodes supplementary characters (emoji) as two 3-byte surrogates the tokenizer does not
+// understand; the UTF-16 chars are converted directly instead.
+static std::string get_string(JNIEnv* env, jstring str) {
+    std::string out;
+    if (str == nullptr) return out;
+    const jsize n = env->GetStringLength(str);
+    out.reserve((size_t) n * 3);
+    const jchar* chars = env->GetStringCritical(str, nullptr);
+    if (chars == nullptr) return out;
+    append_utf8_from_utf16((const uint16_t*) chars, (size_t) n, out);
+    env->ReleaseStringCritical(str, chars);
+    return out;
+}
+
+static std::vector<std::string> get_string_array(JNIEnv* env, jobjectArray array) {
+    std::vector<std::string> out;
+    if (array == nullptr) return out;
+    const jsize n = env->GetArrayLength(array);
+    out.reserve(n);
+    for (jsize i = 0; i < n; i++) {
+        jstring str = (jstring) env->GetObjectArrayElement(array, i);
+        if (str == nullptr) continue;
+        out.push_back(get_string(env, str));
+        env->DeleteLocalRef(str);
     }
-    
-    if (g_is_generating.exchange(true)) {
-        return env->NewStringUTF("Error: Generation already in progress");
+    return out;
+}
+
+// Copies UTF-8 prompt bytes from a byte[] or a direct ByteBuffer (exactly one is non-null)
+// straight into `out` - the only copy on the way in. Returns false on a bad range.
+static bool get_utf8_bytes(JNIEnv* env, jbyteArray array, jobject buffer, jint offset,
+                           jint length, std::string& out) {
+    if (offset < 0 || length < 0) return false;
+    if (array != nullptr) {
+        if ((jlong) offset + length > env->GetArrayLength(array)) return false;
+        out.resize(length);
+        env->GetByteArrayRegion(array, offset, length, (jbyte*) out.data());
+        return !env->ExceptionCheck();
     }
-    
+    if (buffer == nullptr) return false;
+    const char* data = (const char*) env->GetDirectBufferAddress(buffer);
+    if (data == nullptr || (jlong) offset + length > env->GetDirectBufferCapacity(buffer)) {
+        return false;
+    }
+    out.assign(data + offset, length);
+    return true;
+}
+
+// ============================================================================
+// Generation core - shared by the callback and the ring-buffer APIs
+// ============================================================================
+enum GenerationResult {
+    kGenCompleted = 0,          // EOS, token limit or context limit reached
+    kGenStopped,                // stop requested or decode aborted
+    kGenStoppedInPrefill,       // stopped before any token was generated
+    kGenTokenizeFailed,
+    kGenPrefillFailed,
+    kGenGrammarFailed,
+};
+
+// Claims the context for a new generation. Returns 0 if another one is running.
+static uint64_t begin_generation() {
+    if (g_is_generating.exchange(true)) return 0;
+
     const uint64_t local_id = g_generation_id.fetch_add(1) + 1;
     g_stop_generation_id.store(0);
-    
-    // Get prompt string
-    const char* prompt_cstr = env->GetStringUTFChars(prompt, nullptr);
-    std::string prompt_str(prompt_cstr);
-    env->ReleaseStringUTFChars(prompt, prompt_cstr);
+    g_stop_requested_us.store(0);
+    g_stats = GenerationStats();
+    if (g_abort_on_stop) {
+        llama_set_abort_callback(g_ctx, generation_abort_callback, (void*) (uintptr_t) local_id);
+    }
+    return local_id;
+}
+
+struct GenerationRequest {
+    std::string prompt;
+    int max_tokens = 0;
+    std::vector<std::string> stop_sequences;
+    std::string grammar;                    // GBNF, empty = unconstrained
+    SamplerConfig sampler;                  // temp <= 0 selects greedy argmax
+    std::vector<llama_token> prompt_tokens;           // replay: used instead of tokenizing
+    const std::vector<llama_token>* forced_tokens = nullptr;   // replay: decoded, not sampled
+    bool governed = true;                   // benchmarks keep their thread count fixed
+    int repetition_policy = -1;             // replay: recorded policy, -1 = current setting
+    GenerationTrace* record = nullptr;      // replay: recorded here instead of g_last_trace
+    const VocabSubset* vocab_subset = nullptr;        // replay: instead of the setting, empty = off
+};
+
+// The most recent generation, recorded as it runs, and a trace loaded for replay. Replays
+// record into their own trace so neither is overwritten.
+static GenerationTrace g_last_trace;
+static GenerationTrace g_replay_trace;
+
+// Returns the compiled DFA for `source`, reusing the previous one (and its cached masks)
+// when the grammar is unchanged. Returns nullptr if the grammar is not regular.
+static CompiledGrammar* get_compiled_grammar(const std::string& source) {
+    if (g_grammar && g_grammar->source == source) return g_grammar.get();
+
+    auto compiled = std::make_unique<CompiledGrammar>();
+    std::string error;
+    if (!compiled->dfa.compile(source, "root", error)) {
+        LOGI("Grammar not compiled to DFA (%s), using llama grammar sampler", error.c_str());
+        return nullptr;
+    }
+
+    if (g_grammar_pieces.empty()) {
+        const int n_vocab = llama_vocab_n_tokens(g_vocab);
+        g_grammar_pieces.resize(n_vocab);
+        char buf[256];
+        for (llama_token id = 0; id < n_vocab; id++) {
+            std::string& piece = g_grammar_pieces[id];
+            const int n = llama_token_to_piece(g_vocab, id, buf, sizeof(buf), 0, false);
+            if (n > 0) {
+                piece.assign(buf, n);
+            } else if (n < 0) {
+                // Longer than buf: -n is the size needed
+                piece.resize(-n);
+                const int m = llama_token_to_piece(g_vocab, id, &piece[0], -n, 0, false);
+                piece.resize(m > 0 ? m : 0);
+            }
+        }
+    }
+
+    std::vector<int32_t> eog;
+    for (llama_token id = 0; id < (llama_token) g_grammar_pieces.size(); id++) {
+        if (is_end_of_turn(id)) eog.push_back(id);
+    }
+    compiled->source = source;
+    compiled->masks = std::make_unique<GrammarTokenMasks>(&compiled->dfa, &g_grammar_pieces,
+                                                          std::move(eog));
+    g_grammar = std::move(compiled);
+    return g_grammar.get();
+}
+
+// Converts a token to its text piece, growing `piece` if needed. Returns the length.
+static int token_to_piece(llama_token token, std::string& piece) {
+    int n = llama_token_to_piece(g_vocab, token, piece.data(), (int) piece.size(), 0, true);
+    if (n < 0) {
+        piece.resize(-n);
+        n = llama_token_to_piece(g_vocab, token, piece.data(), (int) piece.size(), 0, true);
+    }
+    return n;
+}
+
+// ============================================================================
+// Vocabulary piece table - detokenized once per model on a background thread
+// ============================================================================
+static PieceTable g_pieces;
+static std::thread g_piece_thread;
+static std::atomic<bool> g_piece_cancel{false};
+static std::atomic<int64_t> g_piece_build_us{0};   // written by the build thread
+
+static void start_piece_table_build() {
+    const llama_vocab* vocab = g_vocab;
+    g_piece_cancel.store(false);
+    g_piece_thread = std::thread([vocab]() {
+        const int64_t t0 = now_us();
+        const bool built = g_pieces.build(
+            llama_vocab_n_tokens(vocab),
+            [vocab](int32_t token, char* buf, int len) {
+                return llama_token_to_piece(vocab, token, buf, len, 0, true);
+            },
+            g_piece_cancel);
+        const int64_t build_us = now_us() - t0;
+        g_piece_build_us.store(build_us);
+        if (built) {
+            LOGI("Piece table ready: %zu bytes in %lld ms", g_pieces.bytes(),
+                 (long long) (build_us / 1000));
+        }
+    });
+}
+
+// Must run before the vocabulary it reads from is freed.
+static void stop_piece_table_build() {
+    g_piece_cancel.store(true);
+    if (g_piece_thread.joinable()) g_piece_thread.join();
+    g_pieces.clear();
+}
+
+// Text of `token`: a slice of the piece table once it is built, otherwise detokenized into
+// `fallback`. Returns the length.
+static int token_piece(llama_token token, std::string& fallback, const char*& data) {
+    size_t n = 0;
+    if (g_pieces.lookup(token, data, n)) return (int) n;
+    const int len = token_to_piece(token, fallback);
+    data = fallback.data();
+    return len;
+}
+
+static GenerationResult run_generation(const GenerationRequest& req, uint64_t local_id,
+                                       TokenSink& sink) {
+    // ggml workers are created by this thread and inherit its affinity; the pool's priority
+    // is applied to this (possibly Java) thread and undone on return
+    ScopedThreadAffinity affinity(pinned_cpus());
+    ScopedThreadPriority priority;
+    g_stats.pinned = affinity.active();
+    g_stats.n_threads_prefill = llama_n_threads_batch(g_ctx);
+    g_stats.n_threads_decode = llama_n_threads(g_ctx);
+    g_stats.threadpool = threadpool_name(g_pool_decode != nullptr ? pool_policy() : ThreadPoolPolicy{false});
     
     // Clamp max tokens for stability based on device class
+    int maxTokens = req.max_tokens;
+    const int repetition_policy =
+        req.repetition_policy >= 0 ? req.repetition_policy : g_repetition_policy.load();
     if (maxTokens > g_max_gen_tokens) maxTokens = g_max_gen_tokens;
     if (maxTokens < 1) maxTokens = 1;
-
-    // Get callback method
-    jclass callbackClass = env->GetObjectClass(callback);
-    jmethodID onTokenMethod = callbackClass
-        ? env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V")
-        : nullptr;
-    if (callbackClass == nullptr || onTokenMethod == nullptr) {
-        if (callbackClass != nullptr) env->DeleteLocalRef(callbackClass);
-        g_is_generating = false;
-        return env->NewStringUTF("{\"error\":\"Token callback not available\"}");
+    
+    // Grammar constraint: cached per-state masks if the grammar is regular, otherwise a
+    // request-local chain led by llama's (exact but per-step vocab-walking) grammar sampler
+    CompiledGrammar* grammar = nullptr;
+    llama_sampler* request_sampler = nullptr;
+    if (!req.grammar.empty()) {
+        grammar = get_compiled_grammar(req.grammar);
+        if (grammar != nullptr) {
+            g_stats.grammar_mode = "dfa";
+        } else {
+            llama_sampler* gs = llama_sampler_init_grammar(g_vocab, req.grammar.c_str(), "root");
+            if (gs == nullptr) {
+                LOGE("Invalid grammar");
+                return kGenGrammarFailed;
+            }
+            request_sampler = create_sampler_chain(gs, req.sampler);
+            g_stats.grammar_mode = "llama";
+        }
     }
     
+    // Temperature 0 takes the shared argmax path; everything else gets its own fused sampler
+    llama_sampler* sampler = request_sampler;
+    if (sampler != nullptr) {
+        g_stats.sampling_mode = "chain";
+    } else if (req.sampler.params.temp <= 0.0f) {
+        sampler = greedy_sampler();
+        g_stats.sampling_mode = "greedy";
+    } else {
+        sampler = request_sampler = create_fused_sampler(req.sampler.params, req.sampler.seed);
+    }
+    std::unique_ptr<llama_sampler, decltype(&llama_sampler_free)> request_sampler_guard(
+        request_sampler, llama_sampler_free);
+    // Fixed for the whole generation, so toggling the setting cannot change it midway
+    const bool direct = sampler == greedy_sampler() || sampler->iface == &kFusedSamplerIface;
+    const VocabSubset* subset = nullptr;
+    if (direct && req.vocab_subset != nullptr) {
+        if (!req.vocab_subset->empty()) subset = req.vocab_subset;
+    } else if (direct && vocab_subset_active()) {
+        subset = &g_vocab_subset;
+    }
+    if (subset != nullptr) g_stats.vocab_subset = (int) subset->size();
+    
     // Tokenize prompt
-    std::vector<llama_token> tokens = tokenize_prompt(prompt_str, true);
+    const int64_t t_tokenize = now_us();
+    std::vector<llama_token> tokens =
+        req.prompt_tokens.empty() ? tokenize_prompt(req.prompt, true, &g_stats.tokenize_chunks)
+                                  : req.prompt_tokens;
+    g_stats.tokenize_us = now_us() - t_tokenize;
     if (tokens.empty()) {
-        env->DeleteLocalRef(callbackClass);
-        g_is_generating = false;
-        return env->NewStringUTF("Error: Tokenization failed");
+        return kGenTokenizeFailed;
     }
     
     int n_prompt = tokens.size();
@@ -419,13 +1735,36 @@ Java_com_dannyk_xirea_ai_LlamaCpp_generate(
         LOGI("Prompt truncated to %d tokens", n_prompt);
     }
     
-    // === Evaluate prompt in chunks using pre-allocated batch ===
+    // Record what is about to run so it can be replayed exactly
+    GenerationTrace& rec = req.record != nullptr ? *req.record : g_last_trace;
+    rec = GenerationTrace();
+    rec.n_vocab = llama_vocab_n_tokens(g_vocab);
+    rec.top_k = req.sampler.params.top_k;
+    rec.top_p = req.sampler.params.top_p;
+    rec.temp = req.sampler.params.temp;
+    rec.min_p = req.sampler.params.min_p;
+    rec.max_tokens = maxTokens;
+    rec.stop_sequences = req.stop_sequences;
+    rec.grammar = req.grammar;
+    rec.repetition_policy = repetition_policy;
+    rec.allow_eog = g_allow_eog_tokens;
+    rec.allowed_special = g_allowed_special;
+    if (subset != nullptr) rec.vocab_subset = subset->ids();
+    rec.prompt = tokens;
+    rec.tokens.reserve(maxTokens + 1);
+    
+    // === Evaluate prompt in latency-bounded chunks using pre-allocated batch ===
+    g_stats.n_prompt = n_prompt;
     int n_processed = 0;
+    int64_t last_step_us = 0;
+    int last_chunk = 0;
+    const int64_t t_prefill_start = now_us();
+    resume_threadpool(g_pool_batch);
     
     while (n_processed < n_prompt && g_stop_generation_id.load() != local_id) {
         batch_clear();
         
-        int n_batch = std::min(g_batch_size, n_prompt - n_processed);
+        int n_batch = next_prefill_chunk(n_prompt - n_processed, last_step_us, last_chunk);
         for (int i = 0; i < n_batch; i++) {
             int pos = n_processed + i;
             // Only compute logits for the LAST token of the LAST batch
@@ -433,110 +1772,2067 @@ Java_com_dannyk_xirea_ai_LlamaCpp_generate(
             batch_add(tokens[pos], pos, is_last);
         }
         
-        if (llama_decode(g_ctx, g_batch) != 0) {
-            env->DeleteLocalRef(callbackClass);
-            g_is_generating = false;
+        const int64_t t_step = now_us();
+        const int ret = llama_decode(g_ctx, g_batch);
+        if (ret != 0) {
+            park_threadpools();
+            rollback_kv(n_processed);
+            if (ret == 2) {
+                LOGD("Prompt evaluation aborted at position %d", n_processed);
+                return kGenStoppedInPrefill;
+            }
             LOGE("Decode failed at position %d", n_processed);
-            return env->NewStringUTF("Error: Prompt evaluation failed");
+            return kGenPrefillFailed;
         }
+        last_step_us = now_us() - t_step;
+        last_chunk = n_batch;
         
+        g_stats.n_prefill_chunks++;
+        g_stats.max_prefill_step_us = std::max(g_stats.max_prefill_step_us, last_step_us);
+        if (g_stats.min_prefill_chunk == 0 || n_batch < g_stats.min_prefill_chunk) {
+            g_stats.min_prefill_chunk = n_batch;
+        }
         n_processed += n_batch;
     }
+    g_stats.prefill_us = now_us() - t_prefill_start;
+    park_threadpool(g_pool_batch);
     
     if (g_stop_generation_id.load() == local_id) {
-        env->DeleteLocalRef(callbackClass);
-        g_is_generating = false;
-        return env->NewStringUTF("");
+        park_threadpool(g_pool_decode);
+        return kGenStoppedInPrefill;
     }
     
     LOGD("Prompt evaluated, starting generation");
     
-    // === Token generation loop - optimized for speed ===
-    std::string response;
-    response.reserve(maxTokens * 8); // Pre-allocate response buffer
-    
+    // === Token generation loop - decode overlaps with token delivery ===
+    GenerationResult result = kGenCompleted;
     int n_cur = n_prompt;
     int n_generated = 0;
+    int stop_reason = kStopNone;
+    
+    RepetitionDetector repetition;
+    repetition.reset(maxTokens);
     
-    // Reset sampler state
-    llama_sampler_reset(g_sampler);
+    StopMatcher stop_matcher;
+    stop_matcher.build(req.stop_sequences);
+    int grammar_state = grammar != nullptr ? grammar->dfa.start() : 0;
+    const int n_vocab = llama_vocab_n_tokens(g_vocab);
+    std::string piece(128, '\0');
+    std::string text;
+    std::string chars;
+    Utf8Assembler utf8;
+    llama_token banned_token = LLAMA_TOKEN_NULL;
     
-    while (n_generated < maxTokens && n_cur < g_context_size && g_stop_generation_id.load() != local_id) {
-        // Sample next token - sampler uses logits from last decode
-        llama_token new_token = llama_sampler_sample(g_sampler, g_ctx, -1);
+    // Reset sampler state; a random seed is resolved here and recorded
+    llama_sampler_reset(sampler);
+    rec.seed = sampler->iface == &kFusedSamplerIface
+        ? ((FusedSamplerCtx*) sampler->ctx)->sampler.current_seed()
+        : req.sampler.seed;
+    std::vector<int64_t> token_us;
+    token_us.reserve(maxTokens);
+    resume_threadpool(g_pool_decode);
+    const int64_t t_decode_start = now_us();
+    const int64_t cpu_decode_start = cpu_time_us();
+    int64_t t_token = t_decode_start;
+    ThroughputGovernor governor;
+    const bool governed = g_governor_enabled && req.governed;
+    std::string thermal_zone;
+    if (governed) {
+        governor.reset(governor_config(), t_decode_start);
+        thermal_zone = hottest_thermal_zone(thermal_zones());
+    }
+    
+    while (stop_reason == kStopNone) {
+        if (n_generated >= maxTokens) {
+            stop_reason = kStopMaxTokens;
+            break;
+        }
+        if (n_cur >= g_context_size) {
+            stop_reason = kStopContextFull;
+            break;
+        }
+        if (g_stop_generation_id.load() == local_id) {
+            stop_reason = kStopRequested;
+            result = kGenStopped;
+            break;
+        }
         
-        // Check for end of generation (EOS token)
-        if (llama_vocab_is_eog(g_vocab, new_token)) {
-            LOGD("EOS token reached");
+        llama_token new_token;
+        if (req.forced_tokens != nullptr) {
+            // Replay: the recorded token, no sampling work
+            const size_t step = rec.tokens.size();
+            if (step >= req.forced_tokens->size()) {
+                stop_reason = kStopMaxTokens;
+                break;
+            }
+            new_token = (*req.forced_tokens)[step];
+        } else {
+            // Keep a detected loop from continuing (penalize policy)
+            if (banned_token != LLAMA_TOKEN_NULL) {
+                float* logits = llama_get_logits_ith(g_ctx, -1);
+                if (logits != nullptr) logits[banned_token] = -INFINITY;
+                banned_token = LLAMA_TOKEN_NULL;
+            }
+            
+            // Mask tokens the grammar does not allow in the current state
+            const int64_t t_constraint = now_us();
+            if (grammar != nullptr) {
+                float* logits = llama_get_logits_ith(g_ctx, -1);
+                apply_token_mask(grammar->masks->mask(grammar_state), logits, n_vocab);
+            }
+            
+            // Sample next token - sampler uses logits from last decode
+            const int64_t t_sample = now_us();
+            new_token = sample_next(sampler, n_vocab, subset);
+            g_stats.sample_us += now_us() - t_sample;
+            g_stats.constraint_us += t_sample - t_constraint;
+        }
+        rec.tokens.push_back(new_token);
+        
+        // Check for end of generation (EOS or the template's end-of-turn token)
+        if (is_end_of_turn(new_token)) {
+            LOGD("End of turn reached");
+            stop_reason = kStopEos;
             break;
         }
         
-        // Convert token to text using dynamic string to avoid overflow
-        std::string token_str(128, '\0');
-        int n = llama_token_to_piece(g_vocab, new_token, token_str.data(), (int)token_str.size() - 1, 0, true);
-        if (n < 0) {
-            // Buffer too small - resize and retry
-            token_str.resize(-n + 1, '\0');
-            n = llama_token_to_piece(g_vocab, new_token, token_str.data(), (int)token_str.size() - 1, 0, true);
+        bool grammar_done = false;
+        if (grammar != nullptr) {
+            const int64_t t_advance = now_us();
+            grammar_state = grammar->masks->advance(grammar_state, new_token);
+            if (grammar_state == GrammarDfa::kDead) {
+                LOGE("Sampled token %d violates the grammar", new_token);
+                stop_reason = kStopError;
+                break;
+            }
+            grammar_done = grammar->dfa.accepting(grammar_state) &&
+                           grammar->dfa.exhausted(grammar_state);
+            g_stats.constraint_us += now_us() - t_advance;
         }
-        if (n > 0) {
-            token_str.resize(n);
-            response.append(token_str);
-
-            // === Stream token immediately to UI ===
-            jstring jtoken = env->NewStringUTF(token_str.c_str());
-            env->CallVoidMethod(callback, onTokenMethod, jtoken);
-            env->DeleteLocalRef(jtoken);
+        
+        // === Match stop sequences, then hand the text to the sink while the next decode runs ===
+        const char* piece_data = nullptr;
+        const int n_piece = token_piece(new_token, piece, piece_data);
+        if (n_piece > 0) {
+            text.clear();
+            const bool matched = stop_matcher.feed(piece_data, n_piece, text);
+            chars.clear();
+            utf8.feed(text.data(), text.size(), chars);
+            if (!chars.empty() && !sink.on_text(chars.data(), chars.size())) {
+                LOGI("Sink rejected output after %d tokens, stopping", n_generated + 1);
+                stop_reason = kStopTruncated;
+                break;
+            }
+            if (matched) {
+                LOGD("Stop sequence matched after %d tokens", n_generated + 1);
+                stop_reason = kStopSequence;
+                break;
+            }
+        }
+        if (grammar_done) {
+            LOGD("Grammar complete after %d tokens", n_generated + 1);
+            n_generated++;
+            stop_reason = kStopEos;
+            break;
+        }
+        
+        if (repetition_policy != kRepetitionOff) {
+            const int period = repetition.push(new_token);
+            if (period > 0) {
+                g_stats.repetition_period = period;
+                g_stats.repetition_hits++;
+                if (repetition_policy == kRepetitionStop ||
+                    g_stats.repetition_hits > kRepetitionMaxPenalties) {
+                    LOGI("Repetition loop detected (period %d) after %d tokens, stopping",
+                         period, n_generated + 1);
+                    stop_reason = kStopRepetition;
+                    break;
+                }
+                banned_token = repetition.predicted_next(period);
+                LOGD("Repetition loop detected (period %d), banning token %d", period, banned_token);
+            }
         }
         
         // === Decode next token using pre-allocated batch ===
         batch_clear();
         batch_add(new_token, n_cur, true);
         
-        if (llama_decode(g_ctx, g_batch) != 0) {
-            LOGE("Decode failed during generation");
+        const int ret = llama_decode(g_ctx, g_batch);
+        if (ret != 0) {
+            rollback_kv(n_cur);
+            if (ret == 2) {
+                LOGD("Generation aborted at position %d", n_cur);
+                stop_reason = kStopRequested;
+                result = kGenStopped;
+            } else {
+                LOGE("Decode failed during generation");
+                stop_reason = kStopError;
+            }
             break;
         }
         
         n_cur++;
         n_generated++;
+        const int64_t t_now = now_us();
+        token_us.push_back(t_now - t_token);
+        t_token = t_now;
+        
+        GovernorDecision decision;
+        if (governed && governor.on_token(t_now) &&
+            governor.evaluate(read_temperature(thermal_zone), decision)) {
+            apply_governor_decision(decision);
+        }
+    }
+    g_stats.decode_cpu_us = cpu_time_us() - cpu_decode_start;
+    g_stats.threads_decode_final = llama_n_threads(g_ctx);
+    if (governed && !governor.decisions().empty()) {
+        g_stats.governor_decisions = governor.decisions();
+        llama_set_n_threads(g_ctx, g_stats.n_threads_decode, g_stats.n_threads_prefill);
+        set_decode_poll(pool_policy().poll);
+    }
+    park_threadpool(g_pool_decode);
+    
+    if (stop_reason != kStopSequence && stop_reason != kStopTruncated) {
+        text.clear();
+        chars.clear();
+        stop_matcher.flush(text);
+        utf8.feed(text.data(), text.size(), chars);
+        utf8.flush(chars);
+        if (!chars.empty() && !sink.on_text(chars.data(), chars.size())) {
+            stop_reason = kStopTruncated;
+        }
+    }
+    g_stats.stop_reason = stop_reason;
+    if (grammar != nullptr) {
+        g_stats.grammar_states = grammar->dfa.n_states();
+        g_stats.grammar_masks_built = (int) grammar->masks->n_built();
+    }
+    g_stats.n_generated = n_generated;
+    g_stats.decode_us = now_us() - t_decode_start;
+    if (!token_us.empty()) {
+        auto percentile = [&token_us](size_t pct) {
+            auto it = token_us.begin() + (token_us.size() - 1) * pct / 100;
+            std::nth_element(token_us.begin(), it, token_us.end());
+            return *it;
+        };
+        g_stats.token_p50_us = percentile(50);
+        g_stats.token_p95_us = percentile(95);
+    }
+    LOGI("Generated %d tokens, stop=%s (prefill %d tokens in %d chunks, %lld ms, max step %lld ms)",
+         n_generated, stop_reason_name(stop_reason), n_prompt, g_stats.n_prefill_chunks,
+         (long long) (g_stats.prefill_us / 1000),
+         (long long) (g_stats.max_prefill_step_us / 1000));
+    return result;
+}
+
+// ============================================================================
+// Token ring - lock-free SPSC byte ring shared with Kotlin as a direct ByteBuffer
+// ============================================================================
+// The native generation thread is the only producer and the Kotlin poll loop the only
+// consumer. Indices grow monotonically; the buffer offset is index & (capacity - 1).
+// Kotlin drains whole batches of UTF-8 bytes per poll() instead of receiving one JNI
+// callback per token.
+static const uint32_t kTokenRingCapacity = 1u << 16;   // must be a power of two
+
+struct TokenRing {
+    alignas(64) std::atomic<uint64_t> head{0};      // written by the producer
+    alignas(64) std::atomic<uint64_t> tail{0};      // written by the consumer
+    alignas(64) std::atomic<bool> finished{true};
+    std::atomic<bool> consumer_waiting{false};
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+    alignas(64) uint8_t data[kTokenRingCapacity];
+
+    void reset() {
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        finished.store(false);
+    }
+
+    // Producer side. Blocks while the ring is full unless the generation was stopped.
+    bool write(const char* bytes, uint32_t n, uint64_t generation_id) {
+        if (n > kTokenRingCapacity) return false;
+        const uint64_t h = head.load(std::memory_order_relaxed);
+        while (kTokenRingCapacity - (h - tail.load(std::memory_order_acquire)) < n) {
+            if (g_stop_generation_id.load() == generation_id) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        const uint32_t off = (uint32_t) (h & (kTokenRingCapacity - 1));
+        const uint32_t first = std::min(n, kTokenRingCapacity - off);
+        memcpy(data + off, bytes, first);
+        memcpy(data, bytes + first, n - first);
+        head.store(h + n, std::memory_order_seq_cst);
+        wake_consumer();
+        return true;
+    }
+
+    void finish() {
+        finished.store(true, std::memory_order_seq_cst);
+        wake_consumer();
+    }
+
+    // Consumer side. Releases `consumed` bytes and returns the next contiguous readable
+    // region packed as (offset << 32) | length, or -1 once finished and fully drained.
+    int64_t poll(uint32_t consumed) {
+        const uint64_t t = tail.load(std::memory_order_relaxed) + consumed;
+        tail.store(t, std::memory_order_release);
+        const bool done = finished.load(std::memory_order_acquire);
+        const uint64_t available = head.load(std::memory_order_acquire) - t;
+        if (available == 0) return done ? -1 : 0;
+        const uint32_t off = (uint32_t) (t & (kTokenRingCapacity - 1));
+        const uint32_t len = (uint32_t) std::min<uint64_t>(available, kTokenRingCapacity - off);
+        return ((int64_t) off << 32) | len;
+    }
+
+    // Consumer side. Waits until bytes are readable, the producer finished, or timeout.
+    bool await(int64_t timeout_ms) {
+        auto ready = [this] {
+            return finished.load() || head.load() != tail.load(std::memory_order_relaxed);
+        };
+        if (ready()) return true;
+        std::unique_lock<std::mutex> lock(wait_mutex);
+        consumer_waiting.store(true);
+        const bool ok = wait_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), ready);
+        consumer_waiting.store(false);
+        return ok;
+    }
+
+private:
+    void wake_consumer() {
+        if (consumer_waiting.load()) {
+            std::lock_guard<std::mutex> lock(wait_mutex);
+            wait_cv.notify_one();
+        }
+    }
+};
+
+static TokenRing g_token_ring;
+static std::thread g_generation_thread;
+
+// Writes text straight into the ring - no JNI involved. Chunks larger than a quarter of
+// the ring go in slices so the consumer can drain while the rest waits; the consumer
+// reassembles code points across region boundaries anyway.
+class RingSink : public TokenSink {
+public:
+    explicit RingSink(uint64_t generation_id) : generation_id_(generation_id) {}
+
+    bool on_text(const char* text, size_t n) override {
+        const size_t kSlice = kTokenRingCapacity / 4;
+        for (size_t done = 0; done < n;) {
+            const uint32_t len = (uint32_t) std::min(kSlice, n - done);
+            if (!g_token_ring.write(text + done, len, generation_id_)) return false;
+            done += len;
+        }
+        return true;
+    }
+
+private:
+    uint64_t generation_id_;
+};
+
+static void generation_thread_main(GenerationRequest req, uint64_t local_id) {
+    RingSink sink(local_id);
+    GenerationResult result = run_generation(req, local_id, sink);
+    if (result == kGenTokenizeFailed || result == kGenPrefillFailed || result == kGenGrammarFailed) {
+        LOGE("Background generation failed (%d)", (int) result);
+    }
+    end_generation(local_id);
+    g_token_ring.finish();
+}
+
+// Joins a finished (or stopping) background generation before the context is touched.
+static void join_generation_thread() {
+    if (g_generation_thread.joinable()) {
+        g_generation_thread.join();
+    }
+}
+
+// ============================================================================
+// JNI Lifecycle
+// ============================================================================
+extern "C" {
+
+JNIEXPORT jint JNI_OnLoad(JavaVM* vm, void* reserved) {
+    g_jvm = vm;
+    llama_backend_init();
+    LOGI("Llama backend initialized");
+    return JNI_VERSION_1_6;
+}
+
+JNIEXPORT void JNI_OnUnload(JavaVM* vm, void* reserved) {
+    llama_backend_free();
+    LOGI("Llama backend freed");
+}
+
+// ============================================================================
+// Model Loading - Optimized for mobile
+// ============================================================================
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_loadModel(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring modelPath,
+    jint nCtx,
+    jint nThreads,
+    jint nGpuLayers
+) {
+    const std::unique_lock<std::mutex> model_lock = lock_model_for_reload();
+    // Clean up any existing state
+    if (g_generation_thread.joinable()) {
+        request_stop();
+        join_generation_thread();
+    }
+    stop_piece_table_build();
+    free_context();
+    if (g_model != nullptr) {
+        llama_model_free(g_model);
+        g_model = nullptr;
+    }
+    g_vocab = nullptr;
+    g_chat_template = nullptr;
+    reset_grammar_cache();
+    g_vocab_subset.clear();
+    g_tokenizer_split_state = kSplitUnverified;
+    g_calibration_pending = false;
+    
+    if (!load_cpu_backend()) return JNI_FALSE;
+    
+    // Standard UTF-8, as fopen expects for non-ASCII paths
+    const std::string path = get_string(env, modelPath);
+    LOGI("Loading model: %s", path.c_str());
+    
+    // Adaptive configuration for device capabilities
+    applyDeviceConfig();
+    
+    // Model parameters - optimized for mobile
+    llama_model_params model_params = llama_model_default_params();
+    model_params.n_gpu_layers = 0;      // CPU-only for stability
+    model_params.use_mmap = true;       // Memory-mapped loading (fast, low memory)
+    model_params.use_mlock = false;     // Don't lock - prevents OOM
+    
+    // Load model
+    g_model = llama_model_load_from_file(path.c_str(), model_params);
+    
+    if (g_model == nullptr) {
+        LOGE("Failed to load model");
+        return JNI_FALSE;
+    }
+    
+    // Get vocabulary
+    g_vocab = llama_model_get_vocab(g_model);
+    if (g_vocab == nullptr) {
+        LOGE("Failed to get vocabulary");
+        llama_model_free(g_model);
+        g_model = nullptr;
+        return JNI_FALSE;
+    }
+    
+            // Cap by requested and model limits
+                int modelTrainCtx = llama_model_n_ctx_train(g_model);
+                int deviceCtx = g_context_size;
+                g_context_size = std::min({(int)nCtx, deviceCtx, modelTrainCtx});
+    
+                LOGI("Context size: requested=%d, device=%d, model_max=%d -> using=%d",
+                    nCtx, deviceCtx, modelTrainCtx, g_context_size);
+    
+    // Context parameters: a stored profile, else the device defaults
+    if (g_calibrate_threads) g_n_threads_prefill = g_n_threads_decode = g_n_threads.load();
+    const bool tuned = load_tune_profile();
+    g_tune_source = tuned ? "profile" : "defaults";
+    
+    // Create context
+    if (!create_context()) {
+        LOGE("Failed to create context");
+        llama_model_free(g_model);
+        g_model = nullptr;
+        g_vocab = nullptr;
+        return JNI_FALSE;
+    }
+
+    // Enforce model size and quantization constraints
+    uint64_t n_params = llama_model_n_params(g_model);
+    if (n_params > kMaxParams) {
+        LOGE("Model too large: %llu params (max 7B)", (unsigned long long) n_params);
+        free_context();
+        llama_model_free(g_model);
+        g_model = nullptr;
+        g_vocab = nullptr;
+        return JNI_FALSE;
+    }
+
+    char desc[256];
+    llama_model_desc(g_model, desc, sizeof(desc));
+    std::string desc_str(desc);
+    for (auto & c : desc_str) c = (char) tolower((unsigned char) c);
+    if (desc_str.find("q4") == std::string::npos &&
+        desc_str.find("q5") == std::string::npos &&
+        desc_str.find("quantized") == std::string::npos) {
+        LOGE("Unsupported quantization (require Q4/Q5): %s", desc);
+        free_context();
+        llama_model_free(g_model);
+        g_model = nullptr;
+        g_vocab = nullptr;
+        return JNI_FALSE;
+    }
+    
+    load_chat_template();
+    build_special_token_mask();
+    g_calibration_pending = g_calibrate_threads && !tuned;
+    start_piece_table_build();
+    
+    LOGI("Model loaded: ctx=%d, batch=%d, threads=%d prefill / %d decode (near-greedy sampling)",
+         g_context_size, g_batch_size, g_n_threads_prefill.load(), g_n_threads_decode.load());
+    
+    return JNI_TRUE;
+}
+
+// ============================================================================
+// Model Unloading
+// ============================================================================
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_unloadModel(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    const std::unique_lock<std::mutex> model_lock = lock_model_for_reload();
+    request_stop();
+    join_generation_thread();
+    stop_piece_table_build();
+    
+    // Nullify pointers first to prevent stale access from other threads
+    auto* batch_copy = g_batch_initialized ? &g_batch : nullptr;
+    auto* ctx_copy = g_ctx;
+    auto* model_copy = g_model;
+    
+    g_vocab = nullptr;
+    g_chat_template = nullptr;
+    reset_grammar_cache();
+    g_vocab_subset.clear();
+    g_tokenizer_split_state = kSplitUnverified;
+    g_calibration_pending = false;
+    g_ctx = nullptr;
+    g_model = nullptr;
+    
+    if (g_batch_initialized) {
+        llama_batch_free(g_batch);
+        g_batch_initialized = false;
+    }
+    if (ctx_copy != nullptr) {
+        llama_free(ctx_copy);
+    }
+    free_threadpools();
+    if (model_copy != nullptr) {
+        llama_model_free(model_copy);
+    }
+    
+    LOGI("Model unloaded");
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_isModelLoaded(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    return (g_model != nullptr && g_ctx != nullptr) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_stopGeneration(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    request_stop();
+}
+
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setAbortOnStop(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean enabled
+) {
+    g_abort_on_stop = enabled == JNI_TRUE;
+}
+
+// ============================================================================
+// Token Generation - Maximum Speed Optimization
+// ============================================================================
+// Reads a LlamaCpp.SamplerConfig; null means the default chat settings.
+static SamplerConfig get_sampler_config(JNIEnv* env, jobject config) {
+    SamplerConfig out;
+    out.params = kDefaultSamplerParams;
+    if (config == nullptr) return out;
+    
+    jclass cls = env->GetObjectClass(config);
+    jfieldID top_k = env->GetFieldID(cls, "topK", "I");
+    jfieldID top_p = env->GetFieldID(cls, "topP", "F");
+    jfieldID temp = env->GetFieldID(cls, "temperature", "F");
+    jfieldID min_p = env->GetFieldID(cls, "minP", "F");
+    jfieldID seed = env->GetFieldID(cls, "seed", "J");
+    if (top_k == nullptr || top_p == nullptr || temp == nullptr || min_p == nullptr ||
+        seed == nullptr) {
+        env->ExceptionClear();
+        env->DeleteLocalRef(cls);
+        LOGE("SamplerConfig fields not found, using defaults");
+        return out;
+    }
+    out.params.top_k = env->GetIntField(config, top_k);
+    out.params.top_p = env->GetFloatField(config, top_p);
+    out.params.temp = env->GetFloatField(config, temp);
+    out.params.min_p = env->GetFloatField(config, min_p);
+    // The sampler RNG takes 32 bits: fold the high half in so seeds differing only there
+    // stay distinct, and keep folded values off the random-seed sentinel
+    const jlong s = env->GetLongField(config, seed);
+    if (s < 0) {
+        out.seed = LLAMA_DEFAULT_SEED;
+    } else {
+        out.seed = (uint32_t) ((uint64_t) s ^ ((uint64_t) s >> 32));
+        if (out.seed == LLAMA_DEFAULT_SEED) out.seed--;
+    }
+    env->DeleteLocalRef(cls);
+    return out;
+}
+
+static jstring generate_blocking(JNIEnv* env, const GenerationRequest& req, jobject callback) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("Error: Model not loaded");
+    }
+    
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return env->NewStringUTF("Error: Generation already in progress");
+    }
+    
+    // Get callback method
+    jclass callbackClass = env->GetObjectClass(callback);
+    jmethodID onTokenMethod = callbackClass
+        ? env->GetMethodID(callbackClass, "onToken", "(Ljava/lang/String;)V")
+        : nullptr;
+    if (callbackClass == nullptr || onTokenMethod == nullptr) {
+        if (callbackClass != nullptr) env->DeleteLocalRef(callbackClass);
+        end_generation(local_id);
+        return env->NewStringUTF("{\"error\":\"Token callback not available\"}");
+    }
+    
+    TokenDeliveryWorker delivery;
+    if (!delivery.start(env, callback, onTokenMethod, local_id, std::max(1, req.max_tokens) * 8)) {
+        env->DeleteLocalRef(callbackClass);
+        end_generation(local_id);
+        return env->NewStringUTF("{\"error\":\"Token callback not available\"}");
+    }
+    
+    GenerationResult result = run_generation(req, local_id, delivery);
+    delivery.finish(env);
+    env->DeleteLocalRef(callbackClass);
+    end_generation(local_id);
+    
+    switch (result) {
+        case kGenTokenizeFailed:
+            return env->NewStringUTF("Error: Tokenization failed");
+        case kGenPrefillFailed:
+            return env->NewStringUTF("Error: Prompt evaluation failed");
+        case kGenGrammarFailed:
+            return env->NewStringUTF("Error: Invalid grammar");
+        case kGenStoppedInPrefill:
+            return env->NewStringUTF("");
+        default: {
+            std::string scratch;
+            const std::string& response = delivery.response();
+            return new_string_utf8(env, response.data(), response.size(), scratch);
+        }
+    }
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_generateNative(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring prompt,
+    jint maxTokens,
+    jstring grammar,
+    jobject samplerConfig,
+    jobjectArray stopSequences,
+    jobject callback
+) {
+    GenerationRequest req;
+    req.prompt = get_string(env, prompt);
+    req.max_tokens = maxTokens;
+    req.grammar = get_string(env, grammar);
+    req.sampler = get_sampler_config(env, samplerConfig);
+    req.stop_sequences = get_string_array(env, stopSequences);
+    return generate_blocking(env, req, callback);
+}
+
+// ============================================================================
+// UTF-8 byte transport - prompt in from a byte[] / direct ByteBuffer, output to a direct buffer
+// ============================================================================
+// Return codes of generateUtf8Native; >= 0 is the number of output bytes written.
+enum Utf8GenerateError {
+    kUtf8NotLoaded = -1,
+    kUtf8Busy = -2,
+    kUtf8BadBuffer = -3,
+    kUtf8TokenizeFailed = -4,
+    kUtf8PrefillFailed = -5,
+    kUtf8GrammarFailed = -6,
+};
+
+JNIEXPORT jint JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_generateUtf8Native(
+    JNIEnv* env,
+    jobject /* this */,
+    jbyteArray promptBytes,
+    jobject promptBuffer,
+    jint promptOffset,
+    jint promptLength,
+    jint maxTokens,
+    jstring grammar,
+    jobject samplerConfig,
+    jobjectArray stopSequences,
+    jobject output,
+    jint outputOffset,
+    jint outputCapacity,
+    jobject callback
+) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return kUtf8NotLoaded;
+    }
+    
+    char* out = output != nullptr ? (char*) env->GetDirectBufferAddress(output) : nullptr;
+    if (out == nullptr || outputOffset < 0 || outputCapacity < 0 ||
+        (jlong) outputOffset + outputCapacity > env->GetDirectBufferCapacity(output)) {
+        return kUtf8BadBuffer;
+    }
+    
+    GenerationRequest req;
+    if (!get_utf8_bytes(env, promptBytes, promptBuffer, promptOffset, promptLength, req.prompt)) {
+        return kUtf8BadBuffer;
+    }
+    req.max_tokens = maxTokens;
+    req.grammar = get_string(env, grammar);
+    req.sampler = get_sampler_config(env, samplerConfig);
+    req.stop_sequences = get_string_array(env, stopSequences);
+    
+    jmethodID onBytesMethod = nullptr;
+    if (callback != nullptr) {
+        jclass callbackClass = env->GetObjectClass(callback);
+        onBytesMethod = env->GetMethodID(callbackClass, "onBytes", "(II)V");
+        env->DeleteLocalRef(callbackClass);
+        if (onBytesMethod == nullptr) {
+            env->ExceptionClear();
+            return kUtf8BadBuffer;
+        }
+    }
+    
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return kUtf8Busy;
+    }
+    
+    TokenDeliveryWorker delivery;
+    if (!delivery.start_bytes(env, callback, onBytesMethod, local_id, out + outputOffset,
+                              (size_t) outputCapacity)) {
+        end_generation(local_id);
+        return kUtf8BadBuffer;
+    }
+    
+    GenerationResult result = run_generation(req, local_id, delivery);
+    delivery.finish(env);
+    g_stats.output_truncated = delivery.truncated();
+    end_generation(local_id);
+    
+    switch (result) {
+        case kGenTokenizeFailed: return kUtf8TokenizeFailed;
+        case kGenPrefillFailed: return kUtf8PrefillFailed;
+        case kGenGrammarFailed: return kUtf8GrammarFailed;
+        default: return (jint) delivery.written();
+    }
+}
+
+// ============================================================================
+// Background generation - native thread + token ring, drained by Kotlin
+// ============================================================================
+static bool start_background_generation(GenerationRequest req) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        LOGE("startGeneration: model not loaded");
+        return false;
+    }
+    
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        LOGE("startGeneration: generation already in progress");
+        return false;
+    }
+    
+    join_generation_thread();
+    g_token_ring.reset();
+    g_generation_thread = std::thread(generation_thread_main, std::move(req), local_id);
+    return true;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_startGeneration(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring prompt,
+    jint maxTokens,
+    jobjectArray stopSequences,
+    jstring grammar,
+    jobject samplerConfig
+) {
+    GenerationRequest req;
+    req.prompt = get_string(env, prompt);
+    req.max_tokens = maxTokens;
+    req.stop_sequences = get_string_array(env, stopSequences);
+    req.grammar = get_string(env, grammar);
+    req.sampler = get_sampler_config(env, samplerConfig);
+    return start_background_generation(std::move(req)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_startGenerationUtf8Native(
+    JNIEnv* env,
+    jobject /* this */,
+    jbyteArray promptBytes,
+    jobject promptBuffer,
+    jint promptOffset,
+    jint promptLength,
+    jint maxTokens,
+    jobjectArray stopSequences,
+    jstring grammar,
+    jobject samplerConfig
+) {
+    GenerationRequest req;
+    if (!get_utf8_bytes(env, promptBytes, promptBuffer, promptOffset, promptLength, req.prompt)) {
+        LOGE("startGeneration: bad prompt buffer");
+        return JNI_FALSE;
+    }
+    req.max_tokens = maxTokens;
+    req.stop_sequences = get_string_array(env, stopSequences);
+    req.grammar = get_string(env, grammar);
+    req.sampler = get_sampler_config(env, samplerConfig);
+    return start_background_generation(std::move(req)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jobject JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_getTokenBuffer(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    return env->NewDirectByteBuffer(g_token_ring.data, kTokenRingCapacity);
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_poll(
+    JNIEnv* env,
+    jobject /* this */,
+    jint consumed
+) {
+    return g_token_ring.poll((uint32_t) std::max(0, (int) consumed));
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_await(
+    JNIEnv* env,
+    jobject /* this */,
+    jlong timeoutMs
+) {
+    return g_token_ring.await(std::max<int64_t>(0, timeoutMs)) ? JNI_TRUE : JNI_FALSE;
+}
+
+// ============================================================================
+// Model Info
+// ============================================================================
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_getModelInfo(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    if (g_model == nullptr || g_vocab == nullptr) {
+        return env->NewStringUTF("{}");
+    }
+    
+    char buf[256];
+    llama_model_desc(g_model, buf, sizeof(buf));
+    
+    std::string info = "{";
+    info += "\"description\":\"" + std::string(buf) + "\",";
+    info += "\"n_params\":" + std::to_string(llama_model_n_params(g_model)) + ",";
+    info += "\"n_vocab\":" + std::to_string(llama_vocab_n_tokens(g_vocab)) + ",";
+    info += "\"n_ctx_train\":" + std::to_string(llama_model_n_ctx_train(g_model)) + ",";
+    info += "\"n_ctx\":" + std::to_string(g_context_size) + ",";
+    info += "\"n_batch\":" + std::to_string(g_batch_size) + ",";
+    info += "\"n_threads\":" + std::to_string(g_n_threads) + ",";
+    info += "\"n_threads_prefill\":" + std::to_string(g_n_threads_prefill) + ",";
+    info += "\"n_threads_decode\":" + std::to_string(g_n_threads_decode) + ",";
+    info += "\"n_cores\":" + std::to_string(cpu_topology().n_cores()) + ",";
+    info += "\"n_performance_cores\":" + std::to_string(cpu_topology().n_performance()) + ",";
+    info += "\"cpu_features\":\"" + cpu_feature_names(detect_cpu_features()) + "\",";
+    info += "\"cpu_variant\":\"" + g_cpu_variant + "\",";
+    info += "\"cpu_variant_forced\":" + std::string(g_forced_cpu_variant.empty() ? "false" : "true") + ",";
+    info += "\"pin_threads\":" + std::string(g_pin_threads ? "true" : "false") + ",";
+    const ThreadPoolPolicy policy = pool_policy();
+    info += "\"threadpool\":\"" + std::string(threadpool_name(policy)) + "\",";
+    info += "\"threadpool_poll\":" + std::to_string(policy.poll) + ",";
+    info += "\"threadpool_priority\":" + std::to_string(policy.priority) + ",";
+    info += "\"thermal_governor\":" + std::string(g_governor_enabled ? "true" : "false") + ",";
+    info += "\"thread_calibration\":" + thread_calibration_json() + ",";
+    info += "\"kv_cache\":\"" + std::string(g_kv_quantized ? "q8_0" : "f16") + "\",";
+    info += "\"flash_attn\":" + std::to_string(g_flash_attn) + ",";
+    info += "\"tune_source\":\"" + std::string(g_tune_source) + "\"";
+    info += "}";
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+static std::string generation_stats_json() {
+    const GenerationStats st = last_stats();
+    const double prefill_tps = st.prefill_us > 0 ? st.n_prompt * 1e6 / st.prefill_us : 0.0;
+    const double decode_tps = st.decode_us > 0 ? st.n_generated * 1e6 / st.decode_us : 0.0;
+    auto per_token = [&](int64_t us) { return st.n_generated > 0 ? (double) us / st.n_generated : 0.0; };
+    
+    std::string info = "{";
+    info += "\"tokenize_ms\":" + std::to_string(st.tokenize_us / 1000.0) + ",";
+    info += "\"tokenize_chunks\":" + std::to_string(st.tokenize_chunks) + ",";
+    info += "\"n_prompt\":" + std::to_string(st.n_prompt) + ",";
+    info += "\"n_generated\":" + std::to_string(st.n_generated) + ",";
+    info += "\"prefill_ms\":" + std::to_string(st.prefill_us / 1000) + ",";
+    info += "\"prefill_chunks\":" + std::to_string(st.n_prefill_chunks) + ",";
+    info += "\"min_prefill_chunk\":" + std::to_string(st.min_prefill_chunk) + ",";
+    info += "\"max_prefill_step_ms\":" + std::to_string(st.max_prefill_step_us / 1000) + ",";
+    info += "\"prefill_target_ms\":" + std::to_string(g_prefill_target_ms) + ",";
+    info += "\"decode_ms\":" + std::to_string(st.decode_us / 1000) + ",";
+    info += "\"stop_latency_ms\":" + std::to_string(st.stop_latency_us < 0 ? -1.0 : st.stop_latency_us / 1000.0) + ",";
+    info += "\"abort_on_stop\":" + std::string(g_abort_on_stop.load() ? "true" : "false") + ",";
+    info += "\"stop_reason\":\"" + std::string(stop_reason_name(st.stop_reason)) + "\",";
+    info += "\"repetition_period\":" + std::to_string(st.repetition_period) + ",";
+    info += "\"repetition_hits\":" + std::to_string(st.repetition_hits) + ",";
+    info += "\"sample_us_per_token\":" + std::to_string(per_token(st.sample_us)) + ",";
+    info += "\"constraint_us_per_token\":" + std::to_string(per_token(st.constraint_us)) + ",";
+    info += "\"sampling_mode\":\"" + std::string(st.sampling_mode) + "\",";
+    info += "\"vocab_subset\":" + std::to_string(st.vocab_subset) + ",";
+    info += "\"grammar_mode\":\"" + std::string(st.grammar_mode) + "\",";
+    info += "\"grammar_states\":" + std::to_string(st.grammar_states) + ",";
+    info += "\"grammar_masks_built\":" + std::to_string(st.grammar_masks_built) + ",";
+    info += "\"output_truncated\":" + std::string(st.output_truncated ? "true" : "false") + ",";
+    info += "\"pinned\":" + std::string(st.pinned ? "true" : "false") + ",";
+    info += "\"threads_prefill\":" + std::to_string(st.n_threads_prefill) + ",";
+    info += "\"threads_decode\":" + std::to_string(st.n_threads_decode) + ",";
+    info += "\"threadpool\":\"" + std::string(st.threadpool) + "\",";
+    info += "\"token_p50_ms\":" + std::to_string(st.token_p50_us / 1000.0) + ",";
+    info += "\"token_p95_ms\":" + std::to_string(st.token_p95_us / 1000.0) + ",";
+    info += "\"cpu_ms_per_token\":" + std::to_string(per_token(st.decode_cpu_us) / 1000.0) + ",";
+    info += "\"threads_decode_final\":" + std::to_string(st.threads_decode_final) + ",";
+    info += "\"governor\":" + governor_decisions_json(st.governor_decisions) + ",";
+    info += "\"prefill_tps\":" + std::to_string(prefill_tps) + ",";
+    info += "\"decode_tps\":" + std::to_string(decode_tps);
+    info += "}";
+    return info;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_getGenerationStats(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    return env->NewStringUTF(generation_stats_json().c_str());
+}
+
+// ============================================================================
+// Deterministic replay - identical work for decode benchmarks across builds/devices
+// ============================================================================
+enum ReplayMode {
+    kReplayForce = 0,        // decode the recorded tokens, no sampling
+    kReplayRegenerate = 1,   // sample again with the recorded seed and config
+};
+
+struct DiscardSink : TokenSink {
+    bool on_text(const char* /* data */, size_t /* n */) override { return true; }
+};
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_saveTrace(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring path
+) {
+    if (g_is_generating.load() || g_last_trace.empty()) return JNI_FALSE;
+    return g_last_trace.save(get_string(env, path)) ? JNI_TRUE : JNI_FALSE;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_loadTrace(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring path
+) {
+    const std::string trace_path = get_string(env, path);
+    if (!g_replay_trace.load(trace_path)) {
+        LOGE("Could not load trace %s", trace_path.c_str());
+        g_replay_trace = GenerationTrace();
+        return JNI_FALSE;
+    }
+    LOGI("Loaded trace: %zu prompt tokens, %zu generated", g_replay_trace.prompt.size(),
+         g_replay_trace.tokens.size());
+    return JNI_TRUE;
+}
+
+// Replays the loaded trace (or the last generation) on the calling thread.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_replay(
+    JNIEnv* env,
+    jobject /* this */,
+    jint mode
+) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    
+    // Copied while no generation can write g_last_trace
+    const GenerationTrace trace = g_replay_trace.empty() ? g_last_trace : g_replay_trace;
+    if (trace.empty() || trace.n_vocab != llama_vocab_n_tokens(g_vocab)) {
+        end_generation(local_id);
+        return env->NewStringUTF(trace.empty()
+            ? "{\"error\":\"No trace recorded\"}"
+            : "{\"error\":\"Trace was recorded with a different model\"}");
+    }
+    
+    // Run with the special-token mask the trace was recorded with, restored afterwards
+    const bool allow_eog = g_allow_eog_tokens;
+    const std::vector<std::string> allowed_special = g_allowed_special;
+    const bool swap_special = trace.has_constraints &&
+        (trace.allow_eog != allow_eog || trace.allowed_special != allowed_special);
+    if (swap_special) {
+        g_allow_eog_tokens = trace.allow_eog;
+        g_allowed_special = trace.allowed_special;
+        build_special_token_mask();
+    }
+    
+    GenerationRequest req;
+    req.prompt_tokens = trace.prompt;
+    req.max_tokens = trace.max_tokens;
+    req.stop_sequences = trace.stop_sequences;
+    req.sampler.params.top_k = trace.top_k;
+    req.sampler.params.top_p = trace.top_p;
+    req.sampler.params.temp = trace.temp;
+    req.sampler.params.min_p = trace.min_p;
+    req.sampler.seed = trace.seed;
+    VocabSubset subset;
+    if (trace.has_constraints) {
+        req.grammar = trace.grammar;
+        req.repetition_policy = trace.repetition_policy;
+        if (!trace.vocab_subset.empty()) {
+            subset.build(trace.vocab_subset, trace.n_vocab, model_fingerprint());
+        }
+        req.vocab_subset = &subset;
+    }
+    if (mode == kReplayForce) req.forced_tokens = &trace.tokens;
+    req.governed = false;
+    GenerationTrace replayed_trace;
+    req.record = &replayed_trace;
+    
+    DiscardSink sink;
+    const GenerationResult result = run_generation(req, local_id, sink);
+    if (swap_special) {
+        g_allow_eog_tokens = allow_eog;
+        g_allowed_special = allowed_special;
+        build_special_token_mask();
+    }
+    end_generation(local_id);
+    if (result == kGenGrammarFailed) {
+        return env->NewStringUTF("{\"error\":\"Invalid grammar\"}");
+    }
+    if (result == kGenTokenizeFailed || result == kGenPrefillFailed) {
+        return env->NewStringUTF("{\"error\":\"Prompt evaluation failed\"}");
+    }
+    
+    // First token where the replay left the recorded sequence, -1 if identical
+    const std::vector<int32_t>& replayed = replayed_trace.tokens;
+    int diverged_at = -1;
+    const size_t n = std::min(replayed.size(), trace.tokens.size());
+    for (size_t i = 0; i < n && diverged_at < 0; i++) {
+        if (replayed[i] != trace.tokens[i]) diverged_at = (int) i;
+    }
+    if (diverged_at < 0 && replayed.size() != trace.tokens.size()) diverged_at = (int) n;
+    
+    std::string info = "{";
+    info += "\"mode\":\"" + std::string(mode == kReplayForce ? "force" : "regenerate") + "\",";
+    info += "\"n_recorded\":" + std::to_string(trace.tokens.size()) + ",";
+    info += "\"diverged_at\":" + std::to_string(diverged_at) + ",";
+    info += "\"stats\":" + generation_stats_json();
+    info += "}";
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Times the llama sampler chain against the fused top-k and min-p kernels on synthetic
+// logits. Needs no model.
+static const float kBenchmarkMinP = 0.05f;
+
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_benchmarkSampler(
+    JNIEnv* env,
+    jobject /* this */,
+    jint nVocab,
+    jint iterations
+) {
+    const int n_vocab = std::max(64, (int) nVocab);
+    const int n_iter = std::max(1, (int) iterations);
+    
+    // A few distinct rows so the scan is not served from a single warm row. Roughly normal
+    // logits plus a handful of strong candidates, like a real next-token distribution.
+    const int n_rows = 8;
+    std::vector<float> rows((size_t) n_rows * n_vocab);
+    uint32_t x = 42;
+    auto next_uniform = [&x]() {
+        x = x * 1664525u + 1013904223u;
+        return (x >> 8) * (1.0f / 16777216.0f);
+    };
+    for (float& v : rows) {
+        v = (next_uniform() + next_uniform() + next_uniform() + next_uniform() - 2.0f) * 3.5f;
+    }
+    for (int r = 0; r < n_rows; r++) {
+        for (int j = 0; j < 8; j++) {
+            rows[(size_t) r * n_vocab + (size_t) (next_uniform() * n_vocab)] += 10.0f + j;
+        }
+    }
+    
+    const SamplerParams& sp = kDefaultSamplerParams;
+    llama_sampler* chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(sp.top_k));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_p(sp.top_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(sp.temp));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(1234));
+    
+    // Same work llama_sampler_sample does: build the candidate array, run the chain
+    std::vector<llama_token_data> cur(n_vocab);
+    int64_t t0 = now_us();
+    int64_t sink = 0;
+    for (int it = 0; it < n_iter; it++) {
+        const float* row = &rows[(size_t) (it % n_rows) * n_vocab];
+        for (int i = 0; i < n_vocab; i++) cur[i] = {i, row[i], 0.0f};
+        llama_token_data_array cur_p = {cur.data(), cur.size(), -1, false};
+        llama_sampler_apply(chain, &cur_p);
+        sink += cur_p.data[cur_p.selected].id;
+    }
+    const int64_t chain_us = now_us() - t0;
+    llama_sampler_free(chain);
+    
+    FusedSampler fused(sp, 1234);
+    std::vector<int32_t> picks(n_iter);
+    t0 = now_us();
+    for (int it = 0; it < n_iter; it++) {
+        picks[it] = fused.sample(&rows[(size_t) (it % n_rows) * n_vocab], n_vocab);
+    }
+    const int64_t fused_us = now_us() - t0;
+    
+    t0 = now_us();
+    for (int it = 0; it < n_iter; it++) {
+        sink += argmax(&rows[(size_t) (it % n_rows) * n_vocab], n_vocab);
+    }
+    const int64_t greedy_us = now_us() - t0;
+    
+    SamplerParams mp = sp;
+    mp.min_p = kBenchmarkMinP;
+    FusedSampler min_p(mp, 1234);
+    t0 = now_us();
+    for (int it = 0; it < n_iter; it++) {
+        sink += min_p.sample(&rows[(size_t) (it % n_rows) * n_vocab], n_vocab);
+    }
+    const int64_t min_p_us = now_us() - t0;
+    
+    // Same seed, same logits -> same tokens
+    FusedSampler replay(sp, 1234);
+    bool reproducible = true;
+    for (int it = 0; it < n_iter && reproducible; it++) {
+        reproducible = replay.sample(&rows[(size_t) (it % n_rows) * n_vocab], n_vocab) == picks[it];
+    }
+    LOGD("benchmarkSampler checksum %lld", (long long) sink);
+    
+    std::string info = "{";
+    info += "\"n_vocab\":" + std::to_string(n_vocab) + ",";
+    info += "\"iterations\":" + std::to_string(n_iter) + ",";
+    info += "\"chain_us_per_token\":" + std::to_string((double) chain_us / n_iter) + ",";
+    info += "\"fused_us_per_token\":" + std::to_string((double) fused_us / n_iter) + ",";
+    info += "\"min_p_us_per_token\":" + std::to_string((double) min_p_us / n_iter) + ",";
+    info += "\"greedy_us_per_token\":" + std::to_string((double) greedy_us / n_iter) + ",";
+    info += "\"reproducible\":" + std::string(reproducible ? "true" : "false");
+    info += "}";
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Per-token detokenization cost: a fresh std::string per token (the original loop), a reused
+// buffer, and the piece table. Needs a loaded model whose piece table has been built.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_benchmarkDetokenize(
+    JNIEnv* env,
+    jobject /* this */,
+    jint iterations
+) {
+    if (g_vocab == nullptr) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    if (!g_pieces.ready()) {
+        return env->NewStringUTF("{\"error\":\"Piece table not built yet\"}");
+    }
+    
+    const int n_vocab = llama_vocab_n_tokens(g_vocab);
+    const int n_iter = std::max(1, (int) iterations);
+    std::vector<llama_token> ids(n_iter);
+    uint32_t x = 11;
+    for (llama_token& id : ids) {
+        x = x * 1664525u + 1013904223u;
+        id = (llama_token) ((x >> 8) % (uint32_t) n_vocab);
+    }
+    
+    size_t sink = 0;
+    int64_t t0 = now_us();
+    for (llama_token id : ids) {
+        std::string token_str(128, '\0');
+        int n = llama_token_to_piece(g_vocab, id, &token_str[0], (int) token_str.size(), 0, true);
+        if (n < 0) {
+            token_str.resize(-n);
+            n = llama_token_to_piece(g_vocab, id, &token_str[0], (int) token_str.size(), 0, true);
+        }
+        sink += std::max(0, n);
+    }
+    const int64_t alloc_us = now_us() - t0;
+    
+    std::string piece(128, '\0');
+    t0 = now_us();
+    for (llama_token id : ids) sink += std::max(0, token_to_piece(id, piece));
+    const int64_t reused_us = now_us() - t0;
+    
+    t0 = now_us();
+    for (llama_token id : ids) {
+        const char* data = nullptr;
+        size_t n = 0;
+        if (g_pieces.lookup(id, data, n)) sink += n + (n > 0 ? (unsigned char) data[0] : 0);
+    }
+    const int64_t table_us = now_us() - t0;
+    LOGD("benchmarkDetokenize checksum %zu", sink);
+    
+    auto ns = [n_iter](int64_t us) { return us * 1000.0 / n_iter; };
+    std::string info = "{";
+    info += "\"iterations\":" + std::to_string(n_iter) + ",";
+    info += "\"alloc_ns_per_token\":" + std::to_string(ns(alloc_us)) + ",";
+    info += "\"reused_buffer_ns_per_token\":" + std::to_string(ns(reused_us)) + ",";
+    info += "\"piece_table_ns_per_token\":" + std::to_string(ns(table_us)) + ",";
+    info += "\"piece_table_bytes\":" + std::to_string(g_pieces.bytes()) + ",";
+    info += "\"piece_table_build_ms\":" + std::to_string(g_piece_build_us.load() / 1000);
+    info += "}";
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Serial llama_tokenize against the chunked parallel tokenizer on `sample` repeated to
+// 10k, 25k and 50k bytes. Needs a loaded model.
+static const size_t kTokenizeBenchSizes[] = {10000, 25000, 50000};
+
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_benchmarkTokenize(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring sample,
+    jint iterations
+) {
+    if (g_vocab == nullptr) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    const std::string base = get_string(env, sample);
+    if (base.empty()) {
+        return env->NewStringUTF("{\"error\":\"Empty sample text\"}");
     }
+    const int n_iter = std::max(1, (int) iterations);
     
-    LOGI("Generated %d tokens", n_generated);
-    env->DeleteLocalRef(callbackClass);
+    std::string info = "{";
+    info += "\"threads\":" + std::to_string(g_n_threads) + ",";
+    info += "\"results\":[";
+    for (size_t s = 0; s < sizeof(kTokenizeBenchSizes) / sizeof(kTokenizeBenchSizes[0]); s++) {
+        std::string text;
+        while (text.size() < kTokenizeBenchSizes[s]) text += base + "\n\n";
+        
+        std::vector<llama_token> serial, parallel;
+        int64_t t0 = now_us();
+        bool ok = true;
+        for (int it = 0; it < n_iter && ok; it++) ok = tokenize_text(text.data(), text.size(), true, serial);
+        const int64_t serial_us = now_us() - t0;
+        
+        int chunks = 0;
+        t0 = now_us();
+        for (int it = 0; it < n_iter && ok; it++) {
+            chunks = ParallelTokenizer::tokenize(text, true, g_n_threads, tokenize_text, parallel);
+            ok = chunks > 0;
+        }
+        const int64_t parallel_us = now_us() - t0;
+        
+        if (s > 0) info += ",";
+        info += "{\"bytes\":" + std::to_string(text.size()) + ",";
+        info += "\"tokens\":" + std::to_string(serial.size()) + ",";
+        info += "\"chunks\":" + std::to_string(chunks) + ",";
+        info += "\"serial_ms\":" + std::to_string(serial_us / 1000.0 / n_iter) + ",";
+        info += "\"parallel_ms\":" + std::to_string(parallel_us / 1000.0 / n_iter) + ",";
+        info += "\"identical\":" + std::string(ok && serial == parallel ? "true" : "false") + "}";
+    }
+    info += "]}";
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Checks the vectorized argmax against llama's greedy sampler on synthetic rows with many
+// ties and banned (-inf) tokens. Needs no model.
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_checkGreedySampler(
+    JNIEnv* env,
+    jobject /* this */,
+    jint nVocab,
+    jint iterations
+) {
+    const int n_vocab = std::max(1, (int) nVocab);
+    llama_sampler* reference = llama_sampler_init_greedy();
+    std::vector<float> row(n_vocab);
+    std::vector<llama_token_data> cur(n_vocab);
+    uint32_t x = 7;
+    bool ok = true;
+    for (int it = 0; it < std::max(1, (int) iterations) && ok; it++) {
+        for (int i = 0; i < n_vocab; i++) {
+            x = x * 1664525u + 1013904223u;
+            row[i] = (it % 4 == 3 && i % 5 == 0) ? -INFINITY : (float) ((x >> 20) % 64);
+        }
+        for (int i = 0; i < n_vocab; i++) cur[i] = {i, row[i], 0.0f};
+        llama_token_data_array cur_p = {cur.data(), cur.size(), -1, false};
+        llama_sampler_apply(reference, &cur_p);
+        ok = argmax(row.data(), n_vocab) == cur_p.data[cur_p.selected].id;
+    }
+    llama_sampler_free(reference);
+    return ok ? JNI_TRUE : JNI_FALSE;
+}
+
+// Runs byte pieces through the streaming UTF-8 assembler the way the decode loop does and
+// returns what each piece released, plus the end-of-stream flush as the last element.
+// Lets tests feed split-codepoint vocabularies without a model.
+JNIEXPORT jobjectArray JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_assembleUtf8(
+    JNIEnv* env,
+    jobject /* this */,
+    jobjectArray pieces
+) {
+    const jsize n = pieces != nullptr ? env->GetArrayLength(pieces) : 0;
+    jclass string_class = env->FindClass("java/lang/String");
+    jobjectArray out = env->NewObjectArray(n + 1, string_class, nullptr);
+    env->DeleteLocalRef(string_class);
+    if (out == nullptr) return nullptr;
+
+    Utf8Assembler utf8;
+    std::string chars;
+    std::string scratch;
+    std::vector<char> bytes;
+    for (jsize i = 0; i <= n; i++) {
+        chars.clear();
+        if (i < n) {
+            jbyteArray piece = (jbyteArray) env->GetObjectArrayElement(pieces, i);
+            const jsize len = piece != nullptr ? env->GetArrayLength(piece) : 0;
+            bytes.resize(len);
+            if (len > 0) env->GetByteArrayRegion(piece, 0, len, (jbyte*) bytes.data());
+            if (piece != nullptr) env->DeleteLocalRef(piece);
+            utf8.feed(bytes.data(), bytes.size(), chars);
+        } else {
+            utf8.flush(chars);
+        }
+        jstring s = new_string_utf8(env, chars.data(), chars.size(), scratch);
+        env->SetObjectArrayElement(out, i, s);
+        env->DeleteLocalRef(s);
+    }
+    return out;
+}
+
+// The bytes a Java string reaches the tokenizer as. Lets tests check that supplementary
+// characters arrive as standard 4-byte UTF-8.
+JNIEXPORT jbyteArray JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_encodeUtf8(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring text
+) {
+    const std::string bytes = get_string(env, text);
+    jbyteArray out = env->NewByteArray((jsize) bytes.size());
+    if (out != nullptr) {
+        env->SetByteArrayRegion(out, 0, (jsize) bytes.size(), (const jbyte*) bytes.data());
+    }
+    return out;
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_formatChat(
+    JNIEnv* env,
+    jobject /* this */,
+    jobjectArray roles,
+    jobjectArray contents,
+    jboolean addAssistant
+) {
+    if (g_model == nullptr) return nullptr;
+    
+    const std::vector<std::string> role_strs = get_string_array(env, roles);
+    const std::vector<std::string> content_strs = get_string_array(env, contents);
+    if (role_strs.size() != content_strs.size()) {
+        LOGE("formatChat: %zu roles for %zu messages", role_strs.size(), content_strs.size());
+        return nullptr;
+    }
+    
+    std::vector<llama_chat_message> messages;
+    messages.reserve(role_strs.size());
+    for (size_t i = 0; i < role_strs.size(); i++) {
+        messages.push_back({role_strs[i].c_str(), content_strs[i].c_str()});
+    }
+    
+    std::string formatted;
+    if (!apply_chat_template(messages, addAssistant == JNI_TRUE, formatted)) {
+        return nullptr;
+    }
+    std::string scratch;
+    return new_string_utf8(env, formatted.data(), formatted.size(), scratch);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setSpecialTokenExceptions(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean allowEog,
+    jobjectArray allowed
+) {
+    // The mask is read by every sampling step, so it only changes while nothing generates
+    if (g_is_generating.exchange(true)) return JNI_FALSE;
+    g_allow_eog_tokens = allowEog == JNI_TRUE;
+    g_allowed_special = get_string_array(env, allowed);
+    
+    // Rebuild the mask for the loaded model; otherwise it is built by the next loadModel
+    if (g_vocab != nullptr) build_special_token_mask();
+    g_is_generating = false;
+    return JNI_TRUE;
+}
+
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setParallelTokenization(
+    JNIEnv* env,
+    jobject /* this */,
+    jint mode
+) {
+    if (mode < kParallelTokenizeOff || mode > kParallelTokenizeVerify) {
+        LOGE("Unknown parallel tokenization mode %d", mode);
+        return;
+    }
+    g_parallel_tokenize_mode = mode;
+}
+
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setRepetitionPolicy(
+    JNIEnv* env,
+    jobject /* this */,
+    jint policy
+) {
+    if (policy < kRepetitionOff || policy > kRepetitionPenalize) {
+        LOGE("Unknown repetition policy %d", policy);
+        return;
+    }
+    g_repetition_policy = policy;
+}
+
+// Builds the subset from a profiling corpus plus the required tokens and caches it at
+// `cachePath`. Returns the subset size, or -1.
+JNIEXPORT jint JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_buildVocabSubset(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring corpus,
+    jstring cachePath
+) {
+    if (g_model == nullptr || g_vocab == nullptr) return -1;
+    // Sampling reads the subset on the generation thread
+    if (g_is_generating.exchange(true)) return -1;
+    
+    std::vector<int32_t> tokens = tokenize_prompt(get_string(env, corpus), false);
+    const size_t n_corpus = tokens.size();
+    add_required_subset_tokens(tokens);
+    g_vocab_subset.build(tokens, llama_vocab_n_tokens(g_vocab), model_fingerprint());
+    LOGI("Vocab subset: %zu of %d tokens (%zu corpus tokens)", g_vocab_subset.size(),
+         llama_vocab_n_tokens(g_vocab), n_corpus);
+    
+    const std::string path = get_string(env, cachePath);
+    if (!path.empty() && !g_vocab_subset.save(path)) {
+        LOGE("Could not write vocab subset cache %s", path.c_str());
+    }
+    const jint size = (jint) g_vocab_subset.size();
     g_is_generating = false;
+    return size;
+}
+
+// Loads a subset cached by buildVocabSubset for the loaded model.
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_loadVocabSubset(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring cachePath
+) {
+    if (g_model == nullptr || g_vocab == nullptr) return JNI_FALSE;
+    if (g_is_generating.exchange(true)) return JNI_FALSE;
     
-    return env->NewStringUTF(response.c_str());
+    const bool loaded = g_vocab_subset.load(get_string(env, cachePath),
+                                            llama_vocab_n_tokens(g_vocab), model_fingerprint());
+    if (loaded) {
+        LOGI("Vocab subset loaded: %zu tokens", g_vocab_subset.size());
+    } else {
+        g_vocab_subset.clear();
+    }
+    g_is_generating = false;
+    return loaded ? JNI_TRUE : JNI_FALSE;
 }
 
-// ============================================================================
-// Model Info
-// ============================================================================
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setVocabSubsetEnabled(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean enabled
+) {
+    g_vocab_subset_enabled = enabled == JNI_TRUE;
+}
+
+// Teacher-forced comparison of full-vocabulary and subset sampling on a local text: how
+// often the next token is covered, greedy agreement, perplexity on covered positions and
+// the per-token sampling cost of both.
 JNIEXPORT jstring JNICALL
-Java_com_dannyk_xirea_ai_LlamaCpp_getModelInfo(
+Java_com_dannyk_xirea_ai_LlamaCpp_evaluateVocabSubset(
     JNIEnv* env,
-    jobject /* this */
+    jobject /* this */,
+    jstring text
 ) {
-    if (g_model == nullptr || g_vocab == nullptr) {
-        return env->NewStringUTF("{}");
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    if (g_vocab_subset.empty()) {
+        return env->NewStringUTF("{\"error\":\"No vocab subset\"}");
     }
     
-    char buf[256];
-    llama_model_desc(g_model, buf, sizeof(buf));
+    // Decode cost per token of the last real generation, to translate sampling savings
+    const GenerationStats last = last_stats();
+    const double decode_us_per_token = last.n_generated > 0
+        ? (double) last.decode_us / last.n_generated : 0.0;
+    
+    std::vector<llama_token> tokens = tokenize_prompt(get_string(env, text), true);
+    if ((int) tokens.size() > g_context_size) tokens.resize(g_context_size);
+    if (tokens.size() < 2) {
+        return env->NewStringUTF("{\"error\":\"Evaluation text too short\"}");
+    }
+    
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    llama_memory_t mem = llama_get_memory(g_ctx);
+    if (mem) llama_memory_clear(mem, true);
+    ScopedThreadPriority priority;
+    
+    const int n_vocab = llama_vocab_n_tokens(g_vocab);
+    const int n_tokens = (int) tokens.size();
+    // Every position needs its logits row; keep the output buffer small on 256k vocabs
+    const int chunk = std::min(g_batch_size, 32);
+    std::vector<float> sub(g_vocab_subset.size());
+    
+    auto log_sum_exp = [](const float* row, int n, float max) {
+        double sum = 0.0;
+        for (int i = 0; i < n; i++) sum += std::exp((double) row[i] - max);
+        return max + std::log(sum);
+    };
+    
+    int n_eval = 0, n_covered = 0, n_agree = 0;
+    double nll_full = 0.0, nll_full_covered = 0.0, nll_subset_covered = 0.0;
+    int64_t full_us = 0, subset_us = 0;
+    bool ok = true;
+    
+    for (int start = 0; start < n_tokens - 1 && ok; start += chunk) {
+        if (g_stop_generation_id.load() == local_id) break;
+        const int n = std::min(chunk, n_tokens - 1 - start);
+        batch_clear();
+        for (int i = 0; i < n; i++) batch_add(tokens[start + i], start + i, true);
+        if (llama_decode(g_ctx, g_batch) != 0) {
+            ok = false;
+            break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            const float* logits = llama_get_logits_ith(g_ctx, i);
+            const llama_token target = tokens[start + i + 1];
+            
+            int64_t t0 = now_us();
+            const int32_t full_pick = argmax(logits, n_vocab);
+            full_us += now_us() - t0;
+            
+            t0 = now_us();
+            g_vocab_subset.gather(logits, sub.data());
+            const int32_t sub_idx = argmax(sub.data(), (int) sub.size());
+            subset_us += now_us() - t0;
+            if (full_pick < 0 || sub_idx < 0) continue;     // no finite logit at this position
+            const int32_t sub_pick = g_vocab_subset.ids()[sub_idx];
+            
+            const double full_lse = log_sum_exp(logits, n_vocab, logits[full_pick]);
+            nll_full += full_lse - logits[target];
+            n_eval++;
+            n_agree += full_pick == sub_pick;
+            if (g_vocab_subset.contains(target)) {
+                const double sub_lse = log_sum_exp(sub.data(), (int) sub.size(), logits[sub_pick]);
+                nll_full_covered += full_lse - logits[target];
+                nll_subset_covered += sub_lse - logits[target];
+                n_covered++;
+            }
+        }
+    }
+    if (mem) llama_memory_clear(mem, true);
+    end_generation(local_id);
+    if (!ok || n_eval == 0) {
+        return env->NewStringUTF("{\"error\":\"Evaluation decode failed\"}");
+    }
+    
+    const double full_sample_us = (double) full_us / n_eval;
+    const double subset_sample_us = (double) subset_us / n_eval;
+    // The measured sampling cost can exceed the recorded decode cost (another model, or a
+    // tiny last generation); clamp so the estimate stays positive
+    auto tps = [&](double sample_us) {
+        if (decode_us_per_token <= 0.0) return 0.0;
+        const double us = std::max(decode_us_per_token - full_sample_us, 0.0) + sample_us;
+        return us > 0.0 ? 1e6 / us : 0.0;
+    };
+    auto ppl = [](double nll, int n) { return n > 0 ? std::exp(nll / n) : 0.0; };
     
     std::string info = "{";
-    info += "\"description\":\"" + std::string(buf) + "\",";
-    info += "\"n_params\":" + std::to_string(llama_model_n_params(g_model)) + ",";
-    info += "\"n_vocab\":" + std::to_string(llama_vocab_n_tokens(g_vocab)) + ",";
-    info += "\"n_ctx_train\":" + std::to_string(llama_model_n_ctx_train(g_model)) + ",";
-    info += "\"n_ctx\":" + std::to_string(g_context_size) + ",";
-    info += "\"n_batch\":" + std::to_string(g_batch_size) + ",";
-    info += "\"n_threads\":" + std::to_string(g_n_threads);
+    info += "\"subset_size\":" + std::to_string(g_vocab_subset.size()) + ",";
+    info += "\"n_vocab\":" + std::to_string(n_vocab) + ",";
+    info += "\"n_eval\":" + std::to_string(n_eval) + ",";
+    info += "\"coverage\":" + std::to_string((double) n_covered / n_eval) + ",";
+    info += "\"greedy_agreement\":" + std::to_string((double) n_agree / n_eval) + ",";
+    info += "\"ppl_full\":" + std::to_string(ppl(nll_full, n_eval)) + ",";
+    info += "\"ppl_full_covered\":" + std::to_string(ppl(nll_full_covered, n_covered)) + ",";
+    info += "\"ppl_subset_covered\":" + std::to_string(ppl(nll_subset_covered, n_covered)) + ",";
+    info += "\"full_sample_us\":" + std::to_string(full_sample_us) + ",";
+    info += "\"subset_sample_us\":" + std::to_string(subset_sample_us) + ",";
+    info += "\"est_decode_tps_full\":" + std::to_string(tps(full_sample_us)) + ",";
+    info += "\"est_decode_tps_subset\":" + std::to_string(tps(subset_sample_us));
     info += "}";
     
     return env->NewStringUTF(info.c_str());
 }
 
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setThreadAffinity(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean pinToPerformanceCores
+) {
+    g_pin_threads = pinToPerformanceCores == JNI_TRUE;
+    request_threadpool_reset();     // workers take the mask at creation
+    LOGI("Thread affinity: %s", g_pin_threads ? "performance cores" : "any core");
+}
+
+// Fixes the thread counts (0 keeps the current value) and turns off calibration at load.
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setThreadCounts(
+    JNIEnv* env,
+    jobject /* this */,
+    jint prefillThreads,
+    jint decodeThreads
+) {
+    if (prefillThreads > 0) g_n_threads_prefill = std::min((int) prefillThreads, kMaxThreads);
+    if (decodeThreads > 0) g_n_threads_decode = std::min((int) decodeThreads, kMaxThreads);
+    g_calibrate_threads = false;
+    g_calibration_pending = false;
+    if (g_ctx != nullptr && !g_is_generating.load()) apply_thread_counts();
+    LOGI("Thread counts: prefill=%d, decode=%d", g_n_threads_prefill.load(),
+         g_n_threads_decode.load());
+}
+
+// Runs the calibration (and re-enables it for later loads). Holds the model lock like
+// autotune(); cancelAutotune(), loadModel and unloadModel stop it early.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_calibrateThreads(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    std::lock_guard<std::mutex> model_lock(g_model_mutex);
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    g_calibrate_threads = true;
+    g_autotune_cancel = false;
+    calibrate_threads();
+    g_autotune_cancel = false;
+    end_generation(local_id);
+    return env->NewStringUTF(thread_calibration_json().c_str());
+}
+
+// Greedy generation of `prompt` under three placements: every core unpinned (the old
+// default), one thread per performance core, and the same pinned to those cores.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_benchmarkThreadPlacement(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring prompt,
+    jint maxTokens
+) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    if (g_is_generating.load()) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    
+    struct Placement {
+        const char* name;
+        int n_threads;
+        bool pin;
+    };
+    const int all_cores = std::min(cpu_topology().n_cores(), kMaxThreads);
+    const Placement placements[] = {
+        {"all_cores", all_cores, false},
+        {"performance_cores", g_n_threads, false},
+        {"performance_pinned", g_n_threads, true},
+    };
+    
+    GenerationRequest req;
+    req.prompt = get_string(env, prompt);
+    req.max_tokens = maxTokens;
+    req.sampler.params = kDefaultSamplerParams;
+    req.sampler.params.temp = 0.0f;
+    req.governed = false;
+    
+    const bool saved_pin = g_pin_threads;
+    std::string info = "{";
+    info += "\"n_cores\":" + std::to_string(cpu_topology().n_cores()) + ",";
+    info += "\"n_performance_cores\":" + std::to_string(cpu_topology().n_performance()) + ",";
+    info += "\"results\":[";
+    double baseline_tps = 0.0;
+    for (size_t i = 0; i < sizeof(placements) / sizeof(placements[0]); i++) {
+        const Placement& p = placements[i];
+        const uint64_t local_id = begin_generation();
+        if (local_id == 0) break;
+        g_pin_threads = p.pin;
+        reset_threadpools();
+        llama_set_n_threads(g_ctx, p.n_threads, p.n_threads);
+        DiscardSink sink;
+        const GenerationResult result = run_generation(req, local_id, sink);
+        end_generation(local_id);
+        
+        const GenerationStats st = last_stats();
+        const double prefill_tps = st.prefill_us > 0 ? st.n_prompt * 1e6 / st.prefill_us : 0.0;
+        const double decode_tps = st.decode_us > 0 ? st.n_generated * 1e6 / st.decode_us : 0.0;
+        if (i == 0) baseline_tps = decode_tps;
+        if (i > 0) info += ",";
+        info += "{\"placement\":\"" + std::string(p.name) + "\",";
+        info += "\"n_threads\":" + std::to_string(p.n_threads) + ",";
+        info += "\"pinned\":" + std::string(st.pinned ? "true" : "false") + ",";
+        info += "\"threads_prefill\":" + std::to_string(st.n_threads_prefill) + ",";
+        info += "\"threads_decode\":" + std::to_string(st.n_threads_decode) + ",";
+        info += "\"ok\":" + std::string(result == kGenCompleted ? "true" : "false") + ",";
+        info += "\"prefill_tps\":" + std::to_string(prefill_tps) + ",";
+        info += "\"decode_tps\":" + std::to_string(decode_tps) + ",";
+        info += "\"decode_speedup\":" +
+                std::to_string(baseline_tps > 0.0 ? decode_tps / baseline_tps : 0.0) + "}";
+    }
+    info += "]}";
+    g_pin_threads = saved_pin;
+    request_threadpool_reset();
+    apply_thread_counts();
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Forces a CPU backend variant by name (null or empty = best runnable) and loads it. Only
+// without a loaded model; false if the variant is unknown, not runnable here or missing.
+// Holds the model lock so a concurrent loadModel cannot see the backend half swapped.
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setCpuVariant(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring variant
+) {
+    std::lock_guard<std::mutex> model_lock(g_model_mutex);
+    if (g_model != nullptr || g_is_generating.load()) return JNI_FALSE;
+    const std::string name = variant != nullptr ? get_string(env, variant) : std::string();
+#ifndef XIREA_CPU_VARIANTS
+    // Single linked backend: only the default can be "forced"
+    return name.empty() || name == "builtin" ? JNI_TRUE : JNI_FALSE;
+#else
+    unload_cpu_backend();
+    g_forced_cpu_variant = name;
+    if (load_cpu_backend()) return JNI_TRUE;
+    g_forced_cpu_variant.clear();
+    load_cpu_backend();
+    return JNI_FALSE;
+#endif
+}
+
+// Variants this device can run, most capable first, as a JSON string.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_getCpuVariants(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    const uint32_t features = detect_cpu_features();
+    std::string info = "{";
+    info += "\"features\":\"" + cpu_feature_names(features) + "\",";
+    info += "\"loaded\":\"" + g_cpu_variant + "\",";
+    info += "\"runnable\":[";
+#ifdef XIREA_CPU_VARIANTS
+    const std::vector<CpuVariant> runnable = runnable_cpu_variants(host_cpu_arch(), features, "");
+    for (size_t i = 0; i < runnable.size(); i++) {
+        if (i > 0) info += ",";
+        info += "\"" + std::string(runnable[i].name) + "\"";
+    }
+#else
+    info += "\"builtin\"";
+#endif
+    info += "]}";
+    return env->NewStringUTF(info.c_str());
+}
+
+// Turns the thermal governor on or off and sets its temperature thresholds (Celsius).
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setThermalGovernor(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean enabled,
+    jfloat hotCelsius,
+    jfloat coolCelsius
+) {
+    g_governor_enabled = enabled == JNI_TRUE;
+    std::lock_guard<std::mutex> lock(g_governor_config_mutex);
+    if (hotCelsius > 0.0f) g_governor_config.hot_c = hotCelsius;
+    if (coolCelsius > 0.0f) g_governor_config.cool_c = std::min((float) coolCelsius, g_governor_config.hot_c);
+    LOGI("Thermal governor: %s (hot %.1f C, cool %.1f C)", enabled == JNI_TRUE ? "on" : "off",
+         g_governor_config.hot_c, g_governor_config.cool_c);
+}
+
+// Persistent worker pools on or off, their poll level (0..100) and ggml_sched_priority.
+JNIEXPORT jboolean JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setThreadPool(
+    JNIEnv* env,
+    jobject /* this */,
+    jboolean enabled,
+    jint poll,
+    jint priority
+) {
+    if (g_is_generating.exchange(true)) return JNI_FALSE;
+    ThreadPoolPolicy policy;
+    policy.enabled = enabled == JNI_TRUE;
+    policy.poll = std::max(0, std::min((int) poll, 100));
+    policy.priority = std::max((int) GGML_SCHED_PRIO_LOW,
+                               std::min((int) priority, (int) GGML_SCHED_PRIO_REALTIME));
+    set_pool_policy(policy);
+    reset_threadpools();
+    g_is_generating = false;
+    LOGI("Threadpool: %s (poll %d, priority %d)", threadpool_name(policy), policy.poll,
+         policy.priority);
+    return JNI_TRUE;
+}
+
+// Greedy generation of `prompt` with per-graph workers and with pools that sleep, poll
+// (the ggml default) and spin between tokens. Reports throughput, inter-token latency
+// and the CPU time each token costs.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_benchmarkThreadPool(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring prompt,
+    jint maxTokens
+) {
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    if (g_is_generating.load()) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    
+    const ThreadPoolPolicy policies[] = {
+        {false, 0, GGML_SCHED_PRIO_NORMAL},
+        {true, 0, GGML_SCHED_PRIO_NORMAL},
+        {true, 50, GGML_SCHED_PRIO_NORMAL},
+        {true, 100, GGML_SCHED_PRIO_NORMAL},
+    };
+    
+    GenerationRequest req;
+    req.prompt = get_string(env, prompt);
+    req.max_tokens = maxTokens;
+    req.sampler.params = kDefaultSamplerParams;
+    req.sampler.params.temp = 0.0f;
+    req.governed = false;
+    
+    const ThreadPoolPolicy saved_policy = pool_policy();
+    std::string info = "{";
+    info += "\"n_threads_decode\":" + std::to_string(g_n_threads_decode) + ",";
+    info += "\"results\":[";
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        const uint64_t local_id = begin_generation();
+        if (local_id == 0) break;
+        set_pool_policy(policies[i]);
+        reset_threadpools();
+        DiscardSink sink;
+        const GenerationResult result = run_generation(req, local_id, sink);
+        end_generation(local_id);
+        
+        const GenerationStats st = last_stats();
+        const double decode_tps = st.decode_us > 0 ? st.n_generated * 1e6 / st.decode_us : 0.0;
+        const double cpu_ms = st.n_generated > 0 ? st.decode_cpu_us / 1000.0 / st.n_generated : 0.0;
+        if (i > 0) info += ",";
+        info += "{\"threadpool\":\"" + std::string(st.threadpool) + "\",";
+        info += "\"poll\":" + std::to_string(policies[i].poll) + ",";
+        info += "\"ok\":" + std::string(result == kGenCompleted ? "true" : "false") + ",";
+        info += "\"n_generated\":" + std::to_string(st.n_generated) + ",";
+        info += "\"decode_tps\":" + std::to_string(decode_tps) + ",";
+        info += "\"token_p50_ms\":" + std::to_string(st.token_p50_us / 1000.0) + ",";
+        info += "\"token_p95_ms\":" + std::to_string(st.token_p95_us / 1000.0) + ",";
+        info += "\"cpu_ms_per_token\":" + std::to_string(cpu_ms) + "}";
+    }
+    info += "]}";
+    set_pool_policy(saved_policy);
+    request_threadpool_reset();
+    
+    return env->NewStringUTF(info.c_str());
+}
+
+// Directory for autotune profiles; they are read at load and written by autotune().
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setProfileDir(
+    JNIEnv* env,
+    jobject /* this */,
+    jstring dir
+) {
+    g_profile_dir = dir != nullptr ? get_string(env, dir) : std::string();
+    LOGI("Tune profile dir: %s", g_profile_dir.empty() ? "(disabled)" : g_profile_dir.c_str());
+}
+
+// Sweeps thread counts, batch size and KV cache / flash attention within `budgetMs` and
+// applies the best configuration. Only a sweep that was not cancelled is stored as this
+// model's profile. Blocks, holding the model lock, so loadModel and unloadModel cancel it
+// and wait rather than free the context under it; the KV cache is left empty.
+JNIEXPORT jstring JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_autotune(
+    JNIEnv* env,
+    jobject /* this */,
+    jint budgetMs
+) {
+    std::lock_guard<std::mutex> model_lock(g_model_mutex);
+    if (g_model == nullptr || g_ctx == nullptr || g_vocab == nullptr || !g_batch_initialized) {
+        return env->NewStringUTF("{\"error\":\"Model not loaded\"}");
+    }
+    const uint64_t local_id = begin_generation();
+    if (local_id == 0) {
+        return env->NewStringUTF("{\"error\":\"Generation already in progress\"}");
+    }
+    g_autotune_cancel = false;
+    
+    const int n_prompt = std::min(kAutotunePromptTokens,
+                                  g_context_size - kAutotuneDecodeTokens - 1);
+    const std::vector<llama_token> text =
+        tokenize_prompt("The quick brown fox jumps over the lazy dog. ", false);
+    if (n_prompt < 8 || text.empty()) {
+        end_generation(local_id);
+        return env->NewStringUTF("{\"error\":\"Context too small\"}");
+    }
+    std::vector<llama_token> tokens;
+    while ((int) tokens.size() < n_prompt) tokens.insert(tokens.end(), text.begin(), text.end());
+    
+    TuneSpace space;
+    space.prefill_threads = thread_candidates(false);
+    space.decode_threads = thread_candidates(true);
+    for (int n : {64, 128, 256, 512}) {
+        if (n <= g_context_size) space.batch_sizes.push_back(n);
+    }
+    // A quantized V cache requires flash attention
+    space.kv_flash = {{0, 0}, {0, 1}, {1, 1}};
+    
+    ScopedThreadAffinity affinity(pinned_cpus());
+    ScopedThreadPriority priority;
+    const TuneConfig base = current_tune_config();
+    
+    // Untimed warm-up: the first pass pays for faulting in the mmapped weights
+    double warm_prefill = 0.0, warm_decode = 0.0;
+    measure_throughput(tokens, 8, 1, warm_prefill, warm_decode);
+    
+    auto measure = [&](const TuneConfig& config, double& prefill_tps, double& decode_tps) {
+        return apply_tune_config(config) &&
+               measure_throughput(tokens, n_prompt, kAutotuneDecodeTokens, prefill_tps, decode_tps);
+    };
+    TuneTrial best;
+    std::vector<TuneTrial> trials;
+    const int64_t t_start = now_us();
+    const TuneResult result = Autotuner::run(base, space, measure,
+                                             (int64_t) std::max(0, (int) budgetMs) * 1000,
+                                             g_autotune_cancel, now_us, best, &trials);
+    const bool ok = result != kTuneFailed;
+    const int64_t total_us = now_us() - t_start;
+    
+    bool saved = false;
+    if (ok && apply_tune_config(best.config)) {
+        // A cancelled sweep's best is kept for this session only
+        g_tune_source = result == kTuneFinished ? "autotune" : "partial";
+        TuneProfile profile;
+        profile.model_fingerprint = model_fingerprint();
+        profile.cpu_signature = cpu_topology().signature();
+        profile.best = best;
+        saved = profile.save_result(result, g_profile_dir);
+    } else {
+        apply_tune_config(base);
+    }
+    park_threadpools();
+    const bool cancelled = g_autotune_cancel.exchange(false);
+    end_generation(local_id);
+    LOGI("Autotune: %zu trials in %lld ms%s, best %.0f ms per reference request", trials.size(),
+         (long long) (total_us / 1000), cancelled ? " (cancelled)" : "", best.score_ms);
+    
+    std::string info = "{";
+    info += "\"ok\":" + std::string(ok ? "true" : "false") + ",";
+    info += "\"cancelled\":" + std::string(cancelled ? "true" : "false") + ",";
+    info += "\"saved\":" + std::string(saved ? "true" : "false") + ",";
+    info += "\"autotune_ms\":" + std::to_string(total_us / 1000) + ",";
+    info += "\"best\":" + tune_config_json(best.config) + ",";
+    info += "\"best_score_ms\":" + std::to_string(best.score_ms) + ",";
+    info += "\"trials\":[";
+    for (size_t i = 0; i < trials.size(); i++) {
+        if (i > 0) info += ",";
+        info += "{\"config\":" + tune_config_json(trials[i].config) + ",";
+        info += "\"prefill_tps\":" + std::to_string(trials[i].prefill_tps) + ",";
+        info += "\"decode_tps\":" + std::to_string(trials[i].decode_tps) + ",";
+        info += "\"score_ms\":" + std::to_string(trials[i].score_ms) + "}";
+    }
+    info += "]}";
+    return env->NewStringUTF(info.c_str());
+}
+
+// Makes a running autotune() stop after the current graph and keep the best so far for
+// this session, without saving it. A running calibrateThreads() stops after the current
+// candidate.
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_cancelAutotune(
+    JNIEnv* env,
+    jobject /* this */
+) {
+    g_autotune_cancel = true;
+}
+
+JNIEXPORT void JNICALL
+Java_com_dannyk_xirea_ai_LlamaCpp_setPrefillLatencyTarget(
+    JNIEnv* env,
+    jobject /* this */,
+    jint targetMs
+) {
+    g_prefill_target_ms = std::max(0, (int) targetMs);
+    LOGI("Prefill step latency target: %d ms", g_prefill_target_ms.load());
+}
+
 JNIEXPORT jlong JNICALL
 Java_com_dannyk_xirea_ai_LlamaCpp_getContextSize(
     JNIEnv* env,
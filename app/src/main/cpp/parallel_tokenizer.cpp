@@ -0,0 +1,86 @@
+#include "parallel_tokenizer.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+bool is_space(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Characters after which a following " word" always starts a new pre-token.
+bool is_prose_end(unsigned char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) return true;
+    switch (c) {
+        case '.': case ',': case ';': case ':': case '!': case '?': case ')': case '"': case '\'':
+            return true;
+        default:
+            return c >= 0x80;   // inside or at the end of a non-ASCII character
+    }
+}
+
+// Cutting before text[i] is safe: a single space that ends a whitespace run.
+bool is_boundary(const char* text, size_t n, size_t i) {
+    if (i == 0 || i + 1 >= n || text[i] != ' ') return false;
+    const unsigned char prev = (unsigned char) text[i - 1];
+    const unsigned char next = (unsigned char) text[i + 1];
+    return !is_space(next) && (is_prose_end(prev) || (is_space(prev) && prev != '\n' && prev != '\r'));
+}
+
+}  // namespace
+
+std::vector<size_t> ParallelTokenizer::split_points(const char* text, size_t n, int n_chunks) {
+    std::vector<size_t> cuts;
+    n_chunks = (int) std::min<size_t>(std::max(1, n_chunks), n / kMinChunkBytes);
+    if (n_chunks < 2) return cuts;
+
+    const size_t target = n / n_chunks;
+    size_t last = 0;
+    for (int c = 1; c < n_chunks; c++) {
+        size_t i = std::max(last + kMinChunkBytes, target * c);
+        while (i < n && !is_boundary(text, n, i)) i++;
+        if (n - i < kMinChunkBytes) break;
+        cuts.push_back(i);
+        last = i;
+    }
+    return cuts;
+}
+
+int ParallelTokenizer::tokenize(const std::string& text, bool add_special, int n_threads,
+                                const Tokenizer& tokenize_chunk, std::vector<int32_t>& out) {
+    const std::vector<size_t> cuts = split_points(text.data(), text.size(), n_threads);
+    if (cuts.empty()) {
+        return tokenize_chunk(text.data(), text.size(), add_special, out) ? 1 : 0;
+    }
+
+    std::vector<size_t> bounds;
+    bounds.reserve(cuts.size() + 2);
+    bounds.push_back(0);
+    bounds.insert(bounds.end(), cuts.begin(), cuts.end());
+    bounds.push_back(text.size());
+
+    const size_t n_chunks = bounds.size() - 1;
+    std::vector<std::vector<int32_t>> parts(n_chunks);
+    std::vector<char> ok(n_chunks, 0);
+    auto run = [&](size_t c) {
+        ok[c] = tokenize_chunk(text.data() + bounds[c], bounds[c + 1] - bounds[c],
+                               add_special && c == 0, parts[c]);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(n_chunks - 1);
+    for (size_t c = 1; c < n_chunks; c++) workers.emplace_back(run, c);
+    run(0);
+    for (std::thread& t : workers) t.join();
+
+    size_t total = 0;
+    for (size_t c = 0; c < n_chunks; c++) {
+        if (!ok[c]) return 0;
+        total += parts[c].size();
+    }
+    out.clear();
+    out.reserve(total);
+    for (const std::vector<int32_t>& part : parts) out.insert(out.end(), part.begin(), part.end());
+    return (int) n_chunks;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Parallel chunked tokenization for long inputs
+// ============================================================================
+// Long pasted texts are cut at boundaries no BPE pre-tokenizer merges across and the chunks
+// are tokenized on worker threads, then concatenated. A boundary sits right before a single
+// space that ends a whitespace run and follows ordinary prose (a letter, digit or closing
+// punctuation): GPT-2, Llama 3 and Qwen style pre-tokenizers all start a new piece there
+// (" word"), and no special token can end there. Tokenizers that are not pre-split, such
+// as SentencePiece with its added space prefix, are caught by verification instead.
+class ParallelTokenizer {
+public:
+    // Tokenizes text[0, n) into `out` (replacing its contents); false on failure.
+    using Tokenizer =
+        std::function<bool(const char* text, size_t n, bool add_special, std::vector<int32_t>& out)>;
+
+    // Chunks smaller than this are not worth a thread.
+    static constexpr size_t kMinChunkBytes = 4096;
+
+    // Cut offsets (excluding 0 and n) for at most `n_chunks` chunks of roughly equal size.
+    static std::vector<size_t> split_points(const char* text, size_t n, int n_chunks);
+
+    // Tokenizes on up to `n_threads` threads (the calling thread included). Only the first
+    // chunk gets `add_special`. Returns the number of chunks used, 0 on failure.
+    static int tokenize(const std::string& text, bool add_special, int n_threads,
+                        const Tokenizer& tokenize_chunk, std::vector<int32_t>& out);
+};
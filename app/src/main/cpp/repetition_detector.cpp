@@ -0,0 +1,42 @@
+#include "repetition_detector.h"
+
+#include <algorithm>
+
+void RepetitionDetector::reset(int capacity) {
+    tokens_.clear();
+    prefix_.assign(1, 0);
+    pow_.assign(1, 1);
+    tokens_.reserve(capacity);
+    prefix_.reserve(capacity + 1);
+    pow_.reserve(capacity + 1);
+}
+
+int RepetitionDetector::push(int32_t token) {
+    tokens_.push_back(token);
+    prefix_.push_back(prefix_.back() * kBase + (uint64_t) (token + 1));
+    pow_.push_back(pow_.back() * kBase);
+
+    const int n = (int) tokens_.size();
+    for (int p = 1; p <= kMaxPeriod; p++) {
+        const int repeats = std::max(kMinRepeats, (kMinSpan + p - 1) / p);
+        if (p * repeats > n) {
+            if (p * kMinRepeats > n) break;
+            continue;
+        }
+        const uint64_t last = hash(n - p, n);
+        bool periodic = true;
+        for (int r = 2; r <= repeats && periodic; r++) {
+            periodic = hash(n - r * p, n - (r - 1) * p) == last;
+        }
+        if (periodic && verify(p, repeats)) return p;
+    }
+    return 0;
+}
+
+bool RepetitionDetector::verify(int p, int repeats) const {
+    const int n = (int) tokens_.size();
+    for (int i = n - repeats * p; i < n - p; i++) {
+        if (tokens_[i] != tokens_[i + p]) return false;
+    }
+    return true;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// ============================================================================
+// Repetition detection
+// ============================================================================
+// Small quantized models often get stuck repeating a phrase. The detector keeps polynomial
+// prefix hashes of the generated tokens so any n-gram hash is O(1). After each token it
+// checks every period p <= kMaxPeriod for the last `repeats` blocks of length p being
+// identical, i.e. the output has become periodic. Hashes only screen candidates: a hash
+// hit is confirmed by comparing the tokens, so a collision cannot end a healthy generation.
+class RepetitionDetector {
+public:
+    static constexpr int kMaxPeriod = 64;      // longest repeating unit (tokens) to look for
+    static constexpr int kMinRepeats = 3;      // unit must occur this many times in a row
+    static constexpr int kMinSpan = 32;        // ...and cover at least this many tokens
+    static constexpr uint64_t kBase = 1000003ULL;
+
+    void reset(int capacity);
+
+    // Records a token; returns the detected loop period or 0.
+    int push(int32_t token);
+
+    // The token that would continue a loop of the given period
+    int32_t predicted_next(int period) const {
+        return tokens_[tokens_.size() - period];
+    }
+
+private:
+    uint64_t hash(int begin, int end) const {
+        return prefix_[end] - prefix_[begin] * pow_[end - begin];
+    }
+
+    // tokens [n - repeats * p, n) really have period p
+    bool verify(int p, int repeats) const;
+
+    std::vector<int32_t> tokens_;
+    std::vector<uint64_t> prefix_;
+    std::vector<uint64_t> pow_;
+};
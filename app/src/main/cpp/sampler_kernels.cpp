@@ -0,0 +1,277 @@
+#include "sampler_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+const int kBlock = 16;
+
+// True if any of the 16 floats at `p` is greater than `thr`.
+inline bool block_exceeds(const float* p, float thr) {
+#if defined(__aarch64__)
+    const float32x4_t t = vdupq_n_f32(thr);
+    uint32x4_t m = vcgtq_f32(vld1q_f32(p), t);
+    m = vorrq_u32(m, vcgtq_f32(vld1q_f32(p + 4), t));
+    m = vorrq_u32(m, vcgtq_f32(vld1q_f32(p + 8), t));
+    m = vorrq_u32(m, vcgtq_f32(vld1q_f32(p + 12), t));
+    return vmaxvq_u32(m) != 0;
+#elif defined(__SSE2__)
+    const __m128 t = _mm_set1_ps(thr);
+    __m128 m = _mm_cmpgt_ps(_mm_loadu_ps(p), t);
+    m = _mm_or_ps(m, _mm_cmpgt_ps(_mm_loadu_ps(p + 4), t));
+    m = _mm_or_ps(m, _mm_cmpgt_ps(_mm_loadu_ps(p + 8), t));
+    m = _mm_or_ps(m, _mm_cmpgt_ps(_mm_loadu_ps(p + 12), t));
+    return _mm_movemask_ps(m) != 0;
+#else
+    for (int i = 0; i < kBlock; i++) {
+        if (p[i] > thr) return true;
+    }
+    return false;
+#endif
+}
+
+// Fixed-size candidate set that keeps the k largest values seen so far.
+struct TopK {
+    int k;
+    int count = 0;
+    int min_pos = 0;
+    float threshold = -INFINITY;          // smallest kept value once full
+    int32_t* ids;
+    float* vals;
+
+    void offer(int32_t id, float v) {
+        if (!(v > threshold)) return;
+        if (count < k) {
+            ids[count] = id;
+            vals[count] = v;
+            count++;
+            if (count == k) update_min();
+            return;
+        }
+        ids[min_pos] = id;
+        vals[min_pos] = v;
+        update_min();
+    }
+
+    // Evicts the largest index among equal minima so ties keep the lower index.
+    void update_min() {
+        min_pos = 0;
+        for (int i = 1; i < count; i++) {
+            if (vals[i] < vals[min_pos] || (vals[i] == vals[min_pos] && ids[i] > ids[min_pos])) {
+                min_pos = i;
+            }
+        }
+        threshold = vals[min_pos];
+    }
+};
+
+}  // namespace
+
+int select_top_k(const float* logits, int n, int k, int32_t* out_ids, float* out_logits) {
+    if (k <= 0 || n <= 0) return 0;
+    k = std::min(k, n);
+
+    TopK top{k, 0, 0, -INFINITY, out_ids, out_logits};
+
+    int i = 0;
+    for (; i + kBlock <= n; i += kBlock) {
+        if (!block_exceeds(logits + i, top.threshold)) continue;
+        for (int j = i; j < i + kBlock; j++) top.offer(j, logits[j]);
+    }
+    for (; i < n; i++) top.offer(i, logits[i]);
+
+    // Largest first, lower index on ties (insertion sort, k is small)
+    for (int j = 1; j < top.count; j++) {
+        const int32_t id = out_ids[j];
+        const float v = out_logits[j];
+        int p = j;
+        while (p > 0 &&
+               (out_logits[p - 1] < v || (out_logits[p - 1] == v && out_ids[p - 1] > id))) {
+            out_ids[p] = out_ids[p - 1];
+            out_logits[p] = out_logits[p - 1];
+            p--;
+        }
+        out_ids[p] = id;
+        out_logits[p] = v;
+    }
+    return top.count;
+}
+
+float max_logit(const float* logits, int n) {
+    float best = -INFINITY;
+    int i = 0;
+#if defined(__aarch64__)
+    float32x4_t m0 = vdupq_n_f32(-INFINITY);
+    float32x4_t m1 = m0;
+    for (; i + 8 <= n; i += 8) {
+        m0 = vmaxnmq_f32(m0, vld1q_f32(logits + i));
+        m1 = vmaxnmq_f32(m1, vld1q_f32(logits + i + 4));
+    }
+    best = vmaxnmvq_f32(vmaxnmq_f32(m0, m1));
+#elif defined(__SSE2__)
+    // _mm_max_ps returns its second operand when either is NaN, so NaNs never win
+    __m128 m0 = _mm_set1_ps(-INFINITY);
+    __m128 m1 = m0;
+    for (; i + 8 <= n; i += 8) {
+        m0 = _mm_max_ps(_mm_loadu_ps(logits + i), m0);
+        m1 = _mm_max_ps(_mm_loadu_ps(logits + i + 4), m1);
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_max_ps(m0, m1));
+    best = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+#endif
+    for (; i < n; i++) {
+        if (logits[i] > best) best = logits[i];
+    }
+    return best;
+}
+
+float select_min_p(const float* logits, int n, float min_p, std::vector<int32_t>& out_ids) {
+    const float log_min_p = std::log(std::max(min_p, 1e-30f));
+    float best = -INFINITY;
+    float thr = -INFINITY;
+    const size_t first = out_ids.size();
+
+    // Blocks entirely below the current threshold are skipped without touching their
+    // elements; the threshold only rises, so stale survivors are compacted once at the end
+    int i = 0;
+    for (; i + kBlock <= n; i += kBlock) {
+        if (!block_exceeds(logits + i, std::nextafter(thr, -INFINITY))) continue;
+        for (int j = i; j < i + kBlock; j++) {
+            const float v = logits[j];
+            if (!(v >= thr) || v == -INFINITY) continue;
+            if (v > best) {
+                best = v;
+                thr = best + log_min_p;
+            }
+            out_ids.push_back(j);
+        }
+    }
+    for (; i < n; i++) {
+        const float v = logits[i];
+        if (!(v >= thr) || v == -INFINITY) continue;
+        if (v > best) {
+            best = v;
+            thr = best + log_min_p;
+        }
+        out_ids.push_back(i);
+    }
+
+    size_t kept = first;
+    for (size_t j = first; j < out_ids.size(); j++) {
+        if (logits[out_ids[j]] >= thr) out_ids[kept++] = out_ids[j];
+    }
+    out_ids.resize(kept);
+    return best;
+}
+
+int32_t argmax(const float* logits, int n) {
+    if (n <= 0) return -1;
+
+    // Pass 1: the maximum value
+    const float best = max_logit(logits, n);
+    if (!(best > -INFINITY)) return -1;
+
+    // Pass 2: its first position
+    int i = 0;
+    const float below = std::nextafter(best, -INFINITY);
+    while (i + kBlock <= n && !block_exceeds(logits + i, below)) i += kBlock;
+    for (; i < n; i++) {
+        if (logits[i] == best) return i;
+    }
+    return -1;
+}
+
+FusedSampler::FusedSampler(const SamplerParams& params, uint32_t seed)
+    : params_(params), seed_(seed) {
+    params_.top_k = std::max(1, std::min(params_.top_k, kMaxTopK));
+    ids_.resize(params_.top_k);
+    logits_.resize(params_.top_k);
+    weights_.resize(params_.top_k);
+    reset();
+}
+
+void FusedSampler::reset() {
+    current_seed_ = seed_ == kRandomSeed ? std::random_device()() : seed_;
+    rng_.seed(current_seed_);
+}
+
+int32_t FusedSampler::sample(const float* logits, int n) {
+    return params_.min_p > 0.0f ? sample_min_p(logits, n) : sample_top_k(logits, n);
+}
+
+int32_t FusedSampler::sample_top_k(const float* logits, int n) {
+    const int k = select_top_k(logits, n, params_.top_k, ids_.data(), logits_.data());
+    if (k == 0) return -1;
+    if (params_.temp <= 0.0f || k == 1) return ids_[0];
+
+    // Nucleus cut on the untempered distribution, as llama's top_p stage does
+    int m = k;
+    if (params_.top_p < 1.0f) {
+        double sum = 0.0;
+        for (int i = 0; i < k; i++) {
+            weights_[i] = std::exp((double) logits_[i] - logits_[0]);
+            sum += weights_[i];
+        }
+        double cum = 0.0;
+        for (int i = 0; i < k; i++) {
+            cum += weights_[i];
+            if (cum >= params_.top_p * sum) {
+                m = i + 1;
+                break;
+            }
+        }
+    }
+
+    // Tempered draw over the survivors
+    const double inv_temp = 1.0 / params_.temp;
+    double total = 0.0;
+    for (int i = 0; i < m; i++) {
+        weights_[i] = std::exp(((double) logits_[i] - logits_[0]) * inv_temp);
+        total += weights_[i];
+    }
+    const double u = uniform() * total;
+    double acc = 0.0;
+    for (int i = 0; i < m; i++) {
+        acc += weights_[i];
+        if (u < acc) return ids_[i];
+    }
+    return ids_[m - 1];
+}
+
+// Min-p draws straight from the survivors in index order: no sort, no top-k.
+int32_t FusedSampler::sample_min_p(const float* logits, int n) {
+    survivors_.clear();
+    const float best = select_min_p(logits, n, params_.min_p, survivors_);
+    if (survivors_.empty()) return -1;
+    if (survivors_.size() == 1) return survivors_[0];
+    if (params_.temp <= 0.0f) {
+        // The maximum is always a survivor; the first one in index order wins ties
+        for (int32_t id : survivors_) {
+            if (logits[id] == best) return id;
+        }
+        return survivors_[0];
+    }
+
+    const double inv_temp = 1.0 / params_.temp;
+    weights_.resize(std::max(weights_.size(), survivors_.size()));
+    double total = 0.0;
+    for (size_t i = 0; i < survivors_.size(); i++) {
+        weights_[i] = std::exp(((double) logits[survivors_[i]] - best) * inv_temp);
+        total += weights_[i];
+    }
+    const double u = uniform() * total;
+    double acc = 0.0;
+    for (size_t i = 0; i < survivors_.size(); i++) {
+        acc += weights_[i];
+        if (u < acc) return survivors_[i];
+    }
+    return survivors_.back();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// ============================================================================
+// Fused sampling kernels over a raw logits row
+// ============================================================================
+// One SIMD threshold scan over the vocabulary finds the top-k candidates; softmax, the
+// nucleus cut and the draw then run over those k only. No full-vocabulary candidate array
+// is ever built. std::mt19937 is fully specified and the scan order is fixed, so a seeded
+// run is reproducible on the same device and build; the weights go through std::exp, whose
+// results differ between libm implementations, so other builds may draw differently.
+
+struct SamplerParams {
+    int top_k = 20;
+    float top_p = 0.85f;
+    float temp = 0.6f;
+    float min_p = 0.0f;                     // > 0 selects min-p instead of top-k/top-p
+};
+
+// Writes the indices of the `k` largest logits to `out_ids`, largest first (ties keep the
+// lower index). -inf and NaN logits are never selected. Returns the number written.
+int select_top_k(const float* logits, int n, int k, int32_t* out_ids, float* out_logits);
+
+// Largest logit, NaN skipped (-inf if there is none).
+float max_logit(const float* logits, int n);
+
+// Appends to `out_ids` the indices of all logits >= max + log(min_p), i.e. tokens whose
+// probability is at least min_p times the most likely one, in index order. The running
+// maximum is tracked during the same vectorized scan. Returns that maximum.
+float select_min_p(const float* logits, int n, float min_p, std::vector<int32_t>& out_ids);
+
+// Index of the largest logit (the first one on ties, like llama's greedy sampler), or -1
+// if every logit is -inf or NaN (a fully masked row). Two vectorized passes, no candidate
+// array.
+int32_t argmax(const float* logits, int n);
+
+class FusedSampler {
+public:
+    static constexpr int kMaxTopK = 256;
+    static constexpr uint32_t kRandomSeed = 0xFFFFFFFF;   // same convention as LLAMA_DEFAULT_SEED
+
+    FusedSampler(const SamplerParams& params, uint32_t seed);
+
+    // Restarts the random sequence (a new random seed if constructed with kRandomSeed).
+    void reset();
+
+    // Index into `logits` of the sampled entry, or -1 if every logit is -inf.
+    int32_t sample(const float* logits, int n);
+
+    const SamplerParams& params() const { return params_; }
+    uint32_t seed() const { return seed_; }
+
+    // Seed of the current random sequence (the drawn one for kRandomSeed).
+    uint32_t current_seed() const { return current_seed_; }
+
+private:
+    int32_t sample_top_k(const float* logits, int n);
+    int32_t sample_min_p(const float* logits, int n);
+    double uniform() { return (rng_() >> 8) * (1.0 / 16777216.0); }
+
+    SamplerParams params_;
+    uint32_t seed_;
+    uint32_t current_seed_ = 0;
+    std::mt19937 rng_;
+    std::vector<int32_t> ids_;
+    std::vector<float> logits_;
+    std::vector<double> weights_;
+    std::vector<int32_t> survivors_;
+};
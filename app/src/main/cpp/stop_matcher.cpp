@@ -0,0 +1,103 @@
+#include "stop_matcher.h"
+
+#include <algorithm>
+#include <deque>
+
+int StopMatcher::add_state() {
+    next_.insert(next_.end(), kAlphabet, -1);
+    depth_.push_back(0);
+    match_len_.push_back(0);
+    return (int) depth_.size() - 1;
+}
+
+void StopMatcher::build(const std::vector<std::string>& patterns) {
+    next_.clear();
+    depth_.clear();
+    match_len_.clear();
+    n_patterns_ = 0;
+    add_state();
+
+    // Trie of all patterns
+    for (const std::string& pattern : patterns) {
+        if (pattern.empty()) continue;
+        int s = 0;
+        for (unsigned char c : pattern) {
+            if (next_[s * kAlphabet + c] < 0) {
+                const int t = add_state();
+                depth_[t] = depth_[s] + 1;
+                next_[s * kAlphabet + c] = t;
+            }
+            s = next_[s * kAlphabet + c];
+        }
+        match_len_[s] = std::max(match_len_[s], (int32_t) pattern.size());
+        n_patterns_++;
+    }
+
+    // Breadth-first failure links, folded into a complete transition table so feeding
+    // a byte is a single lookup.
+    std::vector<int32_t> fail(depth_.size(), 0);
+    std::deque<int> queue;
+    for (int c = 0; c < kAlphabet; c++) {
+        int& t = next_[c];
+        if (t < 0) {
+            t = 0;
+        } else {
+            fail[t] = 0;
+            queue.push_back(t);
+        }
+    }
+    while (!queue.empty()) {
+        const int s = queue.front();
+        queue.pop_front();
+        match_len_[s] = std::max(match_len_[s], match_len_[fail[s]]);
+        for (int c = 0; c < kAlphabet; c++) {
+            int& t = next_[s * kAlphabet + c];
+            if (t < 0) {
+                t = next_[fail[s] * kAlphabet + c];
+            } else {
+                fail[t] = next_[fail[s] * kAlphabet + c];
+                queue.push_back(t);
+            }
+        }
+    }
+
+    reset();
+}
+
+void StopMatcher::reset() {
+    state_ = 0;
+    held_.clear();
+}
+
+bool StopMatcher::feed(const char* data, size_t n, std::string& out) {
+    if (n_patterns_ == 0) {
+        out.append(data, n);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char c = (unsigned char) data[i];
+        state_ = next_[state_ * kAlphabet + c];
+        held_.push_back((char) c);
+
+        if (match_len_[state_] > 0) {
+            // Everything before the match start is real output
+            out.append(held_, 0, held_.size() - match_len_[state_]);
+            held_.clear();
+            return true;
+        }
+
+        // Only the longest suffix that is still a pattern prefix can start a match
+        const size_t keep = (size_t) depth_[state_];
+        if (held_.size() > keep) {
+            const size_t release = held_.size() - keep;
+            out.append(held_, 0, release);
+            held_.erase(0, release);
+        }
+    }
+    return false;
+}
+
+void StopMatcher::flush(std::string& out) {
+    out.append(held_);
+    reset();
+}
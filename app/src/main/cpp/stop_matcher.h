@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Streaming stop-sequence matcher (Aho-Corasick over UTF-8 bytes)
+// ============================================================================
+// Matches any number of stop sequences incrementally over the generated byte stream,
+// including sequences split across token pieces. Only the bytes that could still be the
+// start of a match are held back; everything before them is released immediately.
+class StopMatcher {
+public:
+    // Compiles the automaton. Empty patterns are ignored.
+    void build(const std::vector<std::string>& patterns);
+
+    bool empty() const { return n_patterns_ == 0; }
+
+    // Forgets all held-back bytes and restarts matching from the root.
+    void reset();
+
+    // Feeds generated bytes. Bytes that can no longer be part of a match are appended to
+    // `out`. Returns true once a stop sequence completed; the matched sequence and any
+    // bytes after it are dropped and the matcher must be reset before reuse.
+    bool feed(const char* data, size_t n, std::string& out);
+
+    // Releases the held-back bytes at the end of the stream.
+    void flush(std::string& out);
+
+    size_t held() const { return held_.size(); }
+
+private:
+    static const int kAlphabet = 256;
+
+    int add_state();
+
+    std::vector<int32_t> next_;         // full DFA transition table, kAlphabet per state
+    std::vector<int32_t> depth_;        // length of the prefix each state represents
+    std::vector<int32_t> match_len_;    // longest pattern ending at this state, 0 if none
+    int n_patterns_ = 0;
+    int state_ = 0;
+    std::string held_;                  // last depth_[state_] bytes of the stream
+};
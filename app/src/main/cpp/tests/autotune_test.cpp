@@ -0,0 +1,129 @@
+#include "autotune.h"
+#include "test_util.h"
+
+#include <cmath>
+
+namespace {
+
+// Synthetic device: prefill peaks at 6 threads, decode at 3, batch 256 is best, and a
+// quantized KV cache with flash attention helps decode a little.
+bool fake_measure(const TuneConfig& c, double& prefill_tps, double& decode_tps) {
+    prefill_tps = 100.0 - 4.0 * std::abs(c.n_threads_prefill - 6) + (c.n_batch == 256 ? 20.0 : 0.0);
+    decode_tps = 10.0 - std::abs(c.n_threads_decode - 3) + (c.kv_quantized && c.flash_attn == 1 ? 1.0 : 0.0);
+    return true;
+}
+
+TuneSpace full_space() {
+    TuneSpace space;
+    space.prefill_threads = {4, 6, 8};
+    space.decode_threads = {2, 3, 4};
+    space.batch_sizes = {64, 128, 256};
+    space.kv_flash = {{0, 0}, {0, 1}, {1, 1}};
+    return space;
+}
+
+int64_t fake_now = 0;
+int64_t fake_clock() { return fake_now; }
+
+void finds_best_config() {
+    const std::atomic<bool> cancel{false};
+    TuneTrial best;
+    std::vector<TuneTrial> trials;
+    CHECK(Autotuner::run(TuneConfig(), full_space(), fake_measure, 1000000, cancel, fake_clock,
+                         best, &trials) == kTuneFinished);
+    CHECK(best.config.n_threads_prefill == 6);
+    CHECK(best.config.n_threads_decode == 3);
+    CHECK(best.config.n_batch == 256);
+    CHECK(best.config.kv_quantized == 1 && best.config.flash_attn == 1);
+    // The base (4/4/128) is measured once even though it reappears in the space
+    int base_trials = 0;
+    for (const TuneTrial& t : trials) base_trials += t.config == TuneConfig();
+    CHECK(base_trials == 1);
+}
+
+void respects_budget_and_cancel() {
+    // Every measurement takes 100 ms; a 250 ms budget allows three trials
+    auto slow = [](const TuneConfig& c, double& p, double& d) {
+        fake_now += 100000;
+        return fake_measure(c, p, d);
+    };
+    fake_now = 0;
+    const std::atomic<bool> cancel{false};
+    TuneTrial best;
+    std::vector<TuneTrial> trials;
+    CHECK(Autotuner::run(TuneConfig(), full_space(), slow, 250000, cancel, fake_clock, best,
+                         &trials) == kTuneFinished);
+    CHECK(trials.size() == 3);
+
+    // Cancelled before starting: nothing is measured
+    const std::atomic<bool> cancelled{true};
+    trials.clear();
+    CHECK(Autotuner::run(TuneConfig(), full_space(), fake_measure, 1000000, cancelled, fake_clock,
+                         best, &trials) == kTuneFailed);
+    CHECK(trials.empty());
+}
+
+void cancelled_sweep_is_not_persisted() {
+    // Cancelled once the base is measured, as when the first request arrives
+    std::atomic<bool> cancel{false};
+    auto cancel_after_base = [&cancel](const TuneConfig& c, double& p, double& d) {
+        if (cancel.load()) return false;
+        cancel = true;
+        return fake_measure(c, p, d);
+    };
+    TuneTrial best;
+    std::vector<TuneTrial> trials;
+    const TuneResult result = Autotuner::run(TuneConfig(), full_space(), cancel_after_base, 1000000,
+                                             cancel, fake_clock, best, &trials);
+    CHECK(result == kTuneCancelled);
+    CHECK(trials.size() == 1 && best.config == TuneConfig());
+
+    const std::string dir = make_temp_dir();
+    TuneProfile p;
+    p.model_fingerprint = 0x1234;
+    p.cpu_signature = 0xabcd;
+    p.best = best;
+    CHECK(!p.save_result(result, dir));
+    TuneProfile loaded;
+    CHECK(!loaded.load(TuneProfile::path_for(dir, 0x1234, 0xabcd), 0x1234, 0xabcd));
+    CHECK(!p.save_result(kTuneFailed, dir));
+    CHECK(p.save_result(kTuneFinished, dir));
+    CHECK(loaded.load(TuneProfile::path_for(dir, 0x1234, 0xabcd), 0x1234, 0xabcd));
+    remove_tree(dir);
+}
+
+void profile_round_trip() {
+    const std::string dir = make_temp_dir();
+    TuneProfile p;
+    p.model_fingerprint = 0x1234;
+    p.cpu_signature = 0xabcd;
+    p.best.config.n_threads_prefill = 6;
+    p.best.config.n_threads_decode = 3;
+    p.best.config.n_batch = 256;
+    p.best.config.kv_quantized = 1;
+    p.best.config.flash_attn = 1;
+    p.best.prefill_tps = 120.0;
+    p.best.decode_tps = 11.0;
+    const std::string path = TuneProfile::path_for(dir, p.model_fingerprint, p.cpu_signature);
+    CHECK(p.save(path));
+
+    TuneProfile loaded;
+    CHECK(loaded.load(path, 0x1234, 0xabcd));
+    CHECK(loaded.best.config == p.best.config);
+    CHECK(loaded.best.decode_tps == 11.0);
+    CHECK(!loaded.load(path, 0x1234, 0xabce));     // another device
+    CHECK(!loaded.load(path, 0x1235, 0xabcd));     // another model
+    CHECK(!loaded.load(dir + "/missing.xtun", 0x1234, 0xabcd));
+    remove_tree(dir);
+}
+
+}  // namespace
+
+int main() {
+    finds_best_config();
+    respects_budget_and_cancel();
+    cancelled_sweep_is_not_persisted();
+    profile_round_trip();
+    printf("autotune_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "cpu_features.h"
+#include "test_util.h"
+
+namespace {
+
+std::string best(CpuArch arch, uint32_t features, const std::string& forced = "") {
+    const std::vector<CpuVariant> v = runnable_cpu_variants(arch, features, forced);
+    return v.empty() ? "" : v.front().name;
+}
+
+void arm64_selection() {
+    const uint32_t a53 = kCpuNeon;
+    const uint32_t a55 = kCpuNeon | kCpuDotprod | kCpuFp16;
+    const uint32_t x1 = a55 | kCpuI8mm;
+    const uint32_t x4 = x1 | kCpuSve | kCpuSve2;
+    CHECK(best(CpuArch::Arm64, a53) == "android_armv8.0_1");
+    CHECK(best(CpuArch::Arm64, kCpuNeon | kCpuDotprod) == "android_armv8.2_1");
+    CHECK(best(CpuArch::Arm64, a55) == "android_armv8.2_2");
+    CHECK(best(CpuArch::Arm64, x1) == "android_armv8.6_1");
+    CHECK(best(CpuArch::Arm64, x4) == "android_armv9.0_1");
+    // SVE2 without i8mm cannot use the armv9 build
+    CHECK(best(CpuArch::Arm64, a55 | kCpuSve2) == "android_armv8.2_2");
+
+    // Fallback order: most capable first, down to the baseline
+    const std::vector<CpuVariant> chain = runnable_cpu_variants(CpuArch::Arm64, a55, "");
+    CHECK(chain.size() == 3);
+    CHECK(std::string(chain[2].name) == "android_armv8.0_1");
+    CHECK(cpu_variant_library(chain[0]) == "libggml-cpu-android_armv8.2_2.so");
+}
+
+void x86_selection() {
+    const uint32_t haswell = kCpuSse42 | kCpuAvx | kCpuF16c | kCpuFma | kCpuAvx2 | kCpuBmi2;
+    CHECK(best(CpuArch::X86_64, 0) == "x64");
+    CHECK(best(CpuArch::X86_64, kCpuSse42 | kCpuAvx) == "sandybridge");
+    CHECK(best(CpuArch::X86_64, haswell) == "haswell");
+    CHECK(best(CpuArch::X86_64, haswell | kCpuAvxVnni) == "alderlake");
+    CHECK(best(CpuArch::X86_64, haswell | kCpuAvx512) == "skylakex");
+    CHECK(best(CpuArch::X86_64, haswell | kCpuAvx512 | kCpuAvx512Vbmi | kCpuAvx512Vnni |
+                                    kCpuAvxVnni) == "icelake");
+    CHECK(best(CpuArch::Other, haswell).empty());
+}
+
+// Every variant can be forced on a CPU that runs it, and none on one that does not.
+void forcing() {
+    const uint32_t all = ~0u;
+    for (CpuArch arch : {CpuArch::Arm64, CpuArch::X86_64}) {
+        for (const CpuVariant& v : cpu_variants(arch)) {
+            const std::vector<CpuVariant> forced = runnable_cpu_variants(arch, all, v.name);
+            CHECK(forced.size() == 1 && std::string(forced[0].name) == v.name);
+        }
+    }
+    CHECK(best(CpuArch::X86_64, kCpuSse42, "haswell").empty());
+    CHECK(best(CpuArch::X86_64, all, "no_such_variant").empty());
+
+    // On this machine: the probe finds a runnable variant, and each variant it covers can
+    // be forced (the baseline always can)
+    const CpuArch arch = host_cpu_arch();
+    const uint32_t features = detect_cpu_features();
+    printf("host features: %s\n", cpu_feature_names(features).c_str());
+    const std::vector<CpuVariant>& variants = cpu_variants(arch);
+    if (!variants.empty()) {
+        CHECK(!runnable_cpu_variants(arch, features, "").empty());
+        CHECK(best(arch, features, variants.front().name) == variants.front().name);
+        for (const CpuVariant& v : variants) {
+            const bool runs = (v.required & features) == v.required;
+            CHECK(best(arch, features, v.name) == (runs ? v.name : ""));
+            printf("  %-18s %s\n", v.name, runs ? "runnable" : "-");
+        }
+    }
+}
+
+void feature_names() {
+    CHECK(cpu_feature_names(0).empty());
+    CHECK(cpu_feature_names(kCpuNeon | kCpuDotprod | kCpuI8mm) == "neon dotprod i8mm");
+    CHECK(cpu_feature_names(kCpuAvx2 | kCpuSse42) == "sse4.2 avx2");
+}
+
+}  // namespace
+
+int main() {
+    arm64_selection();
+    x86_selection();
+    forcing();
+    feature_names();
+    printf("cpu_features_test: OK\n");
+    return 0;
+}
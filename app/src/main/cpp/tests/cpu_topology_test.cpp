@@ -0,0 +1,126 @@
+#include "cpu_topology.h"
+#include "test_util.h"
+
+#include <pthread.h>
+#include <sys/resource.h>
+#include <thread>
+
+namespace {
+
+void add_cpu(const std::string& root, int id, long freq_khz, long capacity, long cluster) {
+    const std::string dir = "cpu" + std::to_string(id);
+    if (freq_khz > 0) write_file(root, dir + "/cpufreq/cpuinfo_max_freq", std::to_string(freq_khz) + "\n");
+    if (capacity > 0) write_file(root, dir + "/cpu_capacity", std::to_string(capacity) + "\n");
+    if (cluster >= 0) write_file(root, dir + "/topology/cluster_id", std::to_string(cluster) + "\n");
+}
+
+// 1 prime + 3 big + 4 little, ranked by frequency only
+void tri_cluster_by_frequency() {
+    const std::string root = make_temp_dir();
+    for (int i = 0; i < 4; i++) add_cpu(root, i, 2000000, 0, 0);
+    for (int i = 4; i < 7; i++) add_cpu(root, i, 2850000, 0, 1);
+    add_cpu(root, 7, 3200000, 0, 2);
+    write_file(root, "online", "0-7\n");
+
+    const CpuTopology topo = detect_cpu_topology(root, 1);
+    CHECK(topo.n_cores() == 8);
+    CHECK(topo.heterogeneous());
+    CHECK(topo.n_performance() == 4);
+    CHECK((topo.performance_cpus() == std::vector<int>{4, 5, 6, 7}));
+    CHECK(topo.cores[7].cluster == 2);
+
+    // Same tree, same signature; a different prime core clock is another device
+    CHECK(detect_cpu_topology(root, 1).signature() == topo.signature());
+    add_cpu(root, 7, 3300000, 0, 2);
+    CHECK(detect_cpu_topology(root, 1).signature() != topo.signature());
+    remove_tree(root);
+}
+
+// cpu_capacity wins over frequency when every core reports it
+void capacity_preferred() {
+    const std::string root = make_temp_dir();
+    add_cpu(root, 0, 1800000, 400, 0);
+    add_cpu(root, 1, 1800000, 400, 0);
+    add_cpu(root, 2, 1800000, 1024, 1);     // same max freq, bigger core
+    add_cpu(root, 3, 1800000, 1024, 1);
+
+    const CpuTopology topo = detect_cpu_topology(root, 1);
+    CHECK(topo.n_cores() == 4);
+    CHECK((topo.performance_cpus() == std::vector<int>{2, 3}));
+    remove_tree(root);
+}
+
+// Only online cores count; a uniform SoC has no efficiency cores
+void online_list_and_uniform() {
+    const std::string root = make_temp_dir();
+    for (int i = 0; i < 6; i++) add_cpu(root, i, 2400000, 0, 0);
+    write_file(root, "online", "0-1,3,5\n");
+
+    const CpuTopology topo = detect_cpu_topology(root, 1);
+    CHECK(topo.n_cores() == 4);
+    CHECK(!topo.heterogeneous());
+    CHECK((topo.performance_cpus() == std::vector<int>{0, 1, 3, 5}));
+    remove_tree(root);
+}
+
+// No readable sysfs: identical fallback cores
+void unreadable_root() {
+    const CpuTopology topo = detect_cpu_topology("/nonexistent/xirea", 6);
+    CHECK(topo.n_cores() == 6);
+    CHECK(topo.n_performance() == 6);
+}
+
+// The mask is applied and restored, and threads created meanwhile inherit it
+void scoped_affinity() {
+    cpu_set_t before;
+    CHECK(sched_getaffinity(0, sizeof(before), &before) == 0);
+    int first = -1;
+    for (int c = 0; c < CPU_SETSIZE && first < 0; c++) {
+        if (CPU_ISSET(c, &before)) first = c;
+    }
+    CHECK(first >= 0);
+    {
+        ScopedThreadAffinity pin({first});
+        CHECK(pin.active());
+        int inherited = -1;
+        std::thread([&inherited] {
+            cpu_set_t set;
+            CHECK(sched_getaffinity(0, sizeof(set), &set) == 0);
+            inherited = CPU_COUNT(&set) == 1 ? 1 : 0;
+        }).join();
+        CHECK(inherited == 1);
+    }
+    cpu_set_t after;
+    CHECK(sched_getaffinity(0, sizeof(after), &after) == 0);
+    CHECK(CPU_EQUAL(&before, &after));
+}
+
+void scoped_priority() {
+    // What ggml does for GGML_SCHED_PRIO_LOW; needs no privileges either way
+    int before = -1;
+    sched_param param{};
+    CHECK(pthread_getschedparam(pthread_self(), &before, &param) == 0);
+    const int nice_before = getpriority(PRIO_PROCESS, 0);
+    {
+        ScopedThreadPriority priority;
+        sched_param low{};
+        CHECK(pthread_setschedparam(pthread_self(), SCHED_BATCH, &low) == 0);
+    }
+    int after = -1;
+    CHECK(pthread_getschedparam(pthread_self(), &after, &param) == 0);
+    CHECK(after == before);
+    CHECK(getpriority(PRIO_PROCESS, 0) == nice_before);
+}
+
+}  // namespace
+
+int main() {
+    tri_cluster_by_frequency();
+    capacity_preferred();
+    online_list_and_uniform();
+    unreadable_root();
+    scoped_affinity();
+    scoped_priority();
+    printf("cpu_topology_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "grammar_dfa.h"
+#include "test_util.h"
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+namespace {
+
+// True if `text` is a complete sentence of the compiled grammar.
+bool accepts(GrammarDfa& dfa, const std::string& text) {
+    const int state = dfa.step(dfa.start(), text.data(), text.size());
+    return state != GrammarDfa::kDead && dfa.accepting(state);
+}
+
+bool compiles(GrammarDfa& dfa, const std::string& gbnf) {
+    std::string error;
+    const bool ok = dfa.compile(gbnf, "root", error);
+    CHECK(ok == error.empty());
+    return ok;
+}
+
+void acceptance() {
+    GrammarDfa dfa;
+    CHECK(compiles(dfa, "root ::= answer \" \" num\n"
+                        "answer ::= \"yes\" | \"no\"\n"
+                        "num ::= [0-9]{1,3} (\".\" [0-9]+)?\n"));
+    CHECK(accepts(dfa, "yes 7"));
+    CHECK(accepts(dfa, "no 123.45"));
+    CHECK(!accepts(dfa, "yes"));                // prefix, alive but not accepting
+    CHECK(dfa.step(dfa.start(), "ye", 2) != GrammarDfa::kDead);
+
+    // Non-ASCII literals and the any-character class
+    CHECK(compiles(dfa, "root ::= \"\\u00e9\" . [\\u00fc]"));
+    CHECK(accepts(dfa, "\xC3\xA9" "x" "\xC3\xBC"));
+    CHECK(accepts(dfa, "\xC3\xA9" "\xE2\x82\xAC" "\xC3\xBC"));
+}
+
+void rejection() {
+    GrammarDfa dfa;
+    CHECK(compiles(dfa, "root ::= \"a\" [bc]* \"d\""));
+    CHECK(!accepts(dfa, "ad" "x"));
+    CHECK(dfa.step(dfa.start(), "ax", 2) == GrammarDfa::kDead);
+    CHECK(!accepts(dfa, "d"));
+
+    // Malformed, undefined and recursive grammars do not compile
+    CHECK(!compiles(dfa, "root ::= \"a"));
+    CHECK(!compiles(dfa, "root ::= missing"));
+    CHECK(!compiles(dfa, "root ::= \"(\" root \")\" | \"x\""));
+}
+
+void state_cap() {
+    // "the 13th byte from the end is an a" needs 2^13 DFA states
+    GrammarDfa dfa;
+    CHECK(!compiles(dfa, "root ::= [ab]* \"a\" [ab]{12}"));
+    std::string error;
+    CHECK(!dfa.compile("root ::= [ab]* \"a\" [ab]{12}", "root", error));
+    CHECK(error.find("DFA states") != std::string::npos);
+
+    // The same shape with a short tail stays under the cap, fully determinized
+    CHECK(compiles(dfa, "root ::= [ab]* \"a\" [ab]{4}"));
+    CHECK(dfa.n_states() <= GrammarDfa::kMaxDfaStates);
+    const int n = dfa.n_states();
+    CHECK(accepts(dfa, "bbabbbb"));
+    CHECK(!accepts(dfa, "bbbbbbb"));
+    CHECK(dfa.n_states() == n);
+
+    // A failed compile leaves the object reusable
+    CHECK(!compiles(dfa, "root ::= [ab]* \"a\" [ab]{12}"));
+    CHECK(compiles(dfa, "root ::= \"ok\""));
+    CHECK(accepts(dfa, "ok"));
+}
+
+void token_masks() {
+    GrammarDfa dfa;
+    CHECK(compiles(dfa, "root ::= \"ab\" | \"ac\""));
+    const std::vector<std::string> pieces = {"a", "ab", "b", "c", "", "<eos>"};
+    GrammarTokenMasks masks(&dfa, &pieces, {5});
+
+    const uint64_t* m = masks.mask(dfa.start());
+    CHECK(m[0] == 0b000011);                    // "a", "ab"
+
+    const int s = masks.advance(dfa.start(), 0);
+    CHECK(masks.mask(s)[0] == 0b001100);        // "b", "c"
+
+    const int end = masks.advance(s, 3);
+    CHECK(dfa.accepting(end));
+    CHECK(masks.mask(end)[0] == 0b100000);      // only end of generation
+    CHECK(masks.n_built() == 3);
+
+    float logits[6] = {1, 2, 3, 4, 5, 6};
+    apply_token_mask(masks.mask(s), logits, 6);
+    CHECK(std::isinf(logits[0]) && std::isinf(logits[1]));
+    CHECK(logits[2] == 3 && logits[3] == 4);
+    CHECK(std::isinf(logits[5]));
+}
+
+}  // namespace
+
+int main() {
+    acceptance();
+    rejection();
+    state_cap();
+    token_masks();
+    printf("grammar_dfa_test: OK\n");
+    return 0;
+}
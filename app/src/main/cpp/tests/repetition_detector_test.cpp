@@ -0,0 +1,97 @@
+#include "repetition_detector.h"
+#include "test_util.h"
+
+#include <vector>
+
+namespace {
+
+// Pushes `tokens` and returns the period reported for the last one; every earlier token
+// must report none.
+int feed(RepetitionDetector& det, const std::vector<int32_t>& tokens) {
+    int period = 0;
+    for (size_t i = 0; i < tokens.size(); i++) {
+        period = det.push(tokens[i]);
+        if (i + 1 < tokens.size()) CHECK(period == 0);
+    }
+    return period;
+}
+
+void periodic() {
+    // Period 5 needs 7 repeats (35 tokens) to cover the minimum span
+    RepetitionDetector det;
+    det.reset(256);
+    std::vector<int32_t> tokens = {900, 901};
+    for (int i = 0; i < 35; i++) tokens.push_back(10 + i % 5);
+    CHECK(feed(det, tokens) == 5);
+    CHECK(det.predicted_next(5) == 10 + 35 % 5);
+
+    // A single repeated token
+    det.reset(64);
+    CHECK(feed(det, std::vector<int32_t>(32, 7)) == 1);
+
+    // A long unit only needs three repeats
+    det.reset(256);
+    std::vector<int32_t> unit;
+    for (int i = 0; i < 40; i++) unit.push_back(100 + i);
+    std::vector<int32_t> loop;
+    for (int r = 0; r < 3; r++) loop.insert(loop.end(), unit.begin(), unit.end());
+    CHECK(feed(det, loop) == 40);
+}
+
+void non_periodic() {
+    RepetitionDetector det;
+    det.reset(512);
+    uint32_t x = 12345;
+    for (int i = 0; i < 500; i++) {
+        x = x * 1103515245u + 12345u;
+        CHECK(det.push((int32_t) (x >> 16) % 5000) == 0);
+    }
+}
+
+void near_miss() {
+    // 31 identical tokens then a different one: one short of the span, then broken
+    RepetitionDetector det;
+    det.reset(64);
+    std::vector<int32_t> tokens(31, 3);
+    tokens.push_back(4);
+    CHECK(feed(det, tokens) == 0);
+
+    // Two full repeats of a 20-token unit are not enough
+    det.reset(64);
+    std::vector<int32_t> twice;
+    for (int r = 0; r < 2; r++) {
+        for (int i = 0; i < 20; i++) twice.push_back(50 + i);
+    }
+    twice.push_back(50);
+    CHECK(feed(det, twice) == 0);
+}
+
+// Blocks A = (5, 1000010) and B = (6, 7) hash alike for p = 2 with the detector's base
+// (5 * kBase + 1000011 == 6 * kBase + 8 with token + 1 hashed). Arranged in Thue-Morse
+// order, which never repeats any word three times in a row, every span of the hash check
+// collides while the tokens have no period at all.
+void hash_collision_is_rejected() {
+    CHECK(5 * RepetitionDetector::kBase + 1000011 == 6 * RepetitionDetector::kBase + 8);
+    RepetitionDetector det;
+    det.reset(512);
+    for (int i = 0; i < 128; i++) {
+        const bool b = __builtin_popcount(i) & 1;
+        CHECK(det.push(b ? 6 : 5) == 0);
+        CHECK(det.push(b ? 7 : 1000010) == 0);
+    }
+    // A real loop afterwards is still found
+    int period = 0;
+    for (int i = 0; i < 32 && period == 0; i++) period = det.push(i % 4 == 0 ? 6 : 7 + i % 4);
+    CHECK(period == 4);
+}
+
+}  // namespace
+
+int main() {
+    periodic();
+    non_periodic();
+    near_miss();
+    hash_collision_is_rejected();
+    printf("repetition_detector_test: OK\n");
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "sampler_kernels.h"
+#include "test_util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Deterministic logits in [0, 64) with plenty of ties.
+std::vector<float> random_row(int n, uint32_t x) {
+    std::vector<float> row(n);
+    for (float& v : row) {
+        x = x * 1664525u + 1013904223u;
+        v = (float) ((x >> 20) % 64);
+    }
+    return row;
+}
+
+// Brute-force reference: indices sorted by value desc, index asc, finite only.
+std::vector<int32_t> reference_order(const std::vector<float>& row) {
+    std::vector<int32_t> ids;
+    for (int i = 0; i < (int) row.size(); i++) {
+        if (row[i] > -INFINITY) ids.push_back(i);
+    }
+    std::stable_sort(ids.begin(), ids.end(), [&](int32_t a, int32_t b) { return row[a] > row[b]; });
+    return ids;
+}
+
+void top_k_matches_reference() {
+    for (int n : {1, 15, 16, 17, 100, 1000}) {
+        const std::vector<float> row = random_row(n, (uint32_t) n);
+        const std::vector<int32_t> ref = reference_order(row);
+        for (int k : {1, 5, 40}) {
+            std::vector<int32_t> ids(k);
+            std::vector<float> vals(k);
+            const int got = select_top_k(row.data(), n, k, ids.data(), vals.data());
+            CHECK(got == std::min(k, n));
+            for (int i = 0; i < got; i++) {
+                CHECK(ids[i] == ref[i]);
+                CHECK(vals[i] == row[ref[i]]);
+            }
+        }
+    }
+}
+
+void ties_keep_the_lower_index() {
+    std::vector<float> row(48, 1.0f);
+    row[40] = 2.0f;
+    int32_t ids[3];
+    float vals[3];
+    CHECK(select_top_k(row.data(), (int) row.size(), 3, ids, vals) == 3);
+    CHECK(ids[0] == 40 && ids[1] == 0 && ids[2] == 1);
+    row[40] = 1.0f;
+    CHECK(argmax(row.data(), (int) row.size()) == 0);
+    row[33] = 3.0f;
+    row[45] = 3.0f;
+    CHECK(argmax(row.data(), (int) row.size()) == 33);
+}
+
+void top_k_larger_than_row() {
+    const float row[5] = {1.0f, -INFINITY, 3.0f, NAN, 2.0f};
+    int32_t ids[10];
+    float vals[10];
+    CHECK(select_top_k(row, 5, 10, ids, vals) == 3);
+    CHECK(ids[0] == 2 && ids[1] == 4 && ids[2] == 0);
+    CHECK(select_top_k(row, 5, 0, ids, vals) == 0);
+    CHECK(select_top_k(row, 0, 10, ids, vals) == 0);
+}
+
+void all_masked_rows() {
+    for (float fill : {-INFINITY, NAN}) {
+        const std::vector<float> row(37, fill);
+        int32_t ids[4];
+        float vals[4];
+        CHECK(select_top_k(row.data(), (int) row.size(), 4, ids, vals) == 0);
+        CHECK(argmax(row.data(), (int) row.size()) == -1);
+        CHECK(max_logit(row.data(), (int) row.size()) == -INFINITY);
+        std::vector<int32_t> survivors;
+        select_min_p(row.data(), (int) row.size(), 0.1f, survivors);
+        CHECK(survivors.empty());
+
+        SamplerParams params;
+        FusedSampler top_k(params, 1);
+        CHECK(top_k.sample(row.data(), (int) row.size()) == -1);
+        params.min_p = 0.05f;
+        FusedSampler min_p(params, 1);
+        CHECK(min_p.sample(row.data(), (int) row.size()) == -1);
+    }
+    CHECK(argmax(nullptr, 0) == -1);
+}
+
+void min_p_edges() {
+    const std::vector<float> row = random_row(300, 3);
+    const float best = *std::max_element(row.begin(), row.end());
+
+    // min_p 1: exactly the tied maxima, in index order
+    std::vector<int32_t> survivors;
+    CHECK(select_min_p(row.data(), (int) row.size(), 1.0f, survivors) == best);
+    CHECK(!survivors.empty());
+    for (size_t i = 0; i < survivors.size(); i++) {
+        CHECK(row[survivors[i]] == best);
+        if (i > 0) CHECK(survivors[i] > survivors[i - 1]);
+    }
+    size_t n_best = 0;
+    for (float v : row) n_best += v == best;
+    CHECK(survivors.size() == n_best);
+
+    // Tiny min_p keeps every finite logit; appends after what is already there
+    std::vector<float> masked = row;
+    masked[7] = -INFINITY;
+    masked[250] = NAN;
+    survivors.assign(1, -5);
+    select_min_p(masked.data(), (int) masked.size(), 1e-30f, survivors);
+    CHECK(survivors.size() == masked.size() - 1);
+    CHECK(survivors[0] == -5);
+
+    // Matches the threshold definition
+    const float min_p = 0.1f;
+    survivors.clear();
+    select_min_p(row.data(), (int) row.size(), min_p, survivors);
+    std::vector<int32_t> expected;
+    for (int i = 0; i < (int) row.size(); i++) {
+        if (row[i] >= best + std::log(min_p)) expected.push_back(i);
+    }
+    CHECK(survivors == expected);
+}
+
+void seeded_runs_repeat() {
+    const std::vector<float> row = random_row(500, 11);
+    for (float min_p : {0.0f, 0.05f}) {
+        SamplerParams params;
+        params.temp = 1.0f;
+        params.top_p = 0.95f;
+        params.min_p = min_p;
+        FusedSampler a(params, 42);
+        FusedSampler b(params, 42);
+        std::vector<int32_t> first;
+        bool varied = false;
+        for (int i = 0; i < 64; i++) {
+            const int32_t id = a.sample(row.data(), (int) row.size());
+            CHECK(id == b.sample(row.data(), (int) row.size()));
+            CHECK(id >= 0 && row[id] > -INFINITY);
+            if (!first.empty() && id != first[0]) varied = true;
+            first.push_back(id);
+        }
+        CHECK(varied);
+        a.reset();
+        for (int i = 0; i < 64; i++) CHECK(a.sample(row.data(), (int) row.size()) == first[i]);
+        CHECK(a.current_seed() == 42);
+    }
+}
+
+void zero_temperature_is_greedy() {
+    const std::vector<float> row = random_row(200, 5);
+    SamplerParams params;
+    params.temp = 0.0f;
+    FusedSampler top_k(params, FusedSampler::kRandomSeed);
+    CHECK(top_k.sample(row.data(), (int) row.size()) == argmax(row.data(), (int) row.size()));
+    params.min_p = 0.2f;
+    FusedSampler min_p(params, FusedSampler::kRandomSeed);
+    CHECK(min_p.sample(row.data(), (int) row.size()) == argmax(row.data(), (int) row.size()));
+}
+
+}  // namespace
+
+int main() {
+    top_k_matches_reference();
+    ties_keep_the_lower_index();
+    top_k_larger_than_row();
+    all_masked_rows();
+    min_p_edges();
+    seeded_runs_repeat();
+    zero_temperature_is_greedy();
+    printf("sampler_kernels_test: OK\n");
+    return 0;
+}
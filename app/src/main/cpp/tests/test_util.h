@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Aborts the test with the failing expression and line.
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                          \
+        }                                                                     \
+    } while (0)
+
+// Fresh empty directory under $TMPDIR (or /tmp) for a fake sysfs tree.
+inline std::string make_temp_dir() {
+    const char* base = getenv("TMPDIR");
+    std::string tmpl = std::string(base != nullptr ? base : "/tmp") + "/xirea_test_XXXXXX";
+    CHECK(mkdtemp(&tmpl[0]) != nullptr);
+    return tmpl;
+}
+
+// Writes `content` to root/rel, creating parent directories.
+inline void write_file(const std::string& root, const std::string& rel, const std::string& content) {
+    std::string path = root;
+    size_t start = 0;
+    for (size_t slash; (slash = rel.find('/', start)) != std::string::npos; start = slash + 1) {
+        path = root + "/" + rel.substr(0, slash);
+        mkdir(path.c_str(), 0755);
+    }
+    FILE* f = fopen((root + "/" + rel).c_str(), "w");
+    CHECK(f != nullptr);
+    fputs(content.c_str(), f);
+    fclose(f);
+}
+
+inline void remove_tree(const std::string& root) {
+    const std::string cmd = "rm -rf '" + root + "'";
+    CHECK(system(cmd.c_str()) == 0);
+}
@@ -0,0 +1,163 @@
+#include "thermal_governor.h"
+#include "test_util.h"
+
+#include <cstring>
+
+namespace {
+
+// Feeds one window of `window_tokens` tokens at `tps` and evaluates it at `temp_c`.
+struct Driver {
+    ThroughputGovernor gov;
+    GovernorConfig config;
+    int64_t now = 0;
+
+    explicit Driver(const GovernorConfig& c) : config(c) { gov.reset(c, now); }
+
+    bool window(double tps, float temp_c, GovernorDecision& d) {
+        bool due = false;
+        for (int i = 0; i < config.window_tokens; i++) {
+            now += (int64_t) (1e6 / tps);
+            due = gov.on_token(now);
+        }
+        CHECK(due);
+        return gov.evaluate(temp_c, d);
+    }
+};
+
+GovernorConfig config(int max_threads, int poll) {
+    GovernorConfig c;
+    c.min_threads = 1;
+    c.max_threads = max_threads;
+    c.poll = poll;
+    c.window_tokens = 8;
+    c.hold_windows = 2;
+    c.poll_hold_windows = 4;
+    return c;
+}
+
+void hot_drops_polling_then_threads() {
+    Driver drv(config(4, 50));
+    GovernorDecision d;
+    CHECK(!drv.window(10.0, 50.0f, d));        // cool, at max: nothing to do
+    CHECK(drv.window(10.0, 80.0f, d));
+    CHECK(strcmp(d.reason, "thermal") == 0 && d.poll == 0 && d.n_threads == 4);
+    CHECK(d.temp_c == 80.0f);
+    CHECK(drv.window(10.0, 80.0f, d));
+    CHECK(d.n_threads == 3 && d.poll == 0);
+    CHECK(drv.window(10.0, 78.0f, d));
+    CHECK(d.n_threads == 2);
+    // Between the thresholds: hold the setting
+    CHECK(!drv.window(10.0, 70.0f, d));
+    CHECK(!drv.window(10.0, 70.0f, d));
+    CHECK(drv.gov.n_threads() == 2 && drv.gov.poll() == 0);
+    // Cooled down: polling comes back first, then threads, each kept if tok/s holds
+    CHECK(drv.window(10.0, 55.0f, d));
+    CHECK(strcmp(d.reason, "cooled") == 0 && d.poll == 50 && d.n_threads == 2);
+    CHECK(drv.window(10.5, 55.0f, d));
+    CHECK(strcmp(d.reason, "probe") == 0 && d.n_threads == 3);
+    CHECK(drv.gov.decisions().size() == 5);
+}
+
+void throttling_without_sensor() {
+    Driver drv(config(4, 0));
+    GovernorDecision d;
+    CHECK(!drv.window(10.0, NAN, d));
+    CHECK(!drv.window(9.5, NAN, d));
+    // A clear drop with no temperature: try one thread fewer
+    CHECK(drv.window(7.0, NAN, d));
+    CHECK(strcmp(d.reason, "throttled") == 0 && d.n_threads == 3);
+    CHECK(std::isnan(d.temp_c));
+    // Same rate with fewer threads: kept, and no probe during the hold
+    CHECK(!drv.window(7.0, NAN, d));
+    CHECK(!drv.window(7.0, NAN, d));
+    CHECK(drv.gov.n_threads() == 3);
+    // After the hold the governor probes back up; a slower window undoes it
+    CHECK(drv.window(7.0, NAN, d));
+    CHECK(strcmp(d.reason, "probe") == 0 && d.n_threads == 4);
+    CHECK(drv.window(6.0, NAN, d));
+    CHECK(strcmp(d.reason, "revert") == 0 && d.n_threads == 3);
+    CHECK(!drv.window(7.0, NAN, d));
+    CHECK(!drv.window(7.0, NAN, d));
+}
+
+void rejected_step_down_is_undone() {
+    Driver drv(config(4, 0));
+    GovernorDecision d;
+    CHECK(!drv.window(10.0, 65.0f, d));
+    CHECK(drv.window(8.0, 65.0f, d));
+    CHECK(strcmp(d.reason, "throttled") == 0 && d.n_threads == 3);
+    CHECK(drv.window(6.0, 65.0f, d));
+    CHECK(strcmp(d.reason, "revert") == 0 && d.n_threads == 4);
+}
+
+void poll_changes_are_spaced() {
+    GovernorConfig c = config(4, 50);
+    c.poll_hold_windows = 6;
+    Driver drv(c);
+    GovernorDecision d;
+    CHECK(drv.window(10.0, 80.0f, d));
+    CHECK(strcmp(d.reason, "thermal") == 0 && d.poll == 0);
+    CHECK(drv.window(10.0, 80.0f, d));
+    CHECK(d.n_threads == 3);
+    CHECK(!drv.window(10.0, 50.0f, d));
+    CHECK(!drv.window(10.0, 50.0f, d));
+    // Cool and past the hold, but the pool was rebuilt 4 windows ago: probe threads only
+    CHECK(drv.window(10.0, 50.0f, d));
+    CHECK(strcmp(d.reason, "probe") == 0 && d.n_threads == 4 && d.poll == 0);
+    CHECK(!drv.window(10.0, 50.0f, d));
+    // The sixth window since the poll change may rebuild the pool again
+    CHECK(drv.window(10.0, 50.0f, d));
+    CHECK(strcmp(d.reason, "cooled") == 0 && d.poll == 50);
+}
+
+void never_below_min_threads() {
+    GovernorConfig c = config(2, 0);
+    c.min_threads = 2;
+    Driver drv(c);
+    GovernorDecision d;
+    CHECK(!drv.window(10.0, 90.0f, d));
+    CHECK(!drv.window(5.0, 90.0f, d));
+    CHECK(drv.gov.n_threads() == 2);
+}
+
+void reads_cpu_zones() {
+    const std::string root = make_temp_dir();
+    write_file(root, "thermal_zone0/type", "battery\n");
+    write_file(root, "thermal_zone0/temp", "90000\n");
+    write_file(root, "thermal_zone1/type", "cpu-1-0-usr\n");
+    write_file(root, "thermal_zone1/temp", "61500\n");
+    write_file(root, "thermal_zone2/type", "soc_thermal\n");
+    write_file(root, "thermal_zone2/temp", "58000\n");
+    write_file(root, "thermal_zone3/type", "CPU-BIG\n");
+    write_file(root, "thermal_zone3/temp", "-273000\n");     // disabled sensor
+    const std::vector<std::string> zones = find_cpu_thermal_zones(root);
+    CHECK(zones.size() == 3);
+    CHECK(hottest_thermal_zone(zones) == root + "/thermal_zone1/temp");
+    CHECK(read_temperature(hottest_thermal_zone(zones)) == 61.5f);
+    CHECK(std::isnan(read_temperature(root + "/thermal_zone3/temp")));
+    remove_tree(root);
+
+    // No CPU-named zone: every zone counts; whole-degree values are accepted
+    const std::string other = make_temp_dir();
+    write_file(other, "thermal_zone0/type", "skin\n");
+    write_file(other, "thermal_zone0/temp", "41\n");
+    CHECK(read_temperature(hottest_thermal_zone(find_cpu_thermal_zones(other))) == 41.0f);
+    remove_tree(other);
+
+    CHECK(find_cpu_thermal_zones(root).empty());
+    CHECK(hottest_thermal_zone({}).empty());
+    CHECK(std::isnan(read_temperature("")));
+}
+
+}  // namespace
+
+int main() {
+    hot_drops_polling_then_threads();
+    throttling_without_sensor();
+    rejected_step_down_is_undone();
+    poll_changes_are_spaced();
+    never_below_min_threads();
+    reads_cpu_zones();
+    printf("thermal_governor_test: OK\n");
+    return 0;
+}
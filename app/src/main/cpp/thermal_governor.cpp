@@ -0,0 +1,167 @@
+#include "thermal_governor.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+
+// Window evaluation, in order:
+//   1. a pending trial is kept if its window reaches keep_ratio of the window before it,
+//      otherwise the previous setting comes back and upward probes pause;
+//   2. above hot_c: poll 0 first, then one thread fewer (mandatory, not trials);
+//   3. tok/s below drop_ratio of the best window since the last change: trial one
+//      thread fewer (throttled cores sustain the same rate with less work);
+//   4. below cool_c or without a sensor, once the hold has passed: trial the configured
+//      poll level, then one thread more.
+// A poll change rebuilds the decode pool, so outside reverts the level moves at most once
+// per poll_hold_windows; while it is held, steps 2 and 4 go straight to the thread count.
+
+void ThroughputGovernor::reset(const GovernorConfig& config, int64_t now_us) {
+    config_ = config;
+    config_.min_threads = std::max(1, std::min(config_.min_threads, config_.max_threads));
+    config_.window_tokens = std::max(1, config_.window_tokens);
+    n_threads_ = config_.max_threads;
+    poll_ = config_.poll;
+    n_tokens_ = 0;
+    window_count_ = 0;
+    poll_age_ = config_.poll_hold_windows;
+    window_start_us_ = now_us;
+    last_token_us_ = now_us;
+    window_tps_ = 0.0;
+    best_tps_ = 0.0;
+    hold_ = 0;
+    trial_ = false;
+    decisions_.clear();
+}
+
+bool ThroughputGovernor::on_token(int64_t now_us) {
+    n_tokens_++;
+    last_token_us_ = now_us;
+    return ++window_count_ >= config_.window_tokens;
+}
+
+bool ThroughputGovernor::change(int n_threads, int poll, bool trial, const char* reason,
+                                GovernorDecision& out) {
+    if (trial) {
+        trial_base_tps_ = window_tps_;
+        trial_prev_threads_ = n_threads_;
+        trial_prev_poll_ = poll_;
+    }
+    trial_ = trial;
+    if (n_threads < n_threads_ || poll < poll_) hold_ = config_.hold_windows;
+    if (poll != poll_) poll_age_ = 0;
+    n_threads_ = n_threads;
+    poll_ = poll;
+    best_tps_ = 0.0;
+
+    out.token = n_tokens_;
+    out.n_threads = n_threads_;
+    out.poll = poll_;
+    out.tps = window_tps_;
+    out.temp_c = window_temp_c_;
+    out.reason = reason;
+    if (decisions_.size() < kMaxDecisions) decisions_.push_back(out);
+    return true;
+}
+
+bool ThroughputGovernor::evaluate(float temp_c, GovernorDecision& out) {
+    const int64_t elapsed = last_token_us_ - window_start_us_;
+    window_tps_ = elapsed > 0 ? window_count_ * 1e6 / elapsed : 0.0;
+    window_temp_c_ = temp_c;
+    window_start_us_ = last_token_us_;
+    window_count_ = 0;
+    const bool holding = hold_ > 0;
+    if (holding) hold_--;
+    poll_age_++;
+    const bool poll_free = poll_age_ >= config_.poll_hold_windows;
+
+    const bool hot = !std::isnan(temp_c) && temp_c >= config_.hot_c;
+    const bool cool = std::isnan(temp_c) || temp_c < config_.cool_c;
+
+    if (trial_) {
+        trial_ = false;
+        if (!hot && window_tps_ < trial_base_tps_ * config_.keep_ratio) {
+            const bool undo_probe = trial_prev_threads_ < n_threads_ || trial_prev_poll_ < poll_;
+            change(trial_prev_threads_, trial_prev_poll_, false, "revert", out);
+            if (undo_probe) hold_ = config_.hold_windows;
+            return true;
+        }
+    }
+    best_tps_ = std::max(best_tps_, window_tps_);
+
+    if (hot) {
+        if (poll_ > 0 && poll_free) return change(n_threads_, 0, false, "thermal", out);
+        if (n_threads_ > config_.min_threads) return change(n_threads_ - 1, poll_, false, "thermal", out);
+        return false;
+    }
+    if (window_tps_ < best_tps_ * config_.drop_ratio && n_threads_ > config_.min_threads) {
+        return change(n_threads_ - 1, poll_, true, "throttled", out);
+    }
+    if (cool && !holding) {
+        if (poll_ < config_.poll && poll_free) return change(n_threads_, config_.poll, true, "cooled", out);
+        if (n_threads_ < config_.max_threads) return change(n_threads_ + 1, poll_, true, "probe", out);
+    }
+    return false;
+}
+
+namespace {
+
+bool is_cpu_zone_type(std::string type) {
+    for (char& c : type) c = (char) tolower((unsigned char) c);
+    for (const char* key : {"cpu", "soc", "cluster", "tsens", "big", "little"}) {
+        if (type.find(key) != std::string::npos) return true;
+    }
+    return false;
+}
+
+}  // namespace
+
+std::vector<std::string> find_cpu_thermal_zones(const std::string& root) {
+    std::vector<std::string> cpu_zones;
+    std::vector<std::string> all_zones;
+    DIR* dir = opendir(root.c_str());
+    if (dir == nullptr) return cpu_zones;
+    while (dirent* e = readdir(dir)) {
+        if (strncmp(e->d_name, "thermal_zone", 12) != 0) continue;
+        const std::string zone = root + "/" + e->d_name;
+        char type[64] = "";
+        if (FILE* f = fopen((zone + "/type").c_str(), "r")) {
+            if (fgets(type, sizeof(type), f) == nullptr) type[0] = '\0';
+            fclose(f);
+        }
+        all_zones.push_back(zone + "/temp");
+        if (is_cpu_zone_type(type)) cpu_zones.push_back(zone + "/temp");
+    }
+    closedir(dir);
+    std::vector<std::string>& zones = cpu_zones.empty() ? all_zones : cpu_zones;
+    std::sort(zones.begin(), zones.end());
+    return zones;
+}
+
+float read_temperature(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == nullptr) return NAN;
+    long value = 0;
+    const bool ok = fscanf(f, "%ld", &value) == 1;
+    fclose(f);
+    if (!ok) return NAN;
+    // Millidegrees on most kernels; a few drivers report whole degrees
+    const float c = value > 1000 || value < -1000 ? value / 1000.0f : (float) value;
+    if (c <= 0.0f || c > 150.0f) return NAN;       // disabled or bogus sensor
+    return c;
+}
+
+std::string hottest_thermal_zone(const std::vector<std::string>& zones) {
+    std::string hottest;
+    float max_c = NAN;
+    for (const std::string& path : zones) {
+        const float c = read_temperature(path);
+        if (std::isnan(c)) continue;
+        if (std::isnan(max_c) || c > max_c) {
+            max_c = c;
+            hottest = path;
+        }
+    }
+    return hottest;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Thermal and throughput governor for sustained generation
+// ============================================================================
+// Phones throttle a few seconds into a long answer, and once they do, every ggml worker
+// (spinning ones most of all) adds heat without adding tok/s. The governor samples decode
+// throughput over windows of generated tokens, plus the hottest CPU thermal zone when one
+// is readable. It moves the active decode thread count and the pool poll level toward the
+// setting that sustains the most tok/s:
+//  - hot: stop spinning, then shed one thread per window until below the hot threshold;
+//  - tok/s fell well below the best since the last change: try one thread fewer;
+//  - cool (or no sensor): restore polling, then probe one thread more.
+// Voluntary moves are trials: the next window must keep the throughput or they are undone.
+// Inputs are plain numbers, so tests drive it with injected timestamps and temperatures.
+struct GovernorConfig {
+    int min_threads = 1;
+    int max_threads = 4;            // the calibrated decode count
+    int poll = 0;                   // poll level when cool, 0 if pools are off
+    int window_tokens = 32;         // tokens per throughput sample
+    float hot_c = 75.0f;            // at or above: shed heat
+    float cool_c = 60.0f;           // below: may add work again
+    double drop_ratio = 0.85;       // window tok/s under this fraction of the best = throttled
+    double keep_ratio = 0.97;       // a trial must keep this fraction of the tok/s before it
+    int hold_windows = 4;           // no upward probe for this many windows after a step down
+    int poll_hold_windows = 8;      // windows between poll changes; each rebuilds the decode pool
+};
+
+struct GovernorDecision {
+    int token = 0;                  // tokens generated when decided
+    int n_threads = 0;
+    int poll = 0;
+    double tps = 0.0;               // window tok/s that led to it
+    float temp_c = NAN;             // NAN if no zone was readable
+    const char* reason = "";        // thermal, throttled, cooled, probe or revert
+};
+
+class ThroughputGovernor {
+public:
+    static const size_t kMaxDecisions = 64;
+
+    void reset(const GovernorConfig& config, int64_t now_us);
+
+    // Counts one generated token; true when a window is complete and evaluate() is due.
+    bool on_token(int64_t now_us);
+
+    // Judges the completed window. `temp_c` is NAN without a sensor. Returns true and
+    // fills `out` when the setting changes.
+    bool evaluate(float temp_c, GovernorDecision& out);
+
+    int n_threads() const { return n_threads_; }
+    int poll() const { return poll_; }
+    const std::vector<GovernorDecision>& decisions() const { return decisions_; }
+
+private:
+    bool change(int n_threads, int poll, bool trial, const char* reason, GovernorDecision& out);
+
+    GovernorConfig config_;
+    int n_threads_ = 0;
+    int poll_ = 0;
+    int n_tokens_ = 0;
+    int window_count_ = 0;
+    int poll_age_ = 0;              // windows since the poll level last changed
+    int64_t window_start_us_ = 0;
+    int64_t last_token_us_ = 0;
+    double window_tps_ = 0.0;
+    float window_temp_c_ = NAN;
+    double best_tps_ = 0.0;         // best window since the last change
+    int hold_ = 0;
+    bool trial_ = false;
+    double trial_base_tps_ = 0.0;
+    int trial_prev_threads_ = 0;
+    int trial_prev_poll_ = 0;
+    std::vector<GovernorDecision> decisions_;
+};
+
+static const char* const kSysfsThermalRoot = "/sys/class/thermal";
+
+// temp files of the thermal zones below `root` whose type names a CPU, SoC or cluster
+// sensor; every zone if none does (battery and skin sensors lag the cores).
+std::vector<std::string> find_cpu_thermal_zones(const std::string& root);
+
+// One zone's temp file in degrees Celsius, NAN if unreadable, disabled or bogus.
+float read_temperature(const std::string& path);
+
+// The hottest readable of `zones`, empty if none is. Resolved once per generation so the
+// decode thread reads a single file per window.
+std::string hottest_thermal_zone(const std::vector<std::string>& zones);
@@ -0,0 +1,125 @@
+#include "utf8_assembler.h"
+
+namespace {
+
+const char kReplacement[] = "\xEF\xBF\xBD";    // U+FFFD
+
+// Length of the sequence a lead byte starts, 0 if it cannot start one.
+size_t sequence_length(unsigned char b) {
+    if (b >= 0xC2 && b <= 0xDF) return 2;
+    if (b >= 0xE0 && b <= 0xEF) return 3;
+    if (b >= 0xF0 && b <= 0xF4) return 4;
+    return 0;
+}
+
+// Second byte ranges that rule out overlong forms, surrogates and code points > U+10FFFF.
+bool valid_second(unsigned char lead, unsigned char b) {
+    switch (lead) {
+        case 0xE0: return b >= 0xA0 && b <= 0xBF;
+        case 0xED: return b >= 0x80 && b <= 0x9F;
+        case 0xF0: return b >= 0x90 && b <= 0xBF;
+        case 0xF4: return b >= 0x80 && b <= 0x8F;
+        default: return (b & 0xC0) == 0x80;
+    }
+}
+
+void append_3byte(unsigned cp, std::string& out) {
+    out += (char) (0xE0 | (cp >> 12));
+    out += (char) (0x80 | ((cp >> 6) & 0x3F));
+    out += (char) (0x80 | (cp & 0x3F));
+}
+
+}  // namespace
+
+void Utf8Assembler::feed(const char* data, size_t n, std::string& out) {
+    const unsigned char* p = (const unsigned char*) data;
+    size_t i = 0;
+    while (i < n) {
+        const unsigned char b = p[i];
+
+        if (n_pending_ == 0) {
+            // ASCII runs are copied in one go
+            if (b < 0x80) {
+                size_t j = i + 1;
+                while (j < n && p[j] < 0x80) j++;
+                out.append(data + i, j - i);
+                i = j;
+                continue;
+            }
+            need_ = sequence_length(b);
+            if (need_ == 0) {
+                out += kReplacement;
+            } else {
+                pending_[n_pending_++] = b;
+            }
+            i++;
+            continue;
+        }
+
+        const bool ok = n_pending_ == 1 ? valid_second(pending_[0], b) : (b & 0xC0) == 0x80;
+        if (!ok) {
+            // Truncated sequence; `b` is looked at again as a fresh start
+            out += kReplacement;
+            n_pending_ = 0;
+            continue;
+        }
+        pending_[n_pending_++] = b;
+        i++;
+        if (n_pending_ == need_) {
+            out.append((const char*) pending_, n_pending_);
+            n_pending_ = 0;
+        }
+    }
+}
+
+void Utf8Assembler::flush(std::string& out) {
+    if (n_pending_ > 0) out += kReplacement;
+    n_pending_ = 0;
+}
+
+void append_modified_utf8(const char* data, size_t n, std::string& out) {
+    const unsigned char* p = (const unsigned char*) data;
+    size_t i = 0;
+    while (i < n) {
+        const unsigned char b = p[i];
+        if (b == 0) {
+            out += "\xC0\x80";
+            i++;
+        } else if (b >= 0xF0 && i + 3 < n) {
+            unsigned cp = ((b & 0x07u) << 18) | ((p[i + 1] & 0x3Fu) << 12) |
+                          ((p[i + 2] & 0x3Fu) << 6) | (p[i + 3] & 0x3Fu);
+            cp -= 0x10000;
+            append_3byte(0xD800 + (cp >> 10), out);
+            append_3byte(0xDC00 + (cp & 0x3FF), out);
+            i += 4;
+        } else {
+            size_t j = i + 1;
+            while (j < n && p[j] != 0 && p[j] < 0xF0) j++;
+            out.append(data + i, j - i);
+            i = j;
+        }
+    }
+}
+
+void append_utf8_from_utf16(const uint16_t* data, size_t n, std::string& out) {
+    size_t i = 0;
+    while (i < n) {
+        unsigned cp = data[i++];
+        if (cp < 0x80) {
+            out += (char) cp;
+        } else if (cp < 0x800) {
+            out += (char) (0xC0 | (cp >> 6));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else if (cp >= 0xD800 && cp <= 0xDBFF && i < n && data[i] >= 0xDC00 && data[i] <= 0xDFFF) {
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (data[i++] - 0xDC00);
+            out += (char) (0xF0 | (cp >> 18));
+            out += (char) (0x80 | ((cp >> 12) & 0x3F));
+            out += (char) (0x80 | ((cp >> 6) & 0x3F));
+            out += (char) (0x80 | (cp & 0x3F));
+        } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+            out += kReplacement;
+        } else {
+            append_3byte(cp, out);
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// ============================================================================
+// Streaming UTF-8 assembly for token pieces
+// ============================================================================
+// Byte-level BPE vocabularies split multi-byte characters (emoji, CJK, Urdu) across tokens.
+// The assembler holds back an incomplete trailing sequence until its continuation bytes
+// arrive, so every chunk it emits is complete, valid UTF-8. Malformed bytes become U+FFFD.
+class Utf8Assembler {
+public:
+    // Appends the complete code points of `data` (plus any finished held sequence) to `out`.
+    void feed(const char* data, size_t n, std::string& out);
+
+    // End of stream: an unfinished sequence is emitted as U+FFFD.
+    void flush(std::string& out);
+
+    void reset() { n_pending_ = 0; }
+
+    size_t held() const { return n_pending_; }
+
+private:
+    unsigned char pending_[4];
+    size_t n_pending_ = 0;
+    size_t need_ = 0;
+};
+
+// Appends valid UTF-8 `data` to `out` as JNI "modified UTF-8": U+0000 becomes C0 80 and
+// supplementary characters become surrogate pairs, as NewStringUTF expects.
+void append_modified_utf8(const char* data, size_t n, std::string& out);
+
+// Appends UTF-16 `data` (a Java string's chars) to `out` as standard UTF-8: surrogate pairs
+// become one 4-byte sequence, unpaired surrogates become U+FFFD.
+void append_utf8_from_utf16(const uint16_t* data, size_t n, std::string& out);
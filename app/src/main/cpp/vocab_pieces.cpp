@@ -0,0 +1,39 @@
+#include "vocab_pieces.h"
+
+bool PieceTable::build(int32_t n_vocab, const Detokenizer& detokenize,
+                       const std::atomic<bool>& cancel) {
+    clear();
+
+    std::vector<char> arena;
+    std::vector<uint32_t> offsets;
+    arena.reserve((size_t) n_vocab * 6);
+    offsets.reserve((size_t) n_vocab + 1);
+
+    std::vector<char> buf(256);
+    for (int32_t id = 0; id < n_vocab; id++) {
+        if ((id & 1023) == 0 && cancel.load(std::memory_order_relaxed)) return false;
+
+        int n = detokenize(id, buf.data(), (int) buf.size());
+        if (n < 0) {
+            buf.resize(-n);
+            n = detokenize(id, buf.data(), (int) buf.size());
+        }
+        offsets.push_back((uint32_t) arena.size());
+        if (n > 0) arena.insert(arena.end(), buf.data(), buf.data() + n);
+    }
+    offsets.push_back((uint32_t) arena.size());
+    arena.shrink_to_fit();
+
+    arena_ = std::move(arena);
+    offsets_ = std::move(offsets);
+    ready_.store(true, std::memory_order_release);
+    return true;
+}
+
+void PieceTable::clear() {
+    ready_.store(false, std::memory_order_release);
+    arena_.clear();
+    arena_.shrink_to_fit();
+    offsets_.clear();
+    offsets_.shrink_to_fit();
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// ============================================================================
+// Vocabulary piece table
+// ============================================================================
+// The text of every token, detokenized once into one contiguous byte arena plus an offsets
+// array, so per-token detokenization is a bounds-checked slice with no allocation and no
+// call into the tokenizer. Built off the load path; lookups fail until it is ready.
+class PieceTable {
+public:
+    // Writes the piece of `token` to `buf`; returns its length, or -(required size).
+    using Detokenizer = std::function<int(int32_t token, char* buf, int len)>;
+
+    // Builds the table. Returns false (and leaves the table empty) if `cancel` was raised.
+    bool build(int32_t n_vocab, const Detokenizer& detokenize, const std::atomic<bool>& cancel);
+
+    // Only while no build is running.
+    void clear();
+
+    bool ready() const { return ready_.load(std::memory_order_acquire); }
+
+    bool lookup(int32_t token, const char*& data, size_t& n) const {
+        if (!ready() || token < 0 || (size_t) token + 1 >= offsets_.size()) return false;
+        data = arena_.data() + offsets_[token];
+        n = offsets_[token + 1] - offsets_[token];
+        return true;
+    }
+
+    size_t bytes() const { return arena_.size() + offsets_.size() * sizeof(uint32_t); }
+
+private:
+    std::vector<char> arena_;
+    std::vector<uint32_t> offsets_;         // n_vocab + 1 entries
+    std::atomic<bool> ready_{false};
+};
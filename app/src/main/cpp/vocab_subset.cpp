@@ -0,0 +1,93 @@
+#include "vocab_subset.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+
+// Layout: "XVSB", u32 version, u64 fingerprint, i32 n_vocab, u32 n, i32 ids[n].
+namespace {
+
+const char kMagic[4] = {'X', 'V', 'S', 'B'};
+const uint32_t kVersion = 1;
+
+using File = std::unique_ptr<FILE, int (*)(FILE*)>;
+
+template <typename T>
+bool write_pod(FILE* f, const T& v) {
+    return fwrite(&v, sizeof(T), 1, f) == 1;
+}
+
+template <typename T>
+bool read_pod(FILE* f, T& v) {
+    return fread(&v, sizeof(T), 1, f) == 1;
+}
+
+}  // namespace
+
+void VocabSubset::clear() {
+    ids_.clear();
+    n_vocab_ = 0;
+    fingerprint_ = 0;
+}
+
+void VocabSubset::build(const std::vector<int32_t>& tokens, int32_t n_vocab,
+                        uint64_t fingerprint) {
+    std::vector<uint8_t> seen(n_vocab, 0);
+    for (int32_t t : tokens) {
+        if (t >= 0 && t < n_vocab) seen[t] = 1;
+    }
+    ids_.clear();
+    for (int32_t id = 0; id < n_vocab; id++) {
+        if (seen[id]) ids_.push_back(id);
+    }
+    n_vocab_ = n_vocab;
+    fingerprint_ = fingerprint;
+}
+
+bool VocabSubset::contains(int32_t token) const {
+    return std::binary_search(ids_.begin(), ids_.end(), token);
+}
+
+void VocabSubset::gather(const float* logits, float* out) const {
+    const size_t n = ids_.size();
+    const int32_t* ids = ids_.data();
+    for (size_t i = 0; i < n; i++) out[i] = logits[ids[i]];
+}
+
+bool VocabSubset::save(const std::string& path) const {
+    File f(fopen(path.c_str(), "wb"), fclose);
+    if (!f) return false;
+    const uint32_t n = (uint32_t) ids_.size();
+    return fwrite(kMagic, 1, 4, f.get()) == 4 && write_pod(f.get(), kVersion) &&
+           write_pod(f.get(), fingerprint_) && write_pod(f.get(), n_vocab_) &&
+           write_pod(f.get(), n) && fwrite(ids_.data(), sizeof(int32_t), n, f.get()) == n;
+}
+
+bool VocabSubset::load(const std::string& path, int32_t n_vocab, uint64_t fingerprint) {
+    File f(fopen(path.c_str(), "rb"), fclose);
+    if (!f) return false;
+
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t file_fingerprint = 0;
+    int32_t file_n_vocab = 0;
+    uint32_t n = 0;
+    if (fread(magic, 1, 4, f.get()) != 4 || std::string(magic, 4) != std::string(kMagic, 4) ||
+        !read_pod(f.get(), version) || version != kVersion ||
+        !read_pod(f.get(), file_fingerprint) || file_fingerprint != fingerprint ||
+        !read_pod(f.get(), file_n_vocab) || file_n_vocab != n_vocab ||
+        !read_pod(f.get(), n) || n > (uint32_t) n_vocab) {
+        return false;
+    }
+    std::vector<int32_t> ids(n);
+    if (fread(ids.data(), sizeof(int32_t), n, f.get()) != n) return false;
+
+    // Must be sorted, unique and in range for gather/contains
+    for (uint32_t i = 0; i < n; i++) {
+        if (ids[i] < 0 || ids[i] >= n_vocab || (i > 0 && ids[i] <= ids[i - 1])) return false;
+    }
+    ids_ = std::move(ids);
+    n_vocab_ = n_vocab;
+    fingerprint_ = fingerprint;
+    return true;
+}
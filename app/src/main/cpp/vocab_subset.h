@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// Vocabulary subset for large-vocab small models
+// ============================================================================
+// The token ids a deployment actually needs: everything seen in a profiling corpus plus
+// special, control and byte-fallback tokens (so any text stays representable). Sampling
+// gathers only these logits, which shrinks every per-token pass over the vocabulary from
+// 150k-256k entries to the subset. The set is cached on disk, keyed by model fingerprint.
+class VocabSubset {
+public:
+    void clear();
+    bool empty() const { return ids_.empty(); }
+    size_t size() const { return ids_.size(); }
+
+    // Sorted, unique token ids.
+    const std::vector<int32_t>& ids() const { return ids_; }
+
+    // Builds the subset from token ids (duplicates and out-of-range ids are dropped).
+    void build(const std::vector<int32_t>& tokens, int32_t n_vocab, uint64_t fingerprint);
+
+    bool contains(int32_t token) const;
+
+    // logits[ids[i]] -> out[i]
+    void gather(const float* logits, float* out) const;
+
+    uint64_t fingerprint() const { return fingerprint_; }
+    int32_t n_vocab() const { return n_vocab_; }
+
+    bool save(const std::string& path) const;
+
+    // Fails if the file is missing, damaged or was built for another model.
+    bool load(const std::string& path, int32_t n_vocab, uint64_t fingerprint);
+
+private:
+    std::vector<int32_t> ids_;
+    int32_t n_vocab_ = 0;
+    uint64_t fingerprint_ = 0;
+};
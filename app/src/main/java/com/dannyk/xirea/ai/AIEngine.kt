@@ -8,12 +8,20 @@ import com.dannyk.xirea.data.model.AIModel
 import com.dannyk.xirea.data.model.ModelStatus
 import kotlinx.coroutines.Dispatchers
 import kotlinx.coroutines.channels.awaitClose
+import kotlinx.coroutines.currentCoroutineContext
+import kotlinx.coroutines.delay
 import kotlinx.coroutines.flow.Flow
 import kotlinx.coroutines.flow.callbackFlow
 import kotlinx.coroutines.flow.flowOn
+import kotlinx.coroutines.isActive
 import kotlinx.coroutines.launch
 import kotlinx.coroutines.withContext
+import org.json.JSONObject
 import java.io.File
+import java.nio.ByteBuffer
+import java.nio.CharBuffer
+import java.nio.charset.CodingErrorAction
+import kotlin.concurrent.thread
 
 /**
  * AI Engine for managing local AI model inference using llama.cpp.
@@ -23,19 +31,32 @@ class AIEngine(private val context: Context? = null) {
     
     companion object {
         private const val TAG = "AIEngine"
+        private const val FRAME_INTERVAL_MS = 16L
+        private const val TOKEN_DECODE_BUFFER = 4096
+        private const val AUTOTUNE_BUDGET_MS = 30_000
     }
     
     private val llamaCpp = LlamaCpp()
     private var loadedModel: AIModel? = null
     private var modelStatus: ModelStatus = ModelStatus.NOT_DOWNLOADED
-
-    private val tokenBlacklist = setOf(
-        "<|end|>", "<|endoftext|>", "<|assistant|>", "<|user|>",
-        "<|system|>", "<|im_end|>", "<|im_start|>", "<|eot_id|>",
-        "<|start_header_id|>", "<|end_header_id|>"
-    )
+    
+    // Background thread calibration and autotune of a model without a stored profile. They
+    // hold the native context while they run, so generating, loading and unloading stop them
+    // first.
+    @Volatile
+    private var tuneThread: Thread? = null
 
     private val roleMarkers = listOf("User:", "Assistant:", "System:")
+
+    // Stop sequences: if ANY of these appear in the generated text, native generation stops
+    // and the sequence is dropped from the output
+    private val stopSequences = arrayOf(
+        "\nUser:", "\nuser:", "\nHuman:", "\nhuman:",
+        "\nAssistant:", "\nassistant:",
+        "\nSystem:", "\nsystem:",
+        "\nQ:", "\nQuestion:",
+        "###", "<|", "\n\n\n"
+    )
     
     // Adaptive configuration based on device capabilities
     private val contextSize: Int
@@ -144,10 +165,12 @@ class AIEngine(private val context: Context? = null) {
             }
             
             // Unload any existing model
+            stopAutotune()
             if (llamaCpp.isModelLoaded()) {
                 llamaCpp.unloadModel()
             }
             
+            context?.let { llamaCpp.setProfileDir(File(it.filesDir, "tune").apply { mkdirs() }.absolutePath) }
             val nThreads = getOptimalThreadCount()
             val success = llamaCpp.loadModel(
                 modelPath = modelFile.absolutePath,
@@ -159,6 +182,7 @@ class AIEngine(private val context: Context? = null) {
             if (success) {
                 loadedModel = model
                 modelStatus = ModelStatus.LOADED
+                startAutotune(context != null && tuneSource() == "defaults")
                 Result.success(Unit)
             } else {
                 modelStatus = ModelStatus.ERROR
@@ -174,6 +198,7 @@ class AIEngine(private val context: Context? = null) {
      * Unload the currently loaded model.
      */
     fun unloadModel() {
+        stopAutotune()
         if (llamaCpp.isModelLoaded()) {
             llamaCpp.unloadModel()
         }
@@ -181,6 +206,57 @@ class AIEngine(private val context: Context? = null) {
         modelStatus = ModelStatus.NOT_DOWNLOADED
     }
     
+    /**
+     * Where the loaded model's thread/batch/KV settings came from: "defaults",
+     * "profile", "autotune" or "partial" (a cancelled tune, not saved).
+     */
+    private fun tuneSource(): String =
+        runCatching { JSONObject(llamaCpp.getModelInfo()).optString("tune_source") }.getOrDefault("")
+    
+    /**
+     * Whether the loaded model still waits for its thread calibration.
+     */
+    private fun calibrationPending(): Boolean = runCatching {
+        JSONObject(llamaCpp.getModelInfo()).getJSONObject("thread_calibration").optBoolean("pending")
+    }.getOrDefault(false)
+    
+    /**
+     * Calibrate the freshly loaded model's thread counts in the background, then, if
+     * [autotune], tune it. The profile a completed tune saves is applied by every later
+     * load of the model on this device; a tune cancelled by an early request saves nothing
+     * and runs again on the next load.
+     */
+    private fun startAutotune(autotune: Boolean) {
+        val calibrate = calibrationPending()
+        if (!calibrate && !autotune) return
+        tuneThread = thread(name = "xirea-autotune") {
+            if (calibrate) {
+                val result = llamaCpp.calibrateThreads()
+                Log.i(TAG, "Thread calibration finished: ${result.take(200)}")
+            }
+            if (autotune && !Thread.currentThread().isInterrupted) {
+                val result = llamaCpp.autotune(AUTOTUNE_BUDGET_MS)
+                Log.i(TAG, "Autotune finished: ${result.take(200)}")
+            }
+        }
+    }
+    
+    /**
+     * Stop a background autotune and wait for it; the best settings found so far are kept
+     * for this session.
+     * Cancelling is repeated because a cancel issued before the native call starts is lost;
+     * the interrupt keeps the thread from starting the autotune after a calibration.
+     */
+    private fun stopAutotune() {
+        val t = tuneThread ?: return
+        t.interrupt()
+        while (t.isAlive) {
+            llamaCpp.cancelAutotune()
+            t.join(50)
+        }
+        tuneThread = null
+    }
+    
     /**
      * Check if a model is currently loaded.
      */
@@ -205,27 +281,44 @@ class AIEngine(private val context: Context? = null) {
     
     /**
      * Build an optimized prompt with system instruction and conversation context.
-     * Uses ChatML-like format for better model understanding.
+     * Uses the model's own chat template when it ships one, so generation ends at the
+     * model's end-of-turn token; otherwise falls back to a plain "User:/Assistant:" format.
      */
     private fun buildPrompt(chatHistory: List<Pair<String, Boolean>>, userMessage: String): String {
-        val system = "System: You are Xirea, an offline AI assistant built into this Android app. " +
+        val system = "You are Xirea, an offline AI assistant built into this Android app. " +
             "Your name is Xirea. You were developed by Danyal Khattak, but you are not Danyal Khattak and must never claim to be him. " +
             "If asked your name, always respond exactly \"My name is Xirea.\" " +
             "If asked who created you, respond \"I was developed by Danyal Khattak.\" " +
             "Never claim to be the developer or any real human. Never switch roles or output \"User:\" or similar role labels in responses. " +
             "Only answer as the assistant. Provide helpful, concise answers and stop naturally at completion."
 
+        // Preserve recent conversation context
+        val historyLimit = when {
+            contextSize >= 2048 -> 10
+            contextSize >= 1536 -> 8
+            else -> 6
+        }
+        val recentHistory = chatHistory.takeLast(historyLimit)
+
+        val roles = ArrayList<String>(recentHistory.size + 2)
+        val contents = ArrayList<String>(recentHistory.size + 2)
+        roles.add("system")
+        contents.add(system)
+        for ((message, isUser) in recentHistory) {
+            roles.add(if (isUser) "user" else "assistant")
+            contents.add(message)
+        }
+        roles.add("user")
+        contents.add(userMessage)
+
+        llamaCpp.formatChat(roles.toTypedArray(), contents.toTypedArray(), addAssistant = true)
+            ?.let { return it }
+
         return buildString {
+            append("System: ")
             append(system)
             append("\n")
 
-            // Preserve recent conversation context
-            val historyLimit = when {
-                contextSize >= 2048 -> 10
-                contextSize >= 1536 -> 8
-                else -> 6
-            }
-            val recentHistory = chatHistory.takeLast(historyLimit)
             for ((message, isUser) in recentHistory) {
                 if (isUser) {
                     append("User: ").append(message).append("\n")
@@ -252,13 +345,63 @@ class AIEngine(private val context: Context? = null) {
         return out
     }
 
-    private fun cleanToken(token: String): String {
-        return token.takeIf { it.isNotBlank() && it !in tokenBlacklist } ?: ""
+    /**
+     * Drain the native token ring until generation finishes.
+     * Bytes are decoded in batches at most once per frame; a character split across
+     * two batches is carried over until its remaining bytes arrive.
+     */
+    private suspend fun drainTokenRing(onText: (String) -> Unit) {
+        val ring = llamaCpp.getTokenBuffer()
+        val decoder = Charsets.UTF_8.newDecoder()
+            .onMalformedInput(CodingErrorAction.REPLACE)
+            .onUnmappableCharacter(CodingErrorAction.REPLACE)
+        val carry = ByteBuffer.allocate(TOKEN_DECODE_BUFFER)
+        val chars = CharBuffer.allocate(TOKEN_DECODE_BUFFER)
+        var consumed = 0
+        
+        while (true) {
+            if (!currentCoroutineContext().isActive) {
+                llamaCpp.stopGeneration()
+                return
+            }
+            
+            val region = llamaCpp.poll(consumed)
+            consumed = 0
+            if (region < 0) return
+            
+            val length = (region and 0xFFFFFFFFL).toInt()
+            if (length == 0) {
+                llamaCpp.await(FRAME_INTERVAL_MS)
+                continue
+            }
+            
+            val offset = (region ushr 32).toInt()
+            var position = offset
+            while (position < offset + length) {
+                val n = minOf(offset + length - position, carry.remaining())
+                val slice = ring.duplicate()
+                slice.limit(position + n)
+                slice.position(position)
+                carry.put(slice)
+                position += n
+                
+                carry.flip()
+                decoder.decode(carry, chars, false)
+                carry.compact()
+                chars.flip()
+                if (chars.hasRemaining()) onText(chars.toString())
+                chars.clear()
+            }
+            consumed = length
+            
+            // Let tokens accumulate so the UI receives one batch per frame
+            if (offset + length < ring.capacity()) delay(FRAME_INTERVAL_MS)
+        }
     }
     
     /**
      * Generate a response from the AI model.
-     * This streams the response token by token with stop sequence detection.
+     * This streams the response in batches; stop sequences are matched natively.
      */
     fun generateResponse(prompt: String, chatHistory: List<Pair<String, Boolean>>): Flow<String> = callbackFlow {
         if (!llamaCpp.isModelLoaded() || loadedModel == null) {
@@ -270,39 +413,8 @@ class AIEngine(private val context: Context? = null) {
         // Build the full prompt
         val fullPrompt = buildPrompt(chatHistory, prompt)
         
-        // Full generated text for stop-sequence scanning
-        val fullResponse = StringBuilder()
-        // Pending buffer holds tokens not yet sent to UI (guarded against partial stop sequences)
+        // Pending buffer holds text not yet sent to UI (guarded against trailing role markers)
         val pendingBuffer = StringBuilder()
-        var shouldStop = false
-        
-        // Stop sequences: if ANY of these appear in the generated text, stop immediately
-        val stopSequences = listOf(
-            "\nUser:", "\nuser:", "\nHuman:", "\nhuman:",
-            "\nAssistant:", "\nassistant:",
-            "\nSystem:", "\nsystem:",
-            "\nQ:", "\nQuestion:",
-            "###", "<|", "\n\n\n"
-        )
-        
-        fun checkForStopSequence(): Boolean {
-            val text = fullResponse.toString()
-            for (seq in stopSequences) {
-                val idx = text.indexOf(seq)
-                if (idx >= 0) {
-                    // Found a stop sequence - truncate everything from it onward
-                    fullResponse.delete(idx, fullResponse.length)
-                    // Also truncate pending buffer
-                    val pendingText = pendingBuffer.toString()
-                    val pendingIdx = pendingText.indexOf(seq)
-                    if (pendingIdx >= 0) {
-                        pendingBuffer.delete(pendingIdx, pendingBuffer.length)
-                    }
-                    return true
-                }
-            }
-            return false
-        }
         
         fun flushPending(finalFlush: Boolean = false) {
             if (pendingBuffer.isEmpty()) return
@@ -315,7 +427,7 @@ class AIEngine(private val context: Context? = null) {
                 return
             }
             
-            // Guard: hold back the last 15 chars in case a stop sequence is forming
+            // Guard: hold back the last 15 chars so trailing role markers can be trimmed
             val guardSize = 15
             val safeLen = (pendingBuffer.length - guardSize).coerceAtLeast(0)
             if (safeLen == 0) return
@@ -325,34 +437,27 @@ class AIEngine(private val context: Context? = null) {
             pendingBuffer.delete(0, safeLen)
         }
         
-        try {
-            val callback = object : LlamaCpp.TokenCallback {
-                override fun onToken(token: String) {
-                    if (shouldStop) return
-                    
-                    val clean = cleanToken(token)
-                    if (clean.isEmpty()) return
-                    
-                    fullResponse.append(clean)
-                    pendingBuffer.append(clean)
-                    
-                    // Check if a stop sequence appeared
-                    if (checkForStopSequence()) {
-                        shouldStop = true
-                        llamaCpp.stopGeneration()
-                        return
-                    }
-                    
-                    flushPending(finalFlush = false)
-                }
-            }
+        // Special tokens are suppressed in the native sampler, so text arrives clean
+        fun onText(text: String) {
+            if (text.isEmpty()) return
             
+            pendingBuffer.append(text)
+            flushPending(finalFlush = false)
+        }
+        
+        try {
             val job = launch(Dispatchers.IO) {
-                llamaCpp.generate(
-                    prompt = fullPrompt,
+                stopAutotune()
+                val started = llamaCpp.startGeneration(
+                    prompt = fullPrompt.toByteArray(Charsets.UTF_8),
                     maxTokens = maxGenerationTokens,
-                    callback = callback
+                    stopSequences = stopSequences
                 )
+                if (started) {
+                    drainTokenRing(::onText)
+                } else {
+                    Log.e(TAG, "Native generation could not be started")
+                }
             }
 
             job.invokeOnCompletion {
@@ -381,5 +486,9 @@ class AIEngine(private val context: Context? = null) {
             "{}"
         }
     }
+    
+    /**
+     * Get timing statistics of the most recent generation.
+     */
+    fun getGenerationStats(): String = llamaCpp.getGenerationStats()
 }
-
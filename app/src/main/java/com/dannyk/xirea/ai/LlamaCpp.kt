@@ -1,5 +1,7 @@
 package com.dannyk.xirea.ai
 
+import java.nio.ByteBuffer
+
 /**
  * JNI wrapper for llama.cpp native library.
  * This class provides the bridge between Kotlin and the native C++ code.
@@ -10,6 +12,28 @@ class LlamaCpp {
         init {
             System.loadLibrary("xirea")
         }
+        
+        /** Repetition policies for [setRepetitionPolicy]. */
+        const val REPETITION_OFF = 0
+        const val REPETITION_STOP = 1
+        const val REPETITION_PENALIZE = 2
+        
+        /** Negative results of [generateUtf8]. */
+        const val UTF8_ERROR_NOT_LOADED = -1
+        const val UTF8_ERROR_BUSY = -2
+        const val UTF8_ERROR_BAD_BUFFER = -3
+        const val UTF8_ERROR_TOKENIZE = -4
+        const val UTF8_ERROR_PREFILL = -5
+        const val UTF8_ERROR_GRAMMAR = -6
+        
+        /** Modes for [setParallelTokenization]. */
+        const val PARALLEL_TOKENIZE_OFF = 0
+        const val PARALLEL_TOKENIZE_ON = 1
+        const val PARALLEL_TOKENIZE_VERIFY = 2
+        
+        /** Replay modes for [replay]. */
+        const val REPLAY_FORCE = 0
+        const val REPLAY_REGENERATE = 1
     }
     
     /**
@@ -43,27 +67,496 @@ class LlamaCpp {
      */
     external fun stopGeneration()
     
+    /**
+     * Enable or disable aborting an in-flight decode step when generation is stopped.
+     * When enabled, a stop request interrupts the current graph computation instead of
+     * waiting for the whole prompt chunk; the stop-to-idle latency is reported in
+     * [getGenerationStats] so both modes can be compared.
+     */
+    external fun setAbortOnStop(enabled: Boolean)
+    
     /**
      * Generate text based on the given prompt.
      * Tokens are streamed via the callback as they're generated.
      * 
      * @param prompt The input prompt
      * @param maxTokens Maximum number of tokens to generate
+     * @param stopSequences Generation stops when any of these appears in the output;
+     *   the stop sequence itself is not returned
+     * @param sampler Sampling settings; see [SamplerConfig]
      * @param callback Callback for receiving generated tokens
      * @return The complete generated response
      */
-    external fun generate(
+    fun generate(
+        prompt: String,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        sampler: SamplerConfig = SamplerConfig.CHAT,
+        callback: TokenCallback
+    ): String = generateNative(prompt, maxTokens, null, sampler, stopSequences, callback)
+    
+    /**
+     * Generate text constrained by a GBNF grammar (rule `root` is the entry point).
+     * Non-recursive grammars run on cached per-state token masks; recursive ones fall
+     * back to llama.cpp's grammar sampler. Per-token overhead is in [getGenerationStats].
+     * 
+     * @param grammar GBNF grammar the output must match
+     * @return The complete generated response, or "Error: Invalid grammar"
+     */
+    fun generate(
         prompt: String,
         maxTokens: Int = 512,
+        grammar: String,
+        stopSequences: Array<String> = emptyArray(),
+        sampler: SamplerConfig = SamplerConfig.CHAT,
+        callback: TokenCallback
+    ): String = generateNative(prompt, maxTokens, grammar, sampler, stopSequences, callback)
+    
+    private external fun generateNative(
+        prompt: String,
+        maxTokens: Int,
+        grammar: String?,
+        sampler: SamplerConfig,
+        stopSequences: Array<String>,
         callback: TokenCallback
     ): String
     
+    /**
+     * Generate from a prompt given as standard UTF-8 bytes, writing the response into a
+     * direct [output] buffer. No Java strings are created: the prompt is copied once into
+     * native memory and generated bytes go straight into [output], which only ever holds
+     * whole UTF-8 characters. If [output] fills up, generation stops there
+     * (`output_truncated` in [getGenerationStats]).
+     * 
+     * @param prompt UTF-8 prompt bytes
+     * @param output Direct buffer receiving the response from its position on; the position
+     *   is advanced past the written bytes
+     * @param callback Notified of each newly written region of [output]; may be null
+     * @return Bytes written, or one of the negative `UTF8_ERROR_*` codes
+     */
+    fun generateUtf8(
+        prompt: ByteArray,
+        output: ByteBuffer,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        sampler: SamplerConfig = SamplerConfig.CHAT,
+        grammar: String? = null,
+        callback: Utf8Callback? = null
+    ): Int = generateUtf8Into(prompt, null, 0, prompt.size, output, maxTokens, stopSequences,
+        sampler, grammar, callback)
+    
+    /**
+     * Same as the [ByteArray] variant, reading the prompt from [prompt]'s position to its
+     * limit. Direct buffers are read in place; heap buffers through their backing array.
+     */
+    fun generateUtf8(
+        prompt: ByteBuffer,
+        output: ByteBuffer,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        sampler: SamplerConfig = SamplerConfig.CHAT,
+        grammar: String? = null,
+        callback: Utf8Callback? = null
+    ): Int = if (prompt.isDirect) {
+        generateUtf8Into(null, prompt, prompt.position(), prompt.remaining(), output, maxTokens,
+            stopSequences, sampler, grammar, callback)
+    } else {
+        generateUtf8Into(prompt.array(), null, prompt.arrayOffset() + prompt.position(),
+            prompt.remaining(), output, maxTokens, stopSequences, sampler, grammar, callback)
+    }
+    
+    private fun generateUtf8Into(
+        promptBytes: ByteArray?,
+        promptBuffer: ByteBuffer?,
+        promptOffset: Int,
+        promptLength: Int,
+        output: ByteBuffer,
+        maxTokens: Int,
+        stopSequences: Array<String>,
+        sampler: SamplerConfig,
+        grammar: String?,
+        callback: Utf8Callback?
+    ): Int {
+        require(output.isDirect) { "output must be a direct ByteBuffer" }
+        val start = output.position()
+        val written = generateUtf8Native(promptBytes, promptBuffer, promptOffset, promptLength,
+            maxTokens, grammar, sampler, stopSequences, output, start, output.remaining(),
+            callback?.let { Utf8Callback { offset, length -> it.onBytes(start + offset, length) } })
+        if (written > 0) output.position(start + written)
+        return written
+    }
+    
+    private external fun generateUtf8Native(
+        promptBytes: ByteArray?,
+        promptBuffer: ByteBuffer?,
+        promptOffset: Int,
+        promptLength: Int,
+        maxTokens: Int,
+        grammar: String?,
+        sampler: SamplerConfig,
+        stopSequences: Array<String>,
+        output: ByteBuffer,
+        outputOffset: Int,
+        outputCapacity: Int,
+        callback: Utf8Callback?
+    ): Int
+    
+    /**
+     * Start generating on a native background thread.
+     * Generated UTF-8 bytes are written into the token ring returned by [getTokenBuffer]
+     * and drained with [poll] / [await] instead of per-token callbacks.
+     * 
+     * @param prompt The input prompt
+     * @param maxTokens Maximum number of tokens to generate
+     * @param stopSequences Generation stops when any of these appears in the output;
+     *   matched natively, the stop sequence itself never reaches the token ring
+     * @param grammar Optional GBNF grammar the output must match (rule `root`)
+     * @param sampler Sampling settings; see [SamplerConfig]
+     * @return true if generation started, false if no model is loaded or one is running
+     */
+    external fun startGeneration(
+        prompt: String,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        grammar: String? = null,
+        sampler: SamplerConfig = SamplerConfig.CHAT
+    ): Boolean
+    
+    /**
+     * [startGeneration] with the prompt given as standard UTF-8 bytes, copied once into
+     * native memory without going through a Java string.
+     */
+    fun startGeneration(
+        prompt: ByteArray,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        grammar: String? = null,
+        sampler: SamplerConfig = SamplerConfig.CHAT
+    ): Boolean = startGenerationUtf8Native(prompt, null, 0, prompt.size, maxTokens,
+        stopSequences, grammar, sampler)
+    
+    /**
+     * [startGeneration] reading UTF-8 prompt bytes from a direct buffer's position to its limit.
+     */
+    fun startGeneration(
+        prompt: ByteBuffer,
+        maxTokens: Int = 512,
+        stopSequences: Array<String> = emptyArray(),
+        grammar: String? = null,
+        sampler: SamplerConfig = SamplerConfig.CHAT
+    ): Boolean {
+        require(prompt.isDirect) { "prompt must be a direct ByteBuffer" }
+        return startGenerationUtf8Native(null, prompt, prompt.position(), prompt.remaining(),
+            maxTokens, stopSequences, grammar, sampler)
+    }
+    
+    private external fun startGenerationUtf8Native(
+        promptBytes: ByteArray?,
+        promptBuffer: ByteBuffer?,
+        promptOffset: Int,
+        promptLength: Int,
+        maxTokens: Int,
+        stopSequences: Array<String>,
+        grammar: String?,
+        sampler: SamplerConfig
+    ): Boolean
+    
+    /**
+     * Direct ByteBuffer over the native token ring. The buffer is owned by the
+     * native library and stays valid for the lifetime of the process.
+     */
+    external fun getTokenBuffer(): ByteBuffer
+    
+    /**
+     * Release [consumed] bytes of the previously returned region and fetch the next one.
+     * 
+     * @return The next readable region of the token ring packed as
+     *   `(offset shl 32) or length`, 0 if nothing is readable yet,
+     *   or -1 once generation finished and the ring is drained
+     */
+    external fun poll(consumed: Int): Long
+    
+    /**
+     * Block until generated bytes are readable, generation finished, or the timeout elapsed.
+     * 
+     * @return true if [poll] has something to report
+     */
+    external fun await(timeoutMs: Long): Boolean
+    
     /**
      * Get information about the loaded model.
      * Returns a JSON string with model details.
      */
     external fun getModelInfo(): String
     
+    /**
+     * Get timing statistics of the most recent generation.
+     * Returns a JSON string with prefill/decode timings and throughput.
+     */
+    external fun getGenerationStats(): String
+    
+    /**
+     * Save the most recent generation as a replay trace: prompt tokens, generated
+     * tokens, sampler settings, the seed that was actually used, and the grammar,
+     * repetition policy and special-token exceptions it ran with.
+     * @return false if nothing was recorded, a generation is running, or the write failed
+     */
+    external fun saveTrace(path: String): Boolean
+    
+    /**
+     * Load a trace written by [saveTrace] (possibly on another build or device).
+     * Subsequent [replay] calls use it instead of the last generation.
+     */
+    external fun loadTrace(path: String): Boolean
+    
+    /**
+     * Re-run the loaded trace, or the last generation if none was loaded, so decode
+     * performance can be compared on identical work. Blocks the calling thread.
+     * [REPLAY_FORCE] decodes the recorded tokens without sampling; [REPLAY_REGENERATE]
+     * samples again with the recorded seed and settings. Replays do not replace the
+     * last generation's trace.
+     * Returns a JSON string with `diverged_at` (-1 if the replayed tokens are identical)
+     * and the generation `stats`.
+     */
+    external fun replay(mode: Int = REPLAY_FORCE): String
+    
+    /**
+     * Microbenchmark of the llama.cpp top-k/top-p/temp/dist chain against the fused
+     * native top-k/top-p, min-p and greedy samplers on synthetic logits. Does not need a
+     * loaded model; pass the vocab size of the model of interest (e.g. 32000, 151936,
+     * 262144). Returns a JSON string with microseconds per token for each and whether
+     * the seeded fused sampler reproduced its own picks.
+     */
+    external fun benchmarkSampler(nVocab: Int, iterations: Int = 200): String
+    
+    /**
+     * Microbenchmark of per-token detokenization on the loaded model: a fresh string per
+     * token, a reused buffer, and the precomputed piece table (built in the background
+     * after [loadModel]). Returns a JSON string with nanoseconds per token for each, or
+     * an error if the table is not ready yet.
+     */
+    external fun benchmarkDetokenize(iterations: Int = 100000): String
+    
+    /**
+     * Benchmark of prompt tokenization on the loaded model: single-threaded
+     * `llama_tokenize` against the chunked parallel tokenizer, on [sample] repeated to
+     * 10k, 25k and 50k bytes. Returns a JSON string with milliseconds per run for both,
+     * the number of chunks and whether the token sequences were identical.
+     */
+    external fun benchmarkTokenize(sample: String, iterations: Int = 5): String
+    
+    /**
+     * Self-check that the native argmax used for temperature 0 picks the same token as
+     * llama.cpp's greedy sampler on synthetic logits. Does not need a loaded model.
+     */
+    external fun checkGreedySampler(nVocab: Int, iterations: Int = 100): Boolean
+    
+    /**
+     * Feeds raw token bytes through the native streaming UTF-8 assembler used by
+     * generation. Element i is the text released by piece i (empty while a character is
+     * still incomplete); the last element is the end-of-stream flush. Does not need a
+     * loaded model.
+     */
+    external fun assembleUtf8(pieces: Array<ByteArray>): Array<String>
+    
+    /**
+     * The UTF-8 bytes native code receives for [text] (standard UTF-8, supplementary
+     * characters as 4-byte sequences, unpaired surrogates as U+FFFD). Does not need a
+     * loaded model.
+     */
+    external fun encodeUtf8(text: String): ByteArray
+    
+    /**
+     * Format a conversation with the chat template embedded in the loaded model.
+     * Generation of a prompt built this way ends at the template's end-of-turn token.
+     * 
+     * @param roles Message roles ("system", "user", "assistant"), parallel to [contents]
+     * @param contents Message texts
+     * @param addAssistant Append the prefix that opens the assistant's turn
+     * @return The formatted prompt, or null if the model has no usable template
+     */
+    external fun formatChat(
+        roles: Array<String>,
+        contents: Array<String>,
+        addAssistant: Boolean = true
+    ): String?
+    
+    /**
+     * Configure which special/control tokens may still be sampled.
+     * All other control tokens, and added tokens that are chat markers such as
+     * `<|im_start|>` or `[INST]`, are masked out of the sampler when the model is loaded,
+     * so they are never generated, decoded or delivered.
+     * 
+     * @param allowEog Keep end-of-generation tokens samplable so turns can end
+     * @param allowed Token texts (e.g. "<|im_end|>") exempt from suppression
+     * @return false (nothing changed) while a generation is running
+     */
+    external fun setSpecialTokenExceptions(allowEog: Boolean, allowed: Array<String>): Boolean
+    
+    /**
+     * Build a vocabulary subset for the loaded model from a profiling corpus: every token
+     * the corpus uses plus special, control, byte and single-byte tokens. The subset is
+     * written to [cachePath] (keyed by model fingerprint) for [loadVocabSubset].
+     * @return Subset size, or -1 if no model is loaded or a generation is running
+     */
+    external fun buildVocabSubset(corpus: String, cachePath: String): Int
+    
+    /**
+     * Load a subset cached by [buildVocabSubset]. Fails if the file belongs to another model.
+     */
+    external fun loadVocabSubset(cachePath: String): Boolean
+    
+    /**
+     * Experimental: sample only from the vocabulary subset. Off by default.
+     * The model still computes logits for the full vocabulary (llama.cpp offers no way to
+     * prune the output projection), so only the per-token sampling work over them shrinks,
+     * and tokens outside the subset can no longer be generated. Check the trade-off with
+     * [evaluateVocabSubset] before enabling it.
+     */
+    external fun setVocabSubsetEnabled(enabled: Boolean)
+    
+    /**
+     * Compare full-vocabulary and subset sampling teacher-forced over [text].
+     * Returns a JSON string with coverage of the actual next tokens, greedy agreement,
+     * perplexity on covered positions, sampling cost per token, and decode tok/s
+     * estimated from the last generation.
+     */
+    external fun evaluateVocabSubset(text: String): String
+    
+    /**
+     * Control parallel tokenization of long prompts (8 KB and up). Prompts are cut at
+     * whitespace the model's pre-tokenizer never merges across and the chunks are
+     * tokenized on worker threads. [PARALLEL_TOKENIZE_ON] checks the first parallel run per
+     * model against single-threaded tokenization and falls back for good if they differ;
+     * [PARALLEL_TOKENIZE_VERIFY] checks every run. Time and chunk count are reported as
+     * `tokenize_ms` / `tokenize_chunks` in [getGenerationStats].
+     */
+    external fun setParallelTokenization(mode: Int)
+    
+    /**
+     * Choose how generation reacts when the output becomes a repetition loop.
+     * [REPETITION_STOP] ends generation, [REPETITION_PENALIZE] bans the token that would
+     * continue the loop and only stops if the loop persists. The termination reason is
+     * reported as `stop_reason` in [getGenerationStats].
+     */
+    external fun setRepetitionPolicy(policy: Int)
+    
+    /**
+     * Restrict inference threads to the performance cores found at startup (from the
+     * cpufreq / cpu_capacity sysfs entries). The thread count already defaults to the number
+     * of performance cores; pinning also keeps the scheduler from migrating ggml workers
+     * onto efficiency cores. Has no effect on SoCs whose cores are all alike. Called during
+     * a generation, the worker pools pick up the new mask once it ends.
+     */
+    external fun setThreadAffinity(pinToPerformanceCores: Boolean)
+    
+    /**
+     * Fix the thread counts for prompt evaluation (compute-bound) and per-token decode
+     * (memory-bound) instead of calibrating them; 0 keeps the current value.
+     * Both are reported in [getModelInfo], and the counts a generation actually used as
+     * `threads_prefill` / `threads_decode` next to `prefill_tps` / `decode_tps` in
+     * [getGenerationStats].
+     */
+    external fun setThreadCounts(prefillThreads: Int, decodeThreads: Int)
+    
+    /**
+     * Run the thread calibration: a short synthetic prefill and decode at several thread
+     * counts, bounded to a few seconds. [loadModel] without a stored profile marks it
+     * `pending` (under `thread_calibration` in [getModelInfo]) and [AIEngine] runs it in
+     * the background. Applies the fastest pair and re-enables calibration for later loads.
+     * Blocks; [cancelAutotune], [loadModel] and [unloadModel] stop it early, leaving it
+     * pending. Returns a JSON string with the chosen counts and the measured tok/s of
+     * every candidate.
+     */
+    external fun calibrateThreads(): String
+    
+    /**
+     * Greedy generation of [prompt] with threads on all cores, one per performance core,
+     * and the same pinned to the performance cores. Returns a JSON string with prefill and
+     * decode tok/s for each and the decode speedup over the all-core baseline.
+     */
+    external fun benchmarkThreadPlacement(prompt: String, maxTokens: Int = 64): String
+    
+    /**
+     * Force a ggml CPU backend variant by name, e.g. "android_armv8.2_2" (null picks the
+     * most capable one the CPU runs, the default). arm64 builds ship one backend per
+     * instruction-set level: armv8.0, dotprod, dotprod+fp16, +i8mm and armv9 with SVE2.
+     * x86_64 builds ship levels from x64 up to AVX512. Only with no model loaded; returns
+     * false if the variant is unknown, needs features the CPU lacks, or fails to load. The
+     * loaded variant is `cpu_variant` in [getModelInfo].
+     */
+    external fun setCpuVariant(variant: String?): Boolean
+    
+    /**
+     * CPU features found at runtime, the loaded backend variant and every variant this
+     * device can run (most capable first), as a JSON string.
+     */
+    external fun getCpuVariants(): String
+    
+    /**
+     * Turn the thermal governor on or off (it is on by default). During a generation it
+     * measures decode tok/s over windows of tokens and reads the CPU thermal zones when
+     * the device exposes them. At or above [hotCelsius] it stops the workers spinning,
+     * then drops one thread per window. When tok/s sags it tries fewer threads. Once below
+     * [coolCelsius] it gives the work back, keeping only changes that hold the throughput.
+     * Its decisions are listed under `governor` in [getGenerationStats]. Values <= 0 keep
+     * the current thresholds (75 and 60 by default).
+     */
+    external fun setThermalGovernor(enabled: Boolean, hotCelsius: Float = 0f, coolCelsius: Float = 0f)
+    
+    /**
+     * Configure the persistent ggml worker pools used for prompt evaluation and decode.
+     * With pools the workers outlive each graph: between tokens they spin for a while
+     * before sleeping ([poll] 0..100, 0 sleeps at once, 100 spins longest). Builds with a
+     * single CPU backend also park them whenever no generation runs; with per-CPU backend
+     * variants they fall asleep after the poll period instead. [priority] is a ggml
+     * scheduling priority (-1 low, 0 normal, 1 medium, 2 high, 3 realtime; raising it may
+     * need privileges); the calling thread's own priority is restored after each generation.
+     * Disabled, ggml starts its workers for every graph. Returns false while generating.
+     */
+    external fun setThreadPool(enabled: Boolean, poll: Int = 50, priority: Int = 0): Boolean
+    
+    /**
+     * Greedy generation of [prompt] with per-graph workers and with pools that sleep,
+     * poll and spin between tokens. Returns a JSON string with decode tok/s, median and
+     * 95th percentile inter-token latency and process CPU milliseconds per token for each.
+     */
+    external fun benchmarkThreadPool(prompt: String, maxTokens: Int = 64): String
+    
+    /**
+     * Directory for autotune profiles (null disables them). [loadModel] applies the profile
+     * stored for the model on this device, if any, instead of the RAM-based defaults and
+     * the thread calibration; `tune_source` in [getModelInfo] tells which was used.
+     */
+    external fun setProfileDir(dir: String?)
+    
+    /**
+     * Tune thread counts, batch size and KV cache type / flash attention for the loaded
+     * model on this device. Settings are swept one at a time, each measured with a short
+     * synthetic prefill and decode, until [budgetMs] runs out; the one with the lowest
+     * estimated latency for a 256-token prompt plus 128 generated tokens is applied and
+     * saved to the profile directory. Blocks; returns a JSON string with every trial.
+     * [AIEngine] runs it in the background after loading a model that has no profile yet.
+     * [loadModel] and [unloadModel] cancel a running tune and wait for it to stop.
+     */
+    external fun autotune(budgetMs: Int = 30_000): String
+    
+    /**
+     * Stop a running [autotune] after the current measurement. The best configuration
+     * found so far is applied for this session only (`tune_source` "partial"); nothing is
+     * saved, so the next load without a profile tunes again.
+     */
+    external fun cancelAutotune()
+    
+    /**
+     * Set the target latency of a single prompt-evaluation step.
+     * Prompt chunks are sized so that one step stays under this target,
+     * keeping stop requests and other work responsive during long prompts.
+     * 
+     * @param targetMs Target step latency in milliseconds (0 = fixed full-batch chunks)
+     */
+    external fun setPrefillLatencyTarget(targetMs: Int)
+    
     /**
      * Get the context size of the loaded model.
      */
@@ -74,6 +567,54 @@ class LlamaCpp {
      */
     external fun isGenerating(): Boolean
     
+    /**
+     * Per-request sampling settings. Every request gets its own sampler and random state.
+     * 
+     * @param topK Candidates kept before the nucleus cut (1..256)
+     * @param topP Nucleus probability mass
+     * @param temperature Sampling temperature; 0 picks the most likely token every step
+     *   (deterministic, vectorized argmax without building a candidate list)
+     * @param minP When > 0, keep every token at least this likely relative to the top
+     *   one and sample among them (single pass, no sorting); [topK] and [topP] are ignored
+     * @param seed Random seed for reproducible output, or [RANDOM_SEED]. The native RNG is
+     *   32-bit; the high half is folded into the low half
+     */
+    data class SamplerConfig(
+        val topK: Int = 20,
+        val topP: Float = 0.85f,
+        val temperature: Float = 0.6f,
+        val minP: Float = 0f,
+        val seed: Long = RANDOM_SEED
+    ) {
+        companion object {
+            const val RANDOM_SEED = -1L
+            
+            /** Near-greedy chat defaults. */
+            val CHAT = SamplerConfig()
+            
+            /** Greedy decoding for titles, extraction and evaluation. */
+            val DETERMINISTIC = SamplerConfig(temperature = 0f)
+            
+            /** Wider, hotter sampling for open-ended writing. */
+            val CREATIVE = SamplerConfig(topK = 40, topP = 0.95f, temperature = 0.9f)
+            
+            /** Min-p sampling, adapts the candidate count to the model's confidence. */
+            val MIN_P = SamplerConfig(temperature = 0.7f, minP = 0.05f)
+        }
+    }
+    
+    /**
+     * Callback for [generateUtf8]. Called on a native delivery thread while the next token
+     * is decoded.
+     */
+    fun interface Utf8Callback {
+        /**
+         * Bytes `[offset, offset + length)` of the output buffer were just written; they
+         * are whole UTF-8 characters and are not changed afterwards.
+         */
+        fun onBytes(offset: Int, length: Int)
+    }
+    
     /**
      * Callback interface for receiving generated tokens.
      */